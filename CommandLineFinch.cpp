@@ -15,6 +15,7 @@ using namespace std;
 void printMenu() {
     std::cout << "Finch Test Menu: \n"
               << "A - print accelerometer values\n"
+              << "a - print all sensor values at once\n"
               << "o - print orientation state\n"
               << "L - print light sensor values\n"
               << "I - print IR sensor values\n"
@@ -36,11 +37,13 @@ int main(int /*argc*/, char* /*argv*/[]) {
         return -1;
     }
 
-    double* accel = 0;
-    int* lightSense = 0;
-    int* obstacles = 0;
+    Finch::Accel accel;
+    Finch::LightSensors lightSense;
+    Finch::ObstacleSensors obstacles;
+    Finch::Temperature temperature;
+    Finch::Sensors sensors;
+    int orientation;
     char option = 0;
-    double temperature;
     int leftSpeed, rightSpeed;
     int rLED, gLED, bLED;
     int frequency;
@@ -58,38 +61,57 @@ int main(int /*argc*/, char* /*argv*/[]) {
         cin.ignore(10000, '\n');
         switch(option) {
             case 'A':
-                accel = myFinch.getAccelerations();
-                cout << "X: " << accel[0]
-                     << ", Y: " << accel[1]
-                     << ", Z: " << accel[2] << '\n';
-                delete [] accel;
-                accel = 0;
+                accel = myFinch.readAccelerations();
+                if (accel.ok) {
+                    cout << "X: " << accel.x
+                         << ", Y: " << accel.y
+                         << ", Z: " << accel.z << '\n';
+                }
+                break;
+            case 'a':
+                if (myFinch.readAll(sensors) == 1) {
+                    cout << "X: " << sensors.accelerations[0]
+                         << ", Y: " << sensors.accelerations[1]
+                         << ", Z: " << sensors.accelerations[2] << '\n'
+                         << "Tapped: " << sensors.tapped
+                         << ", Shaken: " << sensors.shaken << '\n'
+                         << "Light Left: " << sensors.lightSensors[0]
+                         << ", Right: " << sensors.lightSensors[1] << '\n'
+                         << "Obstacle Left: " << sensors.obstacleSensors[0]
+                         << ", Right: " << sensors.obstacleSensors[1] << '\n'
+                         << sensors.temperature << " Celsius\n";
+                }
                 break;
             case 'o':
-                cout << "Level: " << myFinch.isFinchLevel() << '\n'
-                     << "Beak Up: " << myFinch.isBeakUp() << '\n'
-                     << "Beak Down: " << myFinch.isBeakDown() << '\n'
-                     << "Upside Down: " << myFinch.isFinchUpsideDown() << '\n'
-                     << "Left Wheel Down: " << myFinch.isLeftWingDown() << '\n'
-                     << "Right Wheel Down: " << myFinch.isRightWingDown() << '\n';
+                orientation = myFinch.classifyOrientation();
+                if (orientation != -1) {
+                    cout << "Level: " << ((orientation & Finch::LEVEL) != 0) << '\n'
+                         << "Beak Up: " << ((orientation & Finch::BEAK_UP) != 0) << '\n'
+                         << "Beak Down: " << ((orientation & Finch::BEAK_DOWN) != 0) << '\n'
+                         << "Upside Down: " << ((orientation & Finch::UPSIDE_DOWN) != 0) << '\n'
+                         << "Left Wheel Down: " << ((orientation & Finch::LEFT_WING_DOWN) != 0) << '\n'
+                         << "Right Wheel Down: " << ((orientation & Finch::RIGHT_WING_DOWN) != 0) << '\n';
+                }
                 break;
             case 'L':
-                lightSense = myFinch.getLightSensors();
-                cout << "Left: " << lightSense[0]
-                     << ", Right: " << lightSense[1] << '\n';
-                delete [] lightSense;
-                lightSense = 0;
+                lightSense = myFinch.readLightSensors();
+                if (lightSense.ok) {
+                    cout << "Left: " << lightSense.left
+                         << ", Right: " << lightSense.right << '\n';
+                }
                 break;
             case 'I':
-                obstacles = myFinch.getObstacleSensors();
-                cout << "Left: " << obstacles[0]
-                     << ", Right: " << obstacles[1] << '\n';
-                delete [] obstacles;
-                obstacles = 0;
+                obstacles = myFinch.readObstacleSensors();
+                if (obstacles.ok) {
+                    cout << "Left: " << obstacles.left
+                         << ", Right: " << obstacles.right << '\n';
+                }
                 break;
             case 'T':
-                temperature = myFinch.getTemperature();
-                cout << temperature << " Celcius\n";
+                temperature = myFinch.readTemperature();
+                if (temperature.ok) {
+                    cout << temperature.celsius << " Celsius\n";
+                }
                 break;
             case 'S':
                 shaken = myFinch.wasShaken();
@@ -0,0 +1,483 @@
+/*
+* File:   FinchBench.cpp
+*
+* Benchmarks for the Finch library, written to standard output as JSON so
+* the results can be kept and compared from one build to the next:
+*
+*  - the time to connect, and to get the first reply;
+*  - the latency distribution of every sensor getter, and how many heap
+*    allocations each call makes;
+*  - the fastest setLED()/setMotors() rate that can be kept up, with and
+*    without coalescing;
+*  - how round trips scale when several threads share one Finch;
+*  - what the keep-alive check costs, and what it does to round trips;
+*  - the library's own per-command breakdown (Finch::stats()) of all that.
+*
+* "make bench" runs it against the simulated Finch (src/hid-sim.c), so no
+* robot is needed; "make bench-backends" runs it on a real Finch with each
+* Linux backend. The arguments are the number of calls timed for each
+* getter (1000 by default) and the length of each throughput run in
+* milliseconds (1000 by default).
+*/
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include "Finch.h"
+
+using namespace std;
+
+namespace {
+
+const int warmUp = 20;
+const int maxThreads = 8;
+
+// Heap allocations made through operator new, counted by the replacements
+// at the bottom of this file.
+unsigned long allocations = 0;
+
+unsigned long allocationCount() {
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return double(ts.tv_sec) * 1e6 + double(ts.tv_nsec) / 1e3;
+}
+
+// The latencies of a run of calls, in microseconds.
+struct Latencies {
+    vector<double> samples;
+    int failures;
+
+    Latencies() : failures(0) {
+    }
+
+    double percentile(double p) {
+        if (samples.empty()) {
+            return 0;
+        }
+        size_t index = size_t(p * double(samples.size()));
+        if (index >= samples.size()) {
+            index = samples.size() - 1;
+        }
+        return samples[index];
+    }
+
+    double mean() const {
+        double total = 0;
+        for (size_t i = 0; i < samples.size(); i++) {
+            total += samples[i];
+        }
+        return samples.empty() ? 0 : total / double(samples.size());
+    }
+
+    // Writes the summary as the members of a JSON object.
+    void print() {
+        sort(samples.begin(), samples.end());
+        printf("\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f, \"failures\": %d",
+               mean(), percentile(0.5), percentile(0.99), percentile(0.999),
+               samples.empty() ? 0 : samples.back(), failures);
+    }
+};
+
+// The getters, each wrapped to return -1 if it failed (where it can tell).
+typedef int (*Getter)(Finch& finch);
+
+int getTemperature(Finch& finch) {
+    // -1 is a real temperature too, so failures here can't be told apart.
+    finch.getTemperature();
+    return 1;
+}
+
+int getAccelerations(Finch& finch) {
+    double* accelerations = finch.getAccelerations();
+    delete[] accelerations;
+    return 1;
+}
+
+int getLightSensors(Finch& finch) {
+    int* lightSensors = finch.getLightSensors();
+    delete[] lightSensors;
+    return 1;
+}
+
+int getObstacleSensors(Finch& finch) {
+    int* obstacleSensors = finch.getObstacleSensors();
+    delete[] obstacleSensors;
+    return 1;
+}
+
+int readAll(Finch& finch) {
+    Finch::Sensors sensors;
+    return finch.readAll(sensors);
+}
+
+int readAccelerations(Finch& finch) {
+    return finch.readAccelerations().ok ? 1 : -1;
+}
+
+int readLightSensors(Finch& finch) {
+    return finch.readLightSensors().ok ? 1 : -1;
+}
+
+int readObstacleSensors(Finch& finch) {
+    return finch.readObstacleSensors().ok ? 1 : -1;
+}
+
+int readTemperature(Finch& finch) {
+    return finch.readTemperature().ok ? 1 : -1;
+}
+
+int wasTapped(Finch& finch) { return finch.wasTapped(); }
+int wasShaken(Finch& finch) { return finch.wasShaken(); }
+int isObstacleLeftSide(Finch& finch) { return finch.isObstacleLeftSide(); }
+int isObstacleRightSide(Finch& finch) { return finch.isObstacleRightSide(); }
+int getLeftLightSensor(Finch& finch) { return finch.getLeftLightSensor(); }
+int getRightLightSensor(Finch& finch) { return finch.getRightLightSensor(); }
+int getXAcceleration(Finch& finch) { finch.getXAcceleration(); return 1; }
+int getYAcceleration(Finch& finch) { finch.getYAcceleration(); return 1; }
+int getZAcceleration(Finch& finch) { finch.getZAcceleration(); return 1; }
+int isBeakUp(Finch& finch) { return finch.isBeakUp(); }
+int isBeakDown(Finch& finch) { return finch.isBeakDown(); }
+int isFinchLevel(Finch& finch) { return finch.isFinchLevel(); }
+int isFinchUpsideDown(Finch& finch) { return finch.isFinchUpsideDown(); }
+int isRightWingDown(Finch& finch) { return finch.isRightWingDown(); }
+int isLeftWingDown(Finch& finch) { return finch.isLeftWingDown(); }
+int classifyOrientation(Finch& finch) { return finch.classifyOrientation(); }
+int counter(Finch& finch) { return finch.counter(); }
+
+struct NamedGetter {
+    const char* name;
+    Getter getter;
+};
+
+const NamedGetter getters[] = {
+    { "getTemperature", getTemperature },
+    { "getAccelerations", getAccelerations },
+    { "getLightSensors", getLightSensors },
+    { "getObstacleSensors", getObstacleSensors },
+    { "readAll", readAll },
+    { "readAccelerations", readAccelerations },
+    { "readLightSensors", readLightSensors },
+    { "readObstacleSensors", readObstacleSensors },
+    { "readTemperature", readTemperature },
+    { "wasTapped", wasTapped },
+    { "wasShaken", wasShaken },
+    { "isObstacleLeftSide", isObstacleLeftSide },
+    { "isObstacleRightSide", isObstacleRightSide },
+    { "getLeftLightSensor", getLeftLightSensor },
+    { "getRightLightSensor", getRightLightSensor },
+    { "getXAcceleration", getXAcceleration },
+    { "getYAcceleration", getYAcceleration },
+    { "getZAcceleration", getZAcceleration },
+    { "isBeakUp", isBeakUp },
+    { "isBeakDown", isBeakDown },
+    { "isFinchLevel", isFinchLevel },
+    { "isFinchUpsideDown", isFinchUpsideDown },
+    { "isRightWingDown", isRightWingDown },
+    { "isLeftWingDown", isLeftWingDown },
+    { "classifyOrientation", classifyOrientation },
+    { "counter", counter }
+};
+
+const int numGetters = int(sizeof(getters) / sizeof(getters[0]));
+
+// Times iterations calls of getter, after a short warm-up.
+void timeGetter(Getter getter, Finch& finch, int iterations, Latencies& latencies) {
+    for (int i = 0; i < warmUp; i++) {
+        (void)getter(finch);
+    }
+    latencies.samples.reserve(latencies.samples.size() + size_t(iterations));
+    for (int i = 0; i < iterations; i++) {
+        const double start = now();
+        if (getter(finch) == -1) {
+            latencies.failures++;
+        }
+        latencies.samples.push_back(now() - start);
+    }
+}
+
+void benchGetters(Finch& finch, int iterations) {
+    printf("  \"latency_us\": {\n");
+    for (int g = 0; g < numGetters; g++) {
+        Latencies latencies;
+        latencies.samples.reserve(size_t(iterations + warmUp));
+
+        const unsigned long allocationsBefore = allocationCount();
+        timeGetter(getters[g].getter, finch, iterations, latencies);
+        // The warm-up calls allocate like any others.
+        const double allocationsPerCall =
+            double(allocationCount() - allocationsBefore) / double(iterations + warmUp);
+
+        printf("    \"%s\": { ", getters[g].name);
+        latencies.print();
+        printf(", \"allocs_per_call\": %.2f }%s\n", allocationsPerCall, (g + 1 < numGetters) ? "," : "");
+    }
+    printf("  },\n");
+}
+
+// Sends output commands as fast as they'll go for duration milliseconds,
+// alternating between two settings so none is skipped as already set.
+int setLEDCommand(Finch& finch, int i) {
+    return finch.setLED((i & 1) ? 255 : 0, 0, 0);
+}
+
+int setMotorsCommand(Finch& finch, int i) {
+    return finch.setMotors((i & 1) ? 100 : -100, 0);
+}
+
+void benchCommandRate(const char* name, int (*command)(Finch&, int), Finch& finch, int duration, bool coalescing, bool last) {
+    if (coalescing) {
+        (void)finch.startCoalescing();
+    }
+    const unsigned long coalescedBefore = finch.coalescedOutputs();
+    const unsigned long skippedBefore = finch.skippedOutputs();
+
+    int calls = 0;
+    int failures = 0;
+    const double start = now();
+    const double end = start + duration * 1e3;
+    double finish;
+    while ((finish = now()) < end) {
+        if (command(finch, calls) == -1) {
+            failures++;
+        }
+        calls++;
+    }
+    if (coalescing) {
+        (void)finch.flushOutputs();
+        finish = now();
+        finch.stopCoalescing();
+    }
+
+    const unsigned long coalesced = finch.coalescedOutputs() - coalescedBefore;
+    const unsigned long skipped = finch.skippedOutputs() - skippedBefore;
+    const double seconds = (finish - start) / 1e6;
+    printf("    \"%s%s\": { \"calls_per_sec\": %.0f, \"sent_per_sec\": %.0f, \"coalesced\": %lu, \"skipped\": %lu, \"failures\": %d }%s\n",
+           name, coalescing ? "_coalesced" : "",
+           double(calls) / seconds, double(calls - long(coalesced) - long(skipped)) / seconds,
+           coalesced, skipped, failures, last ? "" : ",");
+}
+
+// Several threads doing round trips on the same Finch at once.
+struct Contender {
+    Finch* finch;
+    double end;
+    Latencies latencies;
+};
+
+void* contend(void* pContender) {
+    Contender* contender = static_cast<Contender*>(pContender);
+    while (now() < contender->end) {
+        const double start = now();
+        if (contender->finch->counter() == -1) {
+            contender->latencies.failures++;
+        }
+        contender->latencies.samples.push_back(now() - start);
+    }
+    return 0;
+}
+
+void benchContention(Finch& finch, int duration) {
+    printf("  \"contention\": [\n");
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        const size_t count = static_cast<size_t>(threads);
+        vector<Contender> contenders(count);
+        vector<pthread_t> ids(count);
+        vector<bool> started(count, false);
+        const double start = now();
+        for (int t = 0; t < threads; t++) {
+            contenders[size_t(t)].finch = &finch;
+            contenders[size_t(t)].end = start + duration * 1e3;
+            started[size_t(t)] = pthread_create(&ids[size_t(t)], 0, contend, &contenders[size_t(t)]) == 0;
+        }
+
+        Latencies all;
+        for (int t = 0; t < threads; t++) {
+            if (started[size_t(t)]) {
+                (void)pthread_join(ids[size_t(t)], 0);
+            }
+            const Latencies& latencies = contenders[size_t(t)].latencies;
+            all.samples.insert(all.samples.end(), latencies.samples.begin(), latencies.samples.end());
+            all.failures += latencies.failures;
+        }
+        const double seconds = (now() - start) / 1e6;
+
+        printf("    { \"threads\": %d, \"calls_per_sec\": %.0f, ", threads, double(all.samples.size()) / seconds);
+        all.print();
+        printf(" }%s\n", (threads * 2 <= maxThreads) ? "," : "");
+    }
+    printf("  ],\n");
+}
+
+// Calls keepAlive() every millisecond, far more often than the library's
+// own once a second, to make its effect on round trips measurable.
+struct KeepAliveStorm {
+    Finch* finch;
+    volatile bool stop;
+};
+
+void* stormKeepAlive(void* pStorm) {
+    KeepAliveStorm* storm = static_cast<KeepAliveStorm*>(pStorm);
+    while (!storm->stop) {
+        storm->finch->keepAlive();
+        struct timespec ms = { 0, 1000000 };
+        nanosleep(&ms, 0);
+    }
+    return 0;
+}
+
+void benchKeepAlive(Finch& finch, int iterations) {
+    // The cost of the check itself. Every other call finds that nothing
+    // has talked to the Finch since the last one, and pings it.
+    const double start = now();
+    for (int i = 0; i < iterations; i++) {
+        finch.keepAlive();
+    }
+    const double callCost = (now() - start) / double(iterations);
+
+    Latencies quiet;
+    timeGetter(counter, finch, iterations, quiet);
+
+    Latencies stormy;
+    KeepAliveStorm storm;
+    storm.finch = &finch;
+    storm.stop = false;
+    pthread_t id;
+    const bool started = pthread_create(&id, 0, stormKeepAlive, &storm) == 0;
+    timeGetter(counter, finch, iterations, stormy);
+    storm.stop = true;
+    if (started) {
+        (void)pthread_join(id, 0);
+    }
+
+    printf("  \"keep_alive\": {\n");
+    printf("    \"call_us\": %.2f,\n", callCost);
+    printf("    \"counter_without\": { ");
+    quiet.print();
+    printf(" },\n");
+    printf("    \"counter_with_1khz_keep_alive\": { ");
+    stormy.print();
+    printf(" }\n");
+    printf("  },\n");
+}
+
+void printStage(const char* name, const Finch::LatencySummary& stage, bool last) {
+    printf("\"%s\": { \"count\": %lu, \"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f }%s",
+           name, stage.count, stage.meanMicros, stage.p50Micros, stage.p99Micros, stage.p999Micros,
+           stage.maxMicros, last ? "" : ", ");
+}
+
+// The library's own breakdown of where the time went in everything above.
+void printCommandStats(Finch& finch) {
+    const Finch::Stats stats = finch.stats();
+    int used = 0;
+    for (int i = 0; i < Finch::Stats::numCommands; i++) {
+        if (stats.commands[i].calls > 0) {
+            used++;
+        }
+    }
+
+    printf("  \"command_stats_us\": {\n");
+    for (int i = 0; i < Finch::Stats::numCommands; i++) {
+        const Finch::CommandStats& command = stats.commands[i];
+        if (command.calls == 0) {
+            continue;
+        }
+        printf("    \"%c\": { \"calls\": %lu, \"errors\": %lu, ", command.command, command.calls, command.errors);
+        printStage("lock_wait", command.lockWait, false);
+        printStage("write", command.write, false);
+        printStage("read_wait", command.readWait, true);
+        printf(" }%s\n", (--used > 0) ? "," : "");
+    }
+    printf("  }\n");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    const int iterations = (argc > 1) ? atoi(argv[1]) : 1000;
+    const int duration = (argc > 2) ? atoi(argv[2]) : 1000;
+    if (iterations < 1 || duration < 1) {
+        fprintf(stderr, "Usage: %s [iterations] [duration_ms]\n", argv[0]);
+        return -1;
+    }
+
+    const double constructStart = now();
+    Finch myFinch;
+    const double constructed = now();
+    if (!myFinch.isInitialized()) {
+        return -1;
+    }
+    (void)myFinch.counter();
+    const double firstReply = now();
+
+    printf("{\n");
+    printf("  \"config\": { \"iterations\": %d, \"duration_ms\": %d },\n", iterations, duration);
+    printf("  \"startup_us\": { \"connect\": %.1f, \"first_reply\": %.1f },\n",
+           constructed - constructStart, firstReply - constructStart);
+
+    benchGetters(myFinch, iterations);
+
+    printf("  \"command_rate\": {\n");
+    benchCommandRate("setLED", setLEDCommand, myFinch, duration, false, false);
+    benchCommandRate("setLED", setLEDCommand, myFinch, duration, true, false);
+    benchCommandRate("setMotors", setMotorsCommand, myFinch, duration, false, false);
+    benchCommandRate("setMotors", setMotorsCommand, myFinch, duration, true, true);
+    printf("  },\n");
+    myFinch.setMotors(0, 0);
+    myFinch.setLED(0, 0, 0);
+
+    benchContention(myFinch, duration);
+    benchKeepAlive(myFinch, iterations);
+    printCommandStats(myFinch);
+    printf("}\n");
+
+    return 0;
+}
+
+// Count every allocation made through operator new, from the library as
+// much as from here.
+#if __cplusplus >= 201103L
+#define NO_THROW noexcept
+#else
+#define NO_THROW throw()
+#endif
+
+void* operator new(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    void* p = malloc(size > 0 ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) NO_THROW {
+    free(p);
+}
+
+void operator delete[](void* p) NO_THROW {
+    free(p);
+}
+
+#if __cplusplus >= 201402L
+void operator delete(void* p, size_t) NO_THROW {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) NO_THROW {
+    free(p);
+}
+#endif
@@ -0,0 +1,212 @@
+/*
+* File:   FinchChecks.cpp
+*
+* Checks of the library's trickier parts against the simulated Finch
+* (src/hid-sim.c), using its test hooks (src/hid-sim.h) to lose replies,
+* slow them down and pull the Finch off the bus:
+*
+*  - matching replies to requests when they're waited for out of order, as
+*    the report counter wraps around, and when they turn up late or never;
+*  - skipping output commands the Finch already has, and only sending the
+*    newest setting of each output while coalescing;
+*  - reconnecting after the Finch is unplugged, and putting its outputs
+*    back how they were.
+*
+* "make check" builds it with HID_BACKEND=sim and runs it. Each check prints
+* a line saying whether it passed; the exit status is 1 if any failed.
+*/
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "Finch.h"
+#include "ReportTracker.h"
+#include "hid-sim.h"
+
+using namespace std;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Opens the first simulated Finch directly, without a Finch object.
+hid_device* openSim() {
+    struct hid_device_info* devs = hid_enumerate(0x2354, 0x1111);
+    hid_device* handle = devs ? hid_open_path(devs->path) : 0;
+    hid_free_enumeration(devs);
+    return handle;
+}
+
+// Sends a 'z' (count received reports) command tagged with counter.
+bool sendCount(hid_device* handle, unsigned char counter) {
+    unsigned char report[9];
+    memset(report, 0, sizeof(report));
+    report[1] = 'z';
+    report[8] = counter;
+    return hid_write(handle, report, sizeof(report)) != -1;
+}
+
+// Waits until the Finch has been reconnected count times in all.
+bool waitForReconnects(Finch& finch, unsigned long count, int timeoutMs) {
+    for (int waited = 0; waited < timeoutMs; waited += 50) {
+        if (finch.reconnects() >= count) {
+            return true;
+        }
+        usleep(50000);
+    }
+    return false;
+}
+
+void checkTracker() {
+    hid_device* handle = openSim();
+    check(handle != 0, "tracker: open the simulated Finch");
+    if (!handle) {
+        return;
+    }
+
+    ReportTracker tracker;
+    unsigned char reply[8];
+
+    // Replies waited for in the reverse of the order they were asked for
+    // still each reach the right request.
+    unsigned char counters[3];
+    bool ok = true;
+    for (int i = 0; i < 3; i++) {
+        counters[i] = tracker.begin();
+        ok = ok && sendCount(handle, counters[i]);
+    }
+    for (int i = 2; i >= 0; i--) {
+        ok = ok && tracker.wait(handle, counters[i], reply, 1000) != -1 && reply[7] == counters[i];
+    }
+    check(ok, "tracker: replies waited for out of order are routed to their requests");
+
+    // The counter wraps from 255 back to 0 without losing track of anything.
+    bool wrapped = false;
+    unsigned char last = counters[2];
+    ok = true;
+    for (int i = 0; i < 600 && ok; i++) {
+        const unsigned char counter = tracker.begin();
+        wrapped = wrapped || counter < last;
+        last = counter;
+        ok = sendCount(handle, counter) && tracker.wait(handle, counter, reply, 1000) != -1 && reply[7] == counter;
+    }
+    check(ok && wrapped, "tracker: round trips keep working as the counter wraps around");
+    check(tracker.lateReports() == 0 && tracker.orphanedReports() == 0, "tracker: nothing late or orphaned so far");
+
+    // A reply that misses its deadline fails the request, and is counted as
+    // late when it does turn up.
+    hid_sim_set_latency(200000);
+    unsigned char counter = tracker.begin();
+    ok = sendCount(handle, counter) && tracker.wait(handle, counter, reply, 20) == -1;
+    hid_sim_set_latency(1000);
+    check(ok, "tracker: a slow reply times out");
+    usleep(250000);
+    counter = tracker.begin();
+    ok = sendCount(handle, counter) && tracker.wait(handle, counter, reply, 1000) != -1 && reply[7] == counter;
+    check(ok && tracker.lateReports() == 1, "tracker: the slow reply is counted as late, and the next request still works");
+
+    // A reply that never comes fails the request, and leaves nothing behind.
+    hid_sim_drop_replies(0, 1);
+    counter = tracker.begin();
+    ok = sendCount(handle, counter) && tracker.wait(handle, counter, reply, 50) == -1;
+    check(ok, "tracker: a lost reply times out");
+
+    // A reply for a counter nobody asked for is counted as orphaned.
+    const unsigned char stray = tracker.begin();
+    tracker.cancel(stray);
+    ok = sendCount(handle, stray);
+    counter = tracker.begin();
+    ok = ok && sendCount(handle, counter) && tracker.wait(handle, counter, reply, 1000) != -1;
+    check(ok && tracker.orphanedReports() == 1 && tracker.lateReports() == 1, "tracker: a reply for an unknown counter is counted as orphaned");
+
+    hid_close(handle);
+}
+
+void checkCoalescer(Finch& finch) {
+    unsigned char led[3];
+    unsigned char motors[4];
+
+    // A command that wouldn't change anything isn't sent.
+    const unsigned long skipped = finch.skippedOutputs();
+    finch.setLED(1, 2, 3);
+    finch.setLED(1, 2, 3);
+    finch.setMotors(0, 0);
+    finch.setMotors(0, 0);
+    check(finch.skippedOutputs() == skipped + 2, "coalescer: repeated settings are skipped");
+    finch.setLED(3, 2, 1);
+    finch.setLED(1, 2, 3);
+    hid_sim_get_outputs(0, led, 0, 0);
+    check(finch.skippedOutputs() == skipped + 2 && led[0] == 1 && led[2] == 3, "coalescer: a setting changed and changed back is sent");
+
+    // While coalescing, a burst of settings ends with the newest one on the
+    // Finch, with most of the ones in between never sent.
+    check(finch.startCoalescing() != -1, "coalescer: start coalescing");
+    for (int i = 0; i < 500; i++) {
+        finch.setLED(i % 256, 255 - i % 256, 7);
+        finch.setMotors(i % 256, -(i % 256));
+    }
+    // Ending on a setting that was sent early on, while one may be on its way
+    finch.setLED(0, 255, 7);
+    check(finch.flushOutputs() != -1, "coalescer: flush the burst");
+    hid_sim_get_outputs(0, led, motors, 0);
+    check(led[0] == 0 && led[1] == 255 && led[2] == 7, "coalescer: the LED ends on the last setting");
+    check(motors[0] == 0 && motors[1] == 243 && motors[2] == 1 && motors[3] == 243, "coalescer: the motors end on the last setting");
+    check(finch.coalescedOutputs() > 0, "coalescer: settings overtaken in the queue aren't sent");
+
+    const unsigned long skippedBefore = finch.skippedOutputs();
+    finch.setLED(0, 255, 7);
+    finch.flushOutputs();
+    check(finch.skippedOutputs() == skippedBefore + 1, "coalescer: the setting that went out last is skipped");
+    finch.stopCoalescing();
+}
+
+void checkReconnect(Finch& finch) {
+    unsigned char led[3];
+    unsigned char motors[4];
+
+    finch.setLED(10, 20, 30);
+    finch.setMotors(100, -50);
+    const unsigned long reconnects = finch.reconnects();
+
+    // Pulled out while nothing is talking to it; the keep-alive check
+    // should notice, and reconnect once it is back.
+    hid_sim_set_present(0, 0);
+    usleep(1500000);
+    check(finch.counter() == -1, "reconnect: requests fail while the Finch is unplugged");
+    hid_sim_set_present(0, 1);
+
+    check(waitForReconnects(finch, reconnects + 1, 10000), "reconnect: the Finch is reconnected");
+    hid_sim_get_outputs(0, led, motors, 0);
+    check(led[0] == 10 && led[1] == 20 && led[2] == 30, "reconnect: the LED is put back");
+    check(motors[0] == 0 && motors[1] == 100 && motors[2] == 1 && motors[3] == 50, "reconnect: the motors are put back");
+    check(finch.counter() != -1, "reconnect: requests work again");
+    finch.setMotors(0, 0);
+}
+
+}
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    // Writes take a while, so a burst of output commands backs up
+    setenv("FINCH_SIM_WRITE_US", "200", 0);
+
+    checkTracker();
+
+    Finch finch;
+    check(finch.isInitialized(), "connect to the simulated Finch");
+    if (finch.isInitialized()) {
+        checkCoalescer(finch);
+        checkReconnect(finch);
+    }
+
+    printf("%d check(s) failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -16,6 +16,9 @@ int main(int /*argc*/, char* /*argv*/[]) {
     Finch myFinch;
     unsigned int rgb[] = {255,0,0};
 
+    // Only send the newest color, rather than queueing up every step
+    myFinch.startCoalescing();
+
     for (int count = 0; count < 100; count++) {
         for (int dec = 0; dec < 3; dec += 1) {
             for(int i = 0; i < 255; i += 1) {
@@ -25,5 +28,6 @@ int main(int /*argc*/, char* /*argv*/[]) {
             }
         }
     }
+    myFinch.flushOutputs();
     return 0;
 }
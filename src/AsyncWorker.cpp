@@ -0,0 +1,182 @@
+/*
+ * File:   AsyncWorker.cpp
+ *
+ * The I/O thread behind the Finch's *Async() functions.
+ */
+
+#include "AsyncWorker.h"
+#include "FinchImpl.h"
+
+AsyncWorker::AsyncWorker(Finch& owner)
+    : finch(owner), busy(0), running(false), stopping(false), joining(false) {
+    pthread_mutex_init(&mtx, 0);
+    pthread_cond_init(&cond, 0);
+}
+
+AsyncWorker::~AsyncWorker() {
+    stop();
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mtx);
+}
+
+int AsyncWorker::submit(const AsyncJob& job) {
+    MutexLocker lock(mtx);
+    if (stopping) {
+        return -1;
+    }
+    if (!running) {
+        if (pthread_create(&threadid, 0, entryPoint, this) != 0) {
+            return -1;
+        }
+        running = true;
+    }
+    jobs.push_back(job);
+    pthread_cond_broadcast(&cond);
+    return 1;
+}
+
+void AsyncWorker::drain() {
+    if (onWorkerThread()) {
+        // Waiting on ourselves would never finish.
+        return;
+    }
+    MutexLocker lock(mtx);
+    while (!jobs.empty() || busy > 0) {
+        pthread_cond_wait(&cond, &mtx);
+    }
+}
+
+void AsyncWorker::stop() {
+    {
+        MutexLocker lock(mtx);
+        if (!running || joining) {
+            return;
+        }
+        stopping = true;
+        pthread_cond_broadcast(&cond);
+        if (pthread_equal(threadid, pthread_self())) {
+            // Called from a callback (e.g. disConnect()), and the thread can't
+            // join itself. It exits once the callback returns, and the next
+            // stop() (at the latest, the destructor's) joins it.
+            return;
+        }
+        joining = true;
+    }
+    (void)pthread_join(threadid, 0);
+
+    MutexLocker lock(mtx);
+    running = false;
+    stopping = false;
+    joining = false;
+}
+
+bool AsyncWorker::onWorkerThread() {
+    MutexLocker lock(mtx);
+    return running && pthread_equal(threadid, pthread_self());
+}
+
+void AsyncWorker::run() {
+    pthread_mutex_lock(&mtx);
+    for (;;) {
+        while (jobs.empty() && !stopping) {
+            pthread_cond_wait(&cond, &mtx);
+        }
+        if (jobs.empty()) {
+            // Asked to stop, and nothing left to do.
+            break;
+        }
+
+        AsyncJob job = jobs.front();
+        jobs.pop_front();
+        busy++;
+        pthread_mutex_unlock(&mtx);
+
+        execute(job);
+
+        pthread_mutex_lock(&mtx);
+        busy--;
+        pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&mtx);
+}
+
+// Carries out a job using the ordinary blocking Finch calls, then hands the
+// result to the job's callback (if it has one).
+void AsyncWorker::execute(const AsyncJob& job) {
+    int result;
+    switch (job.type) {
+        case AsyncJob::SET_LED:
+            result = finch.setLED(job.args[0], job.args[1], job.args[2]);
+            if (job.callback.status) {
+                job.callback.status(result, job.context);
+            }
+            break;
+        case AsyncJob::SET_MOTORS:
+            result = finch.setMotors(job.args[0], job.args[1]);
+            if (job.callback.status) {
+                job.callback.status(result, job.context);
+            }
+            break;
+        case AsyncJob::SET_MOTORS_DURATION:
+            // The timer runs the callback once the motors have stopped.
+            (void)finch.setMotorsFor(job.args[0], job.args[1], job.args[2], job.callback.status, job.context);
+            break;
+        case AsyncJob::NOTE_ON:
+            result = finch.noteOn(job.args[0]);
+            if (job.callback.status) {
+                job.callback.status(result, job.context);
+            }
+            break;
+        case AsyncJob::NOTE_ON_DURATION:
+            (void)finch.noteOnFor(job.args[0], job.args[1], job.callback.status, job.context);
+            break;
+        case AsyncJob::NOTE_OFF:
+            result = finch.noteOff();
+            if (job.callback.status) {
+                job.callback.status(result, job.context);
+            }
+            break;
+        case AsyncJob::READ_ACCELERATIONS: {
+            const Finch::Accel accel = finch.readAccelerations();
+            job.callback.accel(accel, job.context);
+            break;
+        }
+        case AsyncJob::READ_LIGHT_SENSORS: {
+            const Finch::LightSensors light = finch.readLightSensors();
+            job.callback.light(light, job.context);
+            break;
+        }
+        case AsyncJob::READ_OBSTACLE_SENSORS: {
+            const Finch::ObstacleSensors obstacles = finch.readObstacleSensors();
+            job.callback.obstacles(obstacles, job.context);
+            break;
+        }
+        case AsyncJob::READ_TEMPERATURE: {
+            const Finch::Temperature temperature = finch.readTemperature();
+            job.callback.temperature(temperature, job.context);
+            break;
+        }
+        case AsyncJob::READ_ALL: {
+            Finch::Sensors sensors = Finch::Sensors();
+            result = finch.readAll(sensors);
+            job.callback.sensors(result, sensors, job.context);
+            break;
+        }
+        case AsyncJob::CLASSIFY_ORIENTATION:
+            result = finch.classifyOrientation();
+            job.callback.status(result, job.context);
+            break;
+        case AsyncJob::WAS_TAPPED:
+            result = finch.wasTapped();
+            job.callback.status(result, job.context);
+            break;
+        case AsyncJob::WAS_SHAKEN:
+            result = finch.wasShaken();
+            job.callback.status(result, job.context);
+            break;
+        case AsyncJob::COUNTER:
+            result = finch.counter();
+            job.callback.status(result, job.context);
+            break;
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * File:   AsyncWorker.h
+ *
+ * The I/O thread behind the Finch's *Async() functions. Requests are queued
+ * by the calling thread and carried out, in order, on a thread owned by the
+ * library, which then runs the caller's completion callback.
+ */
+
+#ifndef ASYNCWORKER_H
+#define ASYNCWORKER_H
+
+#include <deque>
+#include <pthread.h>
+#include "Finch.h"
+
+// One queued request, and the callback to run when it's done.
+struct AsyncJob {
+    enum Type {
+        SET_LED,
+        SET_MOTORS,
+        SET_MOTORS_DURATION,
+        NOTE_ON,
+        NOTE_ON_DURATION,
+        NOTE_OFF,
+        READ_ACCELERATIONS,
+        READ_LIGHT_SENSORS,
+        READ_OBSTACLE_SENSORS,
+        READ_TEMPERATURE,
+        READ_ALL,
+        CLASSIFY_ORIENTATION,
+        WAS_TAPPED,
+        WAS_SHAKEN,
+        COUNTER
+    };
+
+    Type type;
+    int args[3];
+    union {
+        Finch::StatusCallback status;
+        Finch::AccelCallback accel;
+        Finch::LightSensorsCallback light;
+        Finch::ObstacleSensorsCallback obstacles;
+        Finch::TemperatureCallback temperature;
+        Finch::SensorsCallback sensors;
+    } callback;
+    void* context;
+};
+
+class AsyncWorker {
+public:
+    explicit AsyncWorker(Finch& owner);
+    ~AsyncWorker();
+
+    // Queues a job, starting the I/O thread if it isn't running yet.
+    // Returns 1 if the job was queued, -1 if it wasn't.
+    int submit(const AsyncJob& job);
+
+    // Blocks until every job queued so far has completed.
+    void drain();
+
+    // Finishes off any queued jobs, then shuts the I/O thread down. Called
+    // from the I/O thread itself, it only asks it to shut down.
+    void stop();
+
+    // Returns true if called from the I/O thread itself.
+    bool onWorkerThread();
+
+private:
+    static void* entryPoint(void* pThis) {
+        AsyncWorker* pthX = static_cast<AsyncWorker*>(pThis);
+        pthX->run();
+        return 0;
+    }
+
+    void run();
+    void execute(const AsyncJob& job);
+
+    Finch& finch;
+    pthread_t threadid;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    std::deque<AsyncJob> jobs;
+    int busy;           // Jobs taken off the queue but not yet completed
+    bool running;
+    bool stopping;      // Set once asked to stop; no new jobs are queued
+    bool joining;       // Some thread is waiting for the I/O thread to exit
+
+    // This class is not copy-safe.
+    AsyncWorker(const AsyncWorker&);
+    AsyncWorker& operator=(const AsyncWorker&);
+};
+
+#endif  /* ASYNCWORKER_H */
@@ -0,0 +1,128 @@
+/*
+ * File:   CommandMetrics.cpp
+ *
+ * Per-command call counts, error counts and latency histograms.
+ *
+ * Every counter is updated with a relaxed atomic add, so recording costs a
+ * few uncontended increments and never blocks. The histograms are
+ * log-linear: a time's power of two picks a row of buckets, and the next
+ * three bits below its top bit pick the bucket in the row. That keeps the
+ * whole range from nanoseconds to a minute in a few hundred buckets, while
+ * every bucket stays narrow compared to the times in it.
+ */
+
+#include "CommandMetrics.h"
+#include <cstring>
+
+const char CommandMetrics::commandLetters[Finch::Stats::numCommands] = {
+    'A', 'L', 'I', 'T', 'O', 'M', 'B', 'z', 'R', '?'
+};
+
+CommandMetrics::CommandMetrics() {
+    memset(commands, 0, sizeof(commands));
+}
+
+void CommandMetrics::recordCall(unsigned char command) {
+    __atomic_fetch_add(&commands[commandIndex(command)].calls, 1, __ATOMIC_RELAXED);
+}
+
+void CommandMetrics::recordError(unsigned char command) {
+    __atomic_fetch_add(&commands[commandIndex(command)].errors, 1, __ATOMIC_RELAXED);
+}
+
+void CommandMetrics::record(unsigned char command, Stage stage, long long nanos) {
+    const unsigned long long time = (nanos > 0) ? static_cast<unsigned long long>(nanos) : 0;
+    Histogram& histogram = commands[commandIndex(command)].stages[stage];
+
+    __atomic_fetch_add(&histogram.buckets[bucketIndex(time)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram.count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram.total, time, __ATOMIC_RELAXED);
+
+    unsigned long long max = __atomic_load_n(&histogram.max, __ATOMIC_RELAXED);
+    while (time > max &&
+           !__atomic_compare_exchange_n(&histogram.max, &max, time, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // max now holds the latest value; try again if we still beat it.
+    }
+}
+
+void CommandMetrics::snapshot(Finch::Stats& stats) {
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < Finch::Stats::numCommands; i++) {
+        Finch::CommandStats& command = stats.commands[i];
+        command.command = commandLetters[i];
+        command.calls = __atomic_load_n(&commands[i].calls, __ATOMIC_RELAXED);
+        command.errors = __atomic_load_n(&commands[i].errors, __ATOMIC_RELAXED);
+        summarize(commands[i].stages[LOCK_WAIT], command.lockWait);
+        summarize(commands[i].stages[WRITE], command.write);
+        summarize(commands[i].stages[READ_WAIT], command.readWait);
+    }
+}
+
+// Where a command's counters live: by its letter, with anything else at the end.
+int CommandMetrics::commandIndex(unsigned char command) {
+    for (int i = 0; i < Finch::Stats::numCommands - 1; i++) {
+        if (command == static_cast<unsigned char>(commandLetters[i])) {
+            return i;
+        }
+    }
+    return Finch::Stats::numCommands - 1;
+}
+
+int CommandMetrics::bucketIndex(unsigned long long nanos) {
+    if (nanos < static_cast<unsigned long long>(subBuckets)) {
+        return static_cast<int>(nanos);
+    }
+    const int octave = 63 - __builtin_clzll(nanos);
+    if (octave > maxOctave) {
+        return numBuckets - 1;
+    }
+    const int subBucket = static_cast<int>(nanos >> (octave - subBucketBits)) & (subBuckets - 1);
+    return (octave - subBucketBits + 1) * subBuckets + subBucket;
+}
+
+// The time in the middle of a bucket, as the best guess for any time in it.
+unsigned long long CommandMetrics::bucketMiddle(int index) {
+    if (index < subBuckets) {
+        return static_cast<unsigned long long>(index);
+    }
+    const int shift = index / subBuckets - 1;
+    const unsigned long long lower = static_cast<unsigned long long>(subBuckets + index % subBuckets) << shift;
+    return lower + ((1ULL << shift) >> 1);
+}
+
+void CommandMetrics::summarize(const Histogram& histogram, Finch::LatencySummary& summary) {
+    unsigned long buckets[numBuckets];
+    unsigned long count = 0;
+    for (int i = 0; i < numBuckets; i++) {
+        buckets[i] = __atomic_load_n(&histogram.buckets[i], __ATOMIC_RELAXED);
+        count += buckets[i];
+    }
+    const unsigned long long total = __atomic_load_n(&histogram.total, __ATOMIC_RELAXED);
+    const unsigned long long max = __atomic_load_n(&histogram.max, __ATOMIC_RELAXED);
+
+    summary.count = count;
+    if (count == 0) {
+        return;
+    }
+    summary.meanMicros = double(total) / double(count) / 1000.0;
+    summary.maxMicros = double(max) / 1000.0;
+
+    const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+    double* const percentiles[] = {
+        &summary.p50Micros, &summary.p90Micros, &summary.p99Micros, &summary.p999Micros
+    };
+    int bucket = 0;
+    unsigned long seen = buckets[0];
+    for (int p = 0; p < 4; p++) {
+        // The rank of the sample at this percentile, counting from 1.
+        unsigned long rank = static_cast<unsigned long>(fractions[p] * double(count));
+        if (double(rank) < fractions[p] * double(count) || rank == 0) {
+            rank++;
+        }
+        while (seen < rank && bucket < numBuckets - 1) {
+            seen += buckets[++bucket];
+        }
+        const unsigned long long middle = bucketMiddle(bucket);
+        *percentiles[p] = double(middle < max ? middle : max) / 1000.0;
+    }
+}
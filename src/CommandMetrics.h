@@ -0,0 +1,77 @@
+/*
+ * File:   CommandMetrics.h
+ *
+ * Call counts, error counts and latency histograms for each kind of command
+ * report the Finch is sent. Recording is lock-free, so it can stay on all
+ * the time, and a snapshot can be taken while other threads are still
+ * talking to the Finch.
+ */
+
+#ifndef COMMANDMETRICS_H
+#define COMMANDMETRICS_H
+
+#include "Finch.h"
+
+class CommandMetrics {
+public:
+    // The stages each command's latency is split into.
+    enum Stage {
+        LOCK_WAIT,  // Waiting for the Finch's lock before writing
+        WRITE,      // From handing the report to the HID backend until it's out
+        READ_WAIT,  // Waiting for the reply
+        numStages
+    };
+
+    CommandMetrics();
+
+    // Counts a command report (byte 1 is the command letter) being sent.
+    void recordCall(unsigned char command);
+
+    // Counts a failed write or read of a command.
+    void recordError(unsigned char command);
+
+    // Adds a time in nanoseconds to a command's histogram for a stage.
+    void record(unsigned char command, Stage stage, long long nanos);
+
+    // Summarizes everything recorded so far. Each counter is read on its own,
+    // so a snapshot taken while commands are in flight may be off by those.
+    void snapshot(Finch::Stats& stats);
+
+private:
+    // Log-linear histogram of times in nanoseconds: each power of two is
+    // split into subBuckets equal buckets, so every bucket is at most 1/8th
+    // as wide as the values in it. Times over about a minute share the
+    // last bucket.
+    static const int subBucketBits = 3;
+    static const int subBuckets = 1 << subBucketBits;
+    static const int maxOctave = 36;
+    static const int numBuckets = (maxOctave - subBucketBits + 2) * subBuckets;
+
+    struct Histogram {
+        unsigned long buckets[numBuckets];
+        unsigned long count;
+        unsigned long long total;
+        unsigned long long max;
+    };
+
+    struct Counters {
+        unsigned long calls;
+        unsigned long errors;
+        Histogram stages[numStages];
+    };
+
+    static const char commandLetters[Finch::Stats::numCommands];
+
+    static int commandIndex(unsigned char command);
+    static int bucketIndex(unsigned long long nanos);
+    static unsigned long long bucketMiddle(int index);
+    static void summarize(const Histogram& histogram, Finch::LatencySummary& summary);
+
+    Counters commands[Finch::Stats::numCommands];
+
+    // This class is not copy-safe.
+    CommandMetrics(const CommandMetrics&);
+    CommandMetrics& operator=(const CommandMetrics&);
+};
+
+#endif  /* COMMANDMETRICS_H */
@@ -13,64 +13,157 @@
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
+#include <algorithm>
 #include <wchar.h>
 #include <unistd.h>
 #include <pthread.h>
 #include "hidapi.h"
+#include "ReportTracker.h"
+#include "FinchImpl.h"
+#include "AsyncWorker.h"
+#include "SensorPoller.h"
+#include "OutputCoalescer.h"
+#include "CommandMetrics.h"
+#include "TraceLog.h"
+#include "SessionRecorder.h"
+#include "TimerService.h"
 
 using namespace std;
 
 namespace {
-    // Convenience class to handle locking/unlocking the mutex.
-    class MutexLocker {
-    public:
-        MutexLocker(pthread_mutex_t& mutex)
-            : mtx(mutex), locked(false) {
-            locked = pthread_mutex_lock(&mtx) == 0;
-        }
-        MutexLocker(pthread_mutex_t& mutex, bool tryOnly)
-            : mtx(mutex), locked(false) {
-            if (tryOnly) {
-                locked = pthread_mutex_trylock(&mtx) == 0;
+    // Converts the raw temperature byte of a 'T' report to Celsius.
+    double decodeTemperature(const unsigned char bufRead[]) {
+        return (bufRead[0] - 127) / 2.4 + 25;
+    }
+
+    // Converts the raw accelerometer bytes of an 'A' report to G-forces.
+    void decodeAccelerations(const unsigned char bufRead[], double accelerations[]) {
+        for(int i = 0; i < 3; i++) {
+            if(bufRead[i + 1] > 31) {
+                accelerations[i] = (bufRead[i + 1] - 64) * 1.5 / 32;
             }
             else {
-                locked = pthread_mutex_lock(&mtx) == 0;
+                accelerations[i] = bufRead[i + 1] * 1.5 / 32;
             }
         }
-        ~MutexLocker() {
-            unlock();
+    }
+
+    // Pulls the tap and shake bits out of an 'A' report.
+    int decodeTapped(const unsigned char bufRead[]) {
+        return (bufRead[4] & 0x20) >> 5;
+    }
+
+    int decodeShaken(const unsigned char bufRead[]) {
+        return (bufRead[4] & 0x80) >> 7;
+    }
+
+    // The acceleration ranges (in G's, exclusive at both ends) that define
+    // each orientation.
+    struct OrientationRange {
+        int orientation;
+        double minX, maxX;
+        double minY, maxY;
+        double minZ, maxZ;
+    };
+
+    const OrientationRange orientationRanges[] = {
+        { Finch::BEAK_UP,         -1.5, -0.8,  -0.3,  0.3,  -0.3,  0.3  },
+        { Finch::BEAK_DOWN,        0.8,  1.5,  -0.3,  0.3,  -0.3,  0.3  },
+        { Finch::LEVEL,           -0.5,  0.5,  -0.5,  0.5,   0.65, 1.5  },
+        { Finch::UPSIDE_DOWN,     -0.5,  0.5,  -0.5,  0.5,  -1.5, -0.65 },
+        { Finch::LEFT_WING_DOWN,  -0.5,  0.5,   0.7,  1.5,  -0.5,  0.5  },
+        { Finch::RIGHT_WING_DOWN, -0.5,  0.5,  -1.5, -0.7,  -0.5,  0.5  }
+    };
+
+    const int numOrientationRanges = int(sizeof(orientationRanges) / sizeof(orientationRanges[0]));
+
+    // Lets a thread wait for a batch of command reports, handed to
+    // hid_write_batch(), to finish going out.
+    struct WriteCompletion {
+        pthread_mutex_t mtx;
+        pthread_cond_t cond;
+        bool done;
+        int written;
+    };
+
+    void writeFinished(hid_device*, void* context, int written) {
+        WriteCompletion* completion = static_cast<WriteCompletion*>(context);
+        MutexLocker lock(completion->mtx);
+        completion->written = written;
+        completion->done = true;
+        pthread_cond_broadcast(&completion->cond);
+    }
+
+    // How often each Finch's keep-alive check runs.
+    const long long keepAliveInterval = 1000000000LL; // 1 second
+
+    // How long to wait for the reply to a command before giving up on it
+    // (and on the connection), in milliseconds.
+    const int replyTimeout = 1000;
+
+    // How long to wait before trying to reconnect to a Finch that has gone
+    // away, doubling after each failed attempt up to the maximum.
+    const long long firstReconnectDelay = 50000000LL;  // 50 milliseconds
+    const long long maxReconnectDelay = 2000000000LL;  // 2 seconds
+
+    // Takes the callback (if any) waiting on a timed stop, so that it runs
+    // exactly once, whoever gets to it first.
+    StopWaiter takeStopWaiter(pthread_mutex_t& mtx, StopWaiter& waiter) {
+        MutexLocker lock(mtx);
+        const StopWaiter taken = waiter;
+        waiter.callback = 0;
+        return taken;
+    }
+
+    void notifyStopWaiter(const StopWaiter& waiter) {
+        if (waiter.callback) {
+            waiter.callback(waiter.result, waiter.context);
         }
+    }
 
-        void unlock() {
-            if (locked) {
-                pthread_mutex_unlock(&mtx);
-                locked = false;
+    // Opens the Finch at path or, if path is null, the first one found with
+    // the Finch's VID (0x2354) and PID (0x1111). Sets openedPath to where it
+    // was opened (for the caller to free), to check later that it's still
+    // plugged in.
+    hid_device* openFinch(const char* path, char** openedPath) {
+        *openedPath = 0;
+        if (path) {
+            hid_device* handle = hid_open_path(path);
+            if (handle) {
+                *openedPath = strdup(path);
             }
+            return handle;
         }
 
-        bool isLocked() const {
-            return locked;
+        struct hid_device_info* devs = hid_enumerate_filtered(0x2354, 0x1111, 0);
+        hid_device* handle = devs ? hid_open_path(devs->path) : 0;
+        if (handle) {
+            *openedPath = strdup(devs->path);
         }
+        hid_free_enumeration(devs);
+        return handle;
+    }
 
-    private:
-        pthread_mutex_t& mtx;
-        bool locked;
-    };
-}
+    // Whether there's still a Finch plugged in at path. Only the device
+    // descriptors are looked at, so this is cheap enough to do every second.
+    bool finchPresent(const char* path) {
+        struct hid_device_info* devs = hid_enumerate_filtered(0x2354, 0x1111, 0);
+        bool found = false;
+        for (struct hid_device_info* dev = devs; dev && !found; dev = dev->next) {
+            found = strcmp(dev->path, path) == 0;
+        }
+        hid_free_enumeration(devs);
+        return found;
+    }
 
-/* Hidden state for the Finch. */
-struct Finch::Impl {
-    hid_device *finch_handle; // The handle to communicate with the Finch
-    unsigned char sendReportCounter; // Used to match incoming and outgoing report in the finchRead function
-    int wasTappedVal; // Holds whether the Finch has been tapped since the last read
-    int wasShakenVal; // Holds whether the Finch has been shaken since the last read
+    // Keep-alive timer callback; runs on the shared timer thread.
+    long long keepAliveEntryPoint(void* pThis, long long /*deadline*/, long long firedAt) {
+        Finch* pthX = static_cast<Finch*>(pThis);   // cast from void to Finch object
+        pthX->keepAlive();           // now call the true entry-point-function
+        return firedAt + keepAliveInterval;
+    }
+}
 
-    // Keep-alive thread stuff (and synchronization)
-    pthread_t threadid;
-    pthread_mutex_t mtx;
-    volatile int syncCounter;
-    volatile bool stillRunning;
-};
 
 /**
  * Constructs a Finch object.
@@ -80,7 +173,35 @@ struct Finch::Impl {
  * before the program ends.
  */
 Finch::Finch() : initialized(false), pimpl(new Impl) {
+    setUp(0);
+}
+
+/**
+ * Constructs a Finch object for the robot at a particular device path (as
+ * found by hid_enumerate(), or by FinchPool), rather than the first one
+ * found. Use this to drive more than one Finch from the same program.
+ *
+ * @param path The platform-specific HID device path of the robot.
+ */
+Finch::Finch(const char* path) : initialized(false), pimpl(new Impl) {
+    setUp(path);
+}
+
+/**
+ * Does the work of the constructors: connects to the robot, and signs it up
+ * for keep-alive pings.
+ */
+void Finch::setUp(const char* path) {
+    TraceLog::startFromEnvironment();
+
     memset(pimpl, 0, sizeof(*pimpl));
+    if (path) {
+        pimpl->path = strdup(path);
+    }
+    pimpl->tracker = new ReportTracker;
+    pimpl->outputs = new OutputCoalescer(*this);
+    pimpl->metrics = new CommandMetrics;
+    pimpl->recorder = new SessionRecorder;
 
     // Set up the synchronizing mutex.
     pthread_mutexattr_t mtx_attr;
@@ -98,9 +219,11 @@ Finch::Finch() : initialized(false), pimpl(new Impl) {
         return;
     }
 
-    // Spawn the keep-alive thread.
-    pimpl->stillRunning = true;
-    if (pthread_create(&pimpl->threadid, 0, keepAliveEntryPoint, this) != 0) {
+    // Sign up for keep-alive checks. These run on a timer thread shared by
+    // every Finch in the process.
+    pimpl->keepAliveTimer = TimerService::shared().schedule(
+        TimerService::now() + keepAliveInterval, keepAliveEntryPoint, this);
+    if (pimpl->keepAliveTimer == -1) {
         // Bail on failure.
         return;
     }
@@ -116,6 +239,14 @@ Finch::Finch() : initialized(false), pimpl(new Impl) {
  */
 Finch::~Finch() {
     disConnect();
+    delete pimpl->async;
+    delete pimpl->poller;
+    delete pimpl->outputs;
+    delete pimpl->tracker;
+    delete pimpl->metrics;
+    delete pimpl->recorder;
+    free(pimpl->path);
+    free(pimpl->openedPath);
     delete pimpl;
     pimpl = 0;
 }
@@ -133,13 +264,19 @@ int Finch::connect() {
         return -1;
     }
 
-    // Associate the handle with the Finch's VID (0x2354) and PID (0x1111)
-    pimpl->finch_handle = hid_open(0x2354, 0x1111, NULL);
+    // Open the particular Finch we were asked for, or else the first one
+    free(pimpl->openedPath);
+    pimpl->finch_handle = openFinch(pimpl->path, &pimpl->openedPath);
     if (!pimpl->finch_handle) {
         std::cerr << "Unable to connect to Finch, maybe it's not plugged in or another Finch program is already running?\n";
         return -1;
     }
     else {
+        pimpl->disconnecting = false;
+
+        // Whatever the outputs were set to before, we don't know now
+        pimpl->outputs->invalidate();
+
         // Turn off the LED to indicate that the connection succeeded
         setLED(0, 0, 0);
         return 1;
@@ -157,14 +294,48 @@ int Finch::disConnect() {
     if (pimpl->finch_handle) {
         unsigned char bufToWrite[9];
 
-        // Wait for keep-alive thread to terminate
-        pimpl->stillRunning = false;
-        (void)pthread_join(pimpl->threadid, 0);
+        // Stop trying to reconnect, if we were (waiting for an attempt in
+        // progress to finish)
+        int reconnectTimer;
+        {
+            MutexLocker lock(pimpl->mtx);
+            pimpl->disconnecting = true;
+            reconnectTimer = pimpl->reconnectTimer;
+        }
+        if (reconnectTimer > 0) {
+            TimerService::shared().cancel(reconnectTimer);
+            pimpl->reconnectTimer = 0;
+        }
+
+        // Stop background polling, if it was turned on
+        if (pimpl->poller) {
+            pimpl->poller->stop();
+        }
+
+        // Let any queued asynchronous requests finish
+        if (pimpl->async) {
+            pimpl->async->stop();
+        }
+
+        // Drop any stops still pending from setMotorsFor() and noteOnFor();
+        // the reset below takes care of them
+        cancelTimedStop(pimpl->motorsOffTimer, pimpl->motorsOffWaiter);
+        cancelTimedStop(pimpl->noteOffTimer, pimpl->noteOffWaiter);
+
+        // Send any output commands still waiting to go out
+        pimpl->outputs->stop();
+
+        // Stop the keep-alive checks (waiting for one in progress to finish)
+        if (pimpl->keepAliveTimer > 0) {
+            TimerService::shared().cancel(pimpl->keepAliveTimer);
+            pimpl->keepAliveTimer = 0;
+        }
 
         // send an 'R', which resets the Finch to idle mode
         bufToWrite[0] = 0x0;
         bufToWrite[1] = 'R';
         res = finchWrite(bufToWrite);
+        pimpl->outputs->invalidate();
 
         hid_close(pimpl->finch_handle);
 
@@ -180,7 +351,8 @@ int Finch::disConnect() {
  * @param red Intensity of the red color element, range is 0 to 255
  * @param green Intensity of the green color element, range is 0 to 255
  * @param blue Intensity of the blue color element, range is 0 to 255
- * @return a positive number if the LED was set, -1 if the command failed.
+ * @return a positive number if the LED was set (or was already set that way,
+ * or, while coalescing, if the command was queued), -1 if the command failed.
  */
 int Finch::setLED(int red, int green, int blue) {
     if (!initialized) {
@@ -196,12 +368,12 @@ int Finch::setLED(int red, int green, int blue) {
     }
     else {
         // Create command report, then write it to the Finch
-        bufToWrite[0] = 0x0;
+        memset(bufToWrite, 0, sizeof(bufToWrite));
         bufToWrite[1] = 'O';
         bufToWrite[2] = static_cast<unsigned char>(red);
         bufToWrite[3] = static_cast<unsigned char>(green);
         bufToWrite[4] = static_cast<unsigned char>(blue);
-        return finchWrite(bufToWrite);
+        return pimpl->outputs->write(OutputCoalescer::LED, bufToWrite);
     }
 }
 
@@ -244,8 +416,11 @@ int Finch::setMotors(int leftWheelSpeed, int rightWheelSpeed) {
         bufToWrite[3] = static_cast<unsigned char>(leftWheelSpeed);
         bufToWrite[4] = rightDir;
         bufToWrite[5] = static_cast<unsigned char>(rightWheelSpeed);
+        // A new setting replaces any stop still pending from setMotorsFor()
+        cancelTimedStop(pimpl->motorsOffTimer, pimpl->motorsOffWaiter);
+
         // Write the report to Finch
-        return finchWrite(bufToWrite);
+        return pimpl->outputs->write(OutputCoalescer::MOTORS, bufToWrite);
     }
 }
 
@@ -253,7 +428,8 @@ int Finch::setMotors(int leftWheelSpeed, int rightWheelSpeed) {
  * Sets the speed of the left and right wheels for a specified period of time,
  * after which they turn off.
  *
- * This function blocks program execution by the amount of specified by duration.
+ * This function blocks program execution by the amount of specified by duration;
+ * setMotorsFor() does the same without blocking.
  *
  * @param leftWheelSpeed Power to the left wheel, range is -255 to 255
  * @param rightWheelSpeed Power to the right wheel, range is -255 to 255
@@ -274,7 +450,10 @@ int Finch::setMotors(int leftWheelSpeed, int rightWheelSpeed, int duration) {
     // Set the speeds
     returnVal = setMotors(leftWheelSpeed, rightWheelSpeed);
     // Sleep the program
-    usleep(useconds_t(duration * 1000));
+    {
+        TraceSpan span("sleep", 'M');
+        usleep(useconds_t(duration * 1000));
+    }
     // Turn off the motors
     setMotors(0, 0);
     return returnVal;
@@ -304,7 +483,10 @@ int Finch::noteOn(int frequency) {
     bufToWrite[4] = static_cast<unsigned char>((frequency & 0x0000FFFF) >> 8);
     bufToWrite[5] = static_cast<unsigned char>(frequency & 0x000000FF);
 
-    return finchWrite(bufToWrite);
+    // A new note replaces any noteOff still pending from noteOnFor()
+    cancelTimedStop(pimpl->noteOffTimer, pimpl->noteOffWaiter);
+
+    return pimpl->outputs->write(OutputCoalescer::BUZZER, bufToWrite);
 }
 
 /**
@@ -312,7 +494,7 @@ int Finch::noteOn(int frequency) {
  * period of time.
  *
  * This command blocks program execution by the amount of time specified by
- * duration.
+ * duration; noteOnFor() does the same without blocking.
  *
  * @param frequency The frequency in Hertz to beep at
  * @param duration The duration in milliseconds to hold the note for.
@@ -329,7 +511,10 @@ int Finch::noteOn(int frequency, int duration) {
 
     int returnVal;
     returnVal = noteOn(frequency);
-    usleep(useconds_t(duration * 1000));
+    {
+        TraceSpan span("sleep", 'B');
+        usleep(useconds_t(duration * 1000));
+    }
     noteOff();
     return returnVal;
 }
@@ -353,29 +538,186 @@ int Finch::noteOff() {
     bufToWrite[4] = 0x0;
     bufToWrite[5] = 0x0;
 
-    return finchWrite(bufToWrite);
+    cancelTimedStop(pimpl->noteOffTimer, pimpl->noteOffWaiter);
+
+    return pimpl->outputs->write(OutputCoalescer::BUZZER, bufToWrite);
 }
 
 /**
- * Gets the temperature (in Celcius) as measured by the Finch's thermometer.
+ * Sets the speed of the left and right wheels, and turns them off again after
+ * the given time, without blocking the caller.
  *
- * @return The temperature in degrees Celcius, -1 if the read failed.
+ * The motors are turned off from a library thread, at an absolute deadline
+ * (see timedActionLateness() for how close it gets). Setting the motors again
+ * before then, by any means, cancels the pending stop.
+ *
+ * @param leftWheelSpeed Power to the left wheel, range is -255 to 255
+ * @param rightWheelSpeed Power to the right wheel, range is -255 to 255
+ * @param duration The time in milliseconds to maintain the set speeds
+ * @param onStop Optional; called exactly once, with this function's result:
+ *               from the timer thread once the motors have been turned off,
+ *               from whichever thread cancels the stop, or straight away if
+ *               setting the motors failed.
+ * @return a positive number if the motors were set, -1 if the command failed.
  */
-double Finch::getTemperature() {
-    if (!initialized) {
+int Finch::setMotorsFor(int leftWheelSpeed, int rightWheelSpeed, int duration, StatusCallback onStop, void* context) {
+    const StopWaiter failed = { onStop, context, -1 };
+    if (!initialized || duration < 0) {
+        notifyStopWaiter(failed);
         return -1;
     }
 
-    unsigned char bufToWrite[9]; // Holds the command report
-    unsigned char bufRead[9]; // Holds the raw returned data
-    double temperature; // Holds the final calculated temperature
+    const int returnVal = setMotors(leftWheelSpeed, rightWheelSpeed);
+    if (returnVal == -1) {
+        notifyStopWaiter(failed);
+        return -1;
+    }
+    {
+        MutexLocker lock(pimpl->mtx);
+        const StopWaiter waiter = { onStop, context, returnVal };
+        pimpl->motorsOffWaiter = waiter;
+    }
+    if (scheduleTimedStop(pimpl->motorsOffTimer, duration, motorsOffEntryPoint) == -1) {
+        // Better to stop now than to leave the wheels running for good.
+        (void)takeStopWaiter(pimpl->mtx, pimpl->motorsOffWaiter);
+        setMotors(0, 0);
+        notifyStopWaiter(failed);
+        return -1;
+    }
+    return returnVal;
+}
 
-    // Create a command report that requests temperature data
-    bufToWrite[0] = 0x0;
-    bufToWrite[1] = 'T';
-    if(finchRead(bufToWrite, bufRead) == 1) {
-        temperature = (bufRead[0] - 127) / 2.4 + 25; // Convert raw temperature to Celcius
-        return temperature;
+/**
+ * Turns on the Finch's buzzer, and turns it off again after the given time,
+ * without blocking the caller.
+ *
+ * The buzzer is turned off from a library thread, at an absolute deadline.
+ * Calling noteOn() or noteOff() before then cancels the pending noteOff.
+ *
+ * @param frequency The frequency in Hertz to beep at
+ * @param duration The duration in milliseconds to hold the note for.
+ * @param onStop Optional; called exactly once, as for setMotorsFor().
+ * @return a positive number if the buzzer was set, -1 if the command failed.
+ */
+int Finch::noteOnFor(int frequency, int duration, StatusCallback onStop, void* context) {
+    const StopWaiter failed = { onStop, context, -1 };
+    if (!initialized || duration < 0) {
+        notifyStopWaiter(failed);
+        return -1;
+    }
+
+    const int returnVal = noteOn(frequency);
+    if (returnVal == -1) {
+        notifyStopWaiter(failed);
+        return -1;
+    }
+    {
+        MutexLocker lock(pimpl->mtx);
+        const StopWaiter waiter = { onStop, context, returnVal };
+        pimpl->noteOffWaiter = waiter;
+    }
+    if (scheduleTimedStop(pimpl->noteOffTimer, duration, noteOffEntryPoint) == -1) {
+        (void)takeStopWaiter(pimpl->mtx, pimpl->noteOffWaiter);
+        noteOff();
+        notifyStopWaiter(failed);
+        return -1;
+    }
+    return returnVal;
+}
+
+/**
+ * Reports how late the stops for setMotorsFor() and noteOnFor() have been,
+ * measured from their deadlines to when the stop command had been written
+ * (or handed to the output coalescer), so a slow USB write counts too.
+ *
+ * @return The number of stops so far, with their mean and worst lateness.
+ */
+Finch::Lateness Finch::timedActionLateness() {
+    Lateness lateness = Lateness();
+    MutexLocker lock(pimpl->mtx);
+    lateness.count = pimpl->timedStops;
+    if (pimpl->timedStops > 0) {
+        lateness.meanMicros = double(pimpl->timedTotalLateness) / double(pimpl->timedStops) / 1000.0;
+        lateness.maxMicros = double(pimpl->timedMaxLateness) / 1000.0;
+    }
+    return lateness;
+}
+
+/**
+ * Arranges for callback to run on the precise timer thread in duration
+ * milliseconds, replacing the timer (if any) already in timer.
+ *
+ * @return 1 if the timer was set, -1 if it wasn't.
+ */
+int Finch::scheduleTimedStop(volatile int& timer, int duration, TimedStopCallback callback) {
+    TimerService& timers = TimerService::precise();
+    const int id = timers.schedule(TimerService::now() + duration * 1000000LL, callback, this);
+    if (id == -1) {
+        return -1;
+    }
+    const int previous = __atomic_exchange_n(&timer, id, __ATOMIC_ACQ_REL);
+    if (previous > 0) {
+        timers.cancel(previous);
+    }
+    return 1;
+}
+
+/**
+ * Cancels the timer in timer, if there is one, waiting for it to finish if
+ * it is already running, then runs the callback (if any) still waiting on it.
+ */
+void Finch::cancelTimedStop(volatile int& timer, StopWaiter& waiter) {
+    const int id = __atomic_exchange_n(&timer, 0, __ATOMIC_ACQ_REL);
+    if (id > 0) {
+        TimerService::precise().cancel(id);
+    }
+    notifyStopWaiter(takeStopWaiter(pimpl->mtx, waiter));
+}
+
+/**
+ * Adds one timed stop's lateness (in nanoseconds) to the running totals.
+ */
+void Finch::recordLateness(long long lateness) {
+    MutexLocker lock(pimpl->mtx);
+    pimpl->timedStops++;
+    pimpl->timedTotalLateness += lateness;
+    if (lateness > pimpl->timedMaxLateness) {
+        pimpl->timedMaxLateness = lateness;
+    }
+}
+
+// Timer callbacks for setMotorsFor() and noteOnFor(); they run on the
+// precise timer thread.
+long long Finch::motorsOffEntryPoint(void* pThis, long long deadline, long long /*firedAt*/) {
+    Finch* pthX = static_cast<Finch*>(pThis);
+    TraceSpan span("timed stop", 'M');
+    // Taken first, or setMotors() would run it before the motors had stopped
+    const StopWaiter waiter = takeStopWaiter(pthX->pimpl->mtx, pthX->pimpl->motorsOffWaiter);
+    pthX->setMotors(0, 0);
+    pthX->recordLateness(TimerService::now() - deadline);
+    notifyStopWaiter(waiter);
+    return 0;
+}
+
+long long Finch::noteOffEntryPoint(void* pThis, long long deadline, long long /*firedAt*/) {
+    Finch* pthX = static_cast<Finch*>(pThis);
+    TraceSpan span("timed stop", 'B');
+    const StopWaiter waiter = takeStopWaiter(pthX->pimpl->mtx, pthX->pimpl->noteOffWaiter);
+    pthX->noteOff();
+    pthX->recordLateness(TimerService::now() - deadline);
+    notifyStopWaiter(waiter);
+    return 0;
+}
+
+/**
+ * Gets the temperature (in Celsius) as measured by the Finch's thermometer.
+ *
+ * @return The temperature in degrees Celsius, -1 if the read failed.
+ */
+double Finch::getTemperature() {
+    Temperature temperature = readTemperature();
+    if(temperature.ok) {
+        return temperature.celsius;
     }
     else {
         return -1;
@@ -390,30 +732,12 @@ double Finch::getTemperature() {
  * caller must release with delete[]), null if the read failed.
  */
 double* Finch::getAccelerations() {
-    if (!initialized) {
-        return 0;
-    }
-
-    unsigned char bufToWrite[9]; // Holds the command report
-    unsigned char bufRead[9]; // Holds the raw returned data
-    double* accelerations = new double[3];
-
-    bufToWrite[0] = 0x0;
-    bufToWrite[1] = 'A';
-    if(finchRead(bufToWrite, bufRead) == 1) {
-        // Convert the raw accelerometer data to G-forces
-        for(int i = 0; i < 3; i++) {
-            if(bufRead[i + 1] > 31) {
-                accelerations[i] = (bufRead[i + 1] - 64) * 1.5 / 32;
-            }
-            else {
-                accelerations[i] = bufRead[i + 1] * 1.5 / 32;
-            }
-        }
-        // Check if the latest read indicated the Finch was shaken or tapped.
-        // If so, set the wasTapped and/or wasShaken flags.
-        pimpl->wasTappedVal = pimpl->wasTappedVal || ((bufRead[4] & 0x20) >> 5);
-        pimpl->wasShakenVal = pimpl->wasShakenVal || ((bufRead[4] & 0x80) >> 7);
+    Accel accel = readAccelerations();
+    if(accel.ok) {
+        double* accelerations = new double[3];
+        accelerations[0] = accel.x;
+        accelerations[1] = accel.y;
+        accelerations[2] = accel.z;
         return accelerations;
     }
     else {
@@ -429,19 +753,11 @@ double* Finch::getAccelerations() {
  * (which the caller must release with delete[]), null if read failed.
  */
 int* Finch::getLightSensors() {
-    if (!initialized) {
-        return 0;
-    }
-
-    unsigned char bufToWrite[9]; // Holds command report
-    unsigned char bufRead[9]; // Holds raw returned data
-    int* lightSensors = new int[2]; // Holds array to return
-
-    bufToWrite[0] = 0x0;
-    bufToWrite[1] = 'L';
-    if(finchRead(bufToWrite, bufRead) == 1) {
-        lightSensors[0] = int(bufRead[0]); // Convert values from char to int
-        lightSensors[1] = int(bufRead[1]);
+    LightSensors light = readLightSensors();
+    if(light.ok) {
+        int* lightSensors = new int[2]; // Holds array to return
+        lightSensors[0] = light.left;
+        lightSensors[1] = light.right;
         return lightSensors;
     }
     else {
@@ -457,19 +773,11 @@ int* Finch::getLightSensors() {
  * values (which the caller must release with delete[]), null if read failed.
  */
 int* Finch::getObstacleSensors() {
-    if (!initialized) {
-        return 0;
-    }
-
-    unsigned char bufToWrite[9];
-    unsigned char bufRead[9];
-    int* obstacleSensors = new int[2];
-
-    bufToWrite[0] = 0x0;
-    bufToWrite[1] = 'I';
-    if(finchRead(bufToWrite, bufRead) == 1) {
-        obstacleSensors[0] = int(bufRead[0]);
-        obstacleSensors[1] = int(bufRead[1]);
+    ObstacleSensors obstacles = readObstacleSensors();
+    if(obstacles.ok) {
+        int* obstacleSensors = new int[2];
+        obstacleSensors[0] = obstacles.left;
+        obstacleSensors[1] = obstacles.right;
         return obstacleSensors;
     }
     else {
@@ -478,105 +786,472 @@ int* Finch::getObstacleSensors() {
 }
 
 /**
- * Returns if the Finch was tapped since the last call to wasTapped (no matter
- * how long ago that may have been), or since the start of the program if this
- * is the first call to wasTapped.
+ * Reads the temperature (in Celsius) as measured by the Finch's thermometer.
  *
- * @return 1 if the Finch was tapped, 0 if not, -1 if the read failed.
+ * Unlike getTemperature(), failure is reported through the ok flag rather
+ * than a sentinel value.
+ *
+ * @return The temperature, with ok set to false if the read failed.
  */
-int Finch::wasTapped() {
-    int toReturn;
-    // We need to do at least one call to getAccelerations to get the current tapped state
-    // We are also using this call to detect failure to read
-    if(getAccelerations() == 0) {
-        return -1;
+Finch::Temperature Finch::readTemperature() {
+    Temperature temperature = Temperature();
+    if (!initialized) {
+        return temperature;
     }
-    toReturn = pimpl->wasTappedVal;
-    pimpl->wasTappedVal = 0;
-    return toReturn;
-}
 
-/**
- * Returns if the Finch was shaken since the last call to wasShaken (no matter
- * how long ago that may have been), or since the start of the program if this
- * is the first call to wasShaken.
- *
- * @return 1 if the Finch was shaken, 0 if not, -1 if the read failed.
- */
-int Finch::wasShaken() {
-    int toReturn;
-    // We need to do at least one call to getAccelerations to get the current shaken state
-    // We are also using this call to detect failure to read
-    if(getAccelerations() == 0) {
-        return -1;
+    Sensors cached;
+    if (cachedSensors(cached)) {
+        temperature.celsius = cached.temperature;
+        temperature.ok = true;
+        return temperature;
     }
-    toReturn = pimpl->wasShakenVal;
-    pimpl->wasShakenVal = 0;
-    return toReturn;
+
+    unsigned char bufToWrite[9]; // Holds the command report
+    unsigned char bufRead[9]; // Holds the raw returned data
+
+    // Create a command report that requests temperature data
+    bufToWrite[0] = 0x0;
+    bufToWrite[1] = 'T';
+    if(finchRead(bufToWrite, bufRead) == 1) {
+        temperature.celsius = decodeTemperature(bufRead); // Convert raw temperature to Celsius
+        temperature.ok = true;
+    }
+    return temperature;
 }
 
 /**
- * Used by the keep alive method, left public for creative uses but not
- * ordinarily used by the user.
+ * Reads the X, Y, and Z acceleration values in G's experienced by the Finch's
+ * accelerometer, along with the tap and shake bits of the same reading.
  *
- * This function reads the Finch's ping method, which simply returns the number
- * of times the Finch has been pinged (a number from 0 to 255, overflow returns
- * the value to 0).
+ * Nothing is allocated on the heap; the reading is returned by value.
  *
- * @return Number of times the counter method has been called, -1 if read
- * failed.
+ * @return The reading, with ok set to false if the read failed.
  */
-int Finch::counter() {
+Finch::Accel Finch::readAccelerations() {
+    Accel accel = Accel();
     if (!initialized) {
-        return 0;
+        return accel;
     }
 
-    unsigned char bufToWrite[9];
-    unsigned char bufRead[9];
+    Sensors cached;
+    if (cachedSensors(cached)) {
+        accel.x = cached.accelerations[0];
+        accel.y = cached.accelerations[1];
+        accel.z = cached.accelerations[2];
+        accel.tapped = cached.tapped != 0;
+        accel.shaken = cached.shaken != 0;
+        accel.ok = true;
+        return accel;
+    }
+
+    unsigned char bufToWrite[9]; // Holds the command report
+    unsigned char bufRead[9]; // Holds the raw returned data
+    double accelerations[3];
 
     bufToWrite[0] = 0x0;
-    bufToWrite[1] = 'z';
+    bufToWrite[1] = 'A';
     if(finchRead(bufToWrite, bufRead) == 1) {
-        return (int(bufRead[0]));
-    }
-    else {
-        return -1;
+        // Convert the raw accelerometer data to G-forces
+        decodeAccelerations(bufRead, accelerations);
+        accel.x = accelerations[0];
+        accel.y = accelerations[1];
+        accel.z = accelerations[2];
+        accel.tapped = decodeTapped(bufRead) != 0;
+        accel.shaken = decodeShaken(bufRead) != 0;
+        accel.ok = true;
+        // Check if the latest read indicated the Finch was shaken or tapped.
+        // If so, set the wasTapped and/or wasShaken flags.
+        // Other threads (e.g. the poller) may be latching these at the same time.
+        __atomic_or_fetch(&pimpl->wasTappedVal, accel.tapped ? 1 : 0, __ATOMIC_RELAXED);
+        __atomic_or_fetch(&pimpl->wasShakenVal, accel.shaken ? 1 : 0, __ATOMIC_RELAXED);
     }
+    return accel;
 }
 
 /**
- * Returns the state of the left obstacle sensor.
+ * Reads the left and right light sensor values. Values range from 0 to 255
+ * with higher values indicating more light.
  *
- * @return The state of the left obstacle sensor: 1 for obstacle exists, 0 for
- * no obstacle, -1 for read failed.
+ * @return The reading, with ok set to false if the read failed.
  */
-int Finch::isObstacleLeftSide() {
-    int* obstacles = getObstacleSensors();
-    if(obstacles == 0) {
-        return -1;
+Finch::LightSensors Finch::readLightSensors() {
+    LightSensors light = LightSensors();
+    if (!initialized) {
+        return light;
     }
-    else {
-        int result = obstacles[0];
-        delete [] obstacles;
-        return result;
+
+    Sensors cached;
+    if (cachedSensors(cached)) {
+        light.left = cached.lightSensors[0];
+        light.right = cached.lightSensors[1];
+        light.ok = true;
+        return light;
+    }
+
+    unsigned char bufToWrite[9]; // Holds command report
+    unsigned char bufRead[9]; // Holds raw returned data
+
+    bufToWrite[0] = 0x0;
+    bufToWrite[1] = 'L';
+    if(finchRead(bufToWrite, bufRead) == 1) {
+        light.left = int(bufRead[0]); // Convert values from char to int
+        light.right = int(bufRead[1]);
+        light.ok = true;
     }
+    return light;
 }
 
 /**
- * Returns the state of the right obstacle sensor.
+ * Reads the state of the left and right obstacle sensors.
  *
- * @return The state of the right obstacle sensor: 1 for obstacle exists, 0 for
- * no obstacle, -1 for read failed.
+ * @return The reading (1 where an obstacle was detected, 0 where not), with ok
+ * set to false if the read failed.
+ */
+Finch::ObstacleSensors Finch::readObstacleSensors() {
+    ObstacleSensors obstacles = ObstacleSensors();
+    if (!initialized) {
+        return obstacles;
+    }
+
+    Sensors cached;
+    if (cachedSensors(cached)) {
+        obstacles.left = cached.obstacleSensors[0];
+        obstacles.right = cached.obstacleSensors[1];
+        obstacles.ok = true;
+        return obstacles;
+    }
+
+    unsigned char bufToWrite[9];
+    unsigned char bufRead[9];
+
+    bufToWrite[0] = 0x0;
+    bufToWrite[1] = 'I';
+    if(finchRead(bufToWrite, bufRead) == 1) {
+        obstacles.left = int(bufRead[0]);
+        obstacles.right = int(bufRead[1]);
+        obstacles.ok = true;
+    }
+    return obstacles;
+}
+
+/**
+ * Reads the accelerometer, light, obstacle, and temperature sensors in one
+ * go.
+ *
+ * Rather than doing four lock-step finchRead round trips, the 'A', 'L', 'I'
+ * and 'T' command reports are written back-to-back, and the replies are
+ * matched up to their requests by the report counter (byte 8 going out, byte 7
+ * coming back), in whatever order they arrive.
+ *
+ * @param sensors Filled in with the sensor values if the read succeeded.
+ * @return -1 if read failed, 1 if read succeeded.
+ */
+int Finch::readAll(Sensors& sensors) {
+    if (!initialized) {
+        return -1;
+    }
+
+    static const unsigned char commands[] = { 'A', 'L', 'I', 'T' };
+    const int numCommands = int(sizeof(commands) / sizeof(commands[0]));
+    TraceSpan span("readAll");
+
+    unsigned char bufToWrite[numCommands][9]; // Holds the command reports being sent
+    unsigned char bufRead[numCommands][9]; // Holds the replies, in command order
+    unsigned char reportCounters[numCommands];
+
+    // Tag each request with its own report counter.
+    memset(bufToWrite, 0, sizeof(bufToWrite));
+    for (int i = 0; i < numCommands; i++) {
+        reportCounters[i] = pimpl->tracker->begin();
+        bufToWrite[i][1] = commands[i];
+        bufToWrite[i][8] = reportCounters[i];
+    }
+
+    // Send all of the requests, as one batch, before waiting on any of the
+    // replies.
+    const int sent = writeReports(bufToWrite[0], numCommands);
+
+    if(sent < numCommands) {
+        std::cerr << "Error, failed to write a read command.";
+        std::cerr << "Error is: " << hid_error(pimpl->finch_handle) << "\n";
+        for (int i = 0; i < numCommands; i++) {
+            if (i < sent) {
+                pimpl->tracker->abandon(reportCounters[i]);
+            }
+            else {
+                pimpl->tracker->cancel(reportCounters[i]);
+            }
+        }
+        lostConnection();
+        return -1;
+    }
+
+    // Collect the replies. The tracker matches them up by report counter,
+    // in whatever order they arrive.
+    const long long waitStart = TimerService::now();
+    for (int i = 0; i < numCommands; i++) {
+        const int readResult = pimpl->tracker->wait(pimpl->finch_handle, reportCounters[i], bufRead[i], replyTimeout);
+        pimpl->metrics->record(commands[i], CommandMetrics::READ_WAIT, TimerService::now() - waitStart);
+        if (readResult == 1 && pimpl->recorder->recording()) {
+            pimpl->recorder->recordReply(commands[i], bufRead[i]);
+        }
+        if (readResult == -1) {
+            pimpl->metrics->recordError(commands[i]);
+            std::cerr << "Error, failed to read.";
+            std::cerr << "Error is: " << hid_error(pimpl->finch_handle) << "\n";
+            for (int j = i + 1; j < numCommands; j++) {
+                pimpl->tracker->abandon(reportCounters[j]);
+            }
+            lostConnection();
+            return -1;
+        }
+    }
+
+    decodeAccelerations(bufRead[0], sensors.accelerations);
+    sensors.tapped = decodeTapped(bufRead[0]);
+    sensors.shaken = decodeShaken(bufRead[0]);
+    __atomic_or_fetch(&pimpl->wasTappedVal, sensors.tapped, __ATOMIC_RELAXED);
+    __atomic_or_fetch(&pimpl->wasShakenVal, sensors.shaken, __ATOMIC_RELAXED);
+    sensors.lightSensors[0] = int(bufRead[1][0]);
+    sensors.lightSensors[1] = int(bufRead[1][1]);
+    sensors.obstacleSensors[0] = int(bufRead[2][0]);
+    sensors.obstacleSensors[1] = int(bufRead[2][1]);
+    sensors.temperature = decodeTemperature(bufRead[3]);
+    return 1;
+}
+
+/**
+ * Turns on background polling. A library thread reads every sensor rateHz
+ * times a second, and from then on the read*() and get*() functions answer
+ * from the latest of those readings (without any USB traffic or locking), as
+ * long as it is no more than maxStaleness milliseconds old. If it is older
+ * than that, they fall back to reading from the Finch as usual.
+ *
+ * @param rateHz How many times a second to read the sensors.
+ * @param maxStaleness The oldest reading (in milliseconds) the getters will
+ *                     answer from.
+ * @return 1 if polling was started, -1 if it failed.
+ */
+int Finch::startPolling(int rateHz, int maxStaleness) {
+    if (!initialized) {
+        return -1;
+    }
+
+    MutexLocker lock(pimpl->mtx);
+    if (!pimpl->poller) {
+        __atomic_store_n(&pimpl->poller, new SensorPoller(*this), __ATOMIC_RELEASE);
+    }
+    lock.unlock();
+
+    return pimpl->poller->start(rateHz, maxStaleness);
+}
+
+/**
+ * Turns off background polling; the getters go back to reading from the
+ * Finch on every call.
+ */
+void Finch::stopPolling() {
+    SensorPoller* poller = __atomic_load_n(&pimpl->poller, __ATOMIC_ACQUIRE);
+    if (poller) {
+        poller->stop();
+    }
+}
+
+/**
+ * Gets the latest readings taken by the background poller, without any USB
+ * traffic.
+ *
+ * @param sensors Filled in with the readings if they are fresh enough.
+ * @param maxStaleness The oldest reading (in milliseconds) to accept.
+ * @return 1 if a fresh enough reading was available, -1 if not.
+ */
+int Finch::readCachedSensors(Sensors& sensors, int maxStaleness) {
+    SensorPoller* poller = __atomic_load_n(&pimpl->poller, __ATOMIC_ACQUIRE);
+    if (poller && poller->latest(sensors, maxStaleness)) {
+        return 1;
+    }
+    return -1;
+}
+
+/**
+ * Turns on output coalescing. From then on setLED(), setMotors(), noteOn()
+ * and noteOff() return straight away, and a library thread sends the
+ * commands. If an output is set again before its last setting has gone out,
+ * only the newest setting is sent, so a tight animation loop can't back up
+ * the USB link. Use flushOutputs() to wait for the commands to go out.
+ *
+ * @return 1 if coalescing was turned on, -1 if it failed.
+ */
+int Finch::startCoalescing() {
+    if (!initialized) {
+        return -1;
+    }
+    return pimpl->outputs->start();
+}
+
+/**
+ * Turns off output coalescing, once every queued output command has been
+ * sent; the setters go back to sending their commands themselves.
+ */
+void Finch::stopCoalescing() {
+    pimpl->outputs->stop();
+}
+
+/**
+ * Waits until every output command queued while coalescing has been sent.
+ *
+ * @return 1 if they all went out, -1 if any of them failed since the last
+ * call to flushOutputs().
+ */
+int Finch::flushOutputs() {
+    return pimpl->outputs->flush();
+}
+
+/**
+ * Returns the number of output commands that weren't sent, because the Finch
+ * was already set that way.
+ *
+ * @return The number of skipped commands since the Finch was constructed.
+ */
+unsigned long Finch::skippedOutputs() {
+    return pimpl->outputs->skipped();
+}
+
+/**
+ * Returns the number of output commands, given while coalescing, that were
+ * replaced by a newer setting of the same output before they were sent.
+ *
+ * @return The number of coalesced commands since the Finch was constructed.
+ */
+unsigned long Finch::coalescedOutputs() {
+    return pimpl->outputs->coalesced();
+}
+
+/**
+ * Fetches the poller's latest readings, if polling is on and they are within
+ * the staleness limit given to startPolling().
+ */
+bool Finch::cachedSensors(Sensors& sensors) {
+    SensorPoller* poller = __atomic_load_n(&pimpl->poller, __ATOMIC_ACQUIRE);
+    return poller && poller->latest(sensors);
+}
+
+/**
+ * Returns if the Finch was tapped since the last call to wasTapped (no matter
+ * how long ago that may have been), or since the start of the program if this
+ * is the first call to wasTapped.
+ *
+ * @return 1 if the Finch was tapped, 0 if not, -1 if the read failed.
+ */
+int Finch::wasTapped() {
+    int toReturn;
+    // We need to do at least one call to readAccelerations to get the current tapped state
+    // We are also using this call to detect failure to read
+    if(!readAccelerations().ok) {
+        return -1;
+    }
+    // Read and clear in one go, so a tap latched in between isn't lost.
+    toReturn = __atomic_exchange_n(&pimpl->wasTappedVal, 0, __ATOMIC_RELAXED);
+    return toReturn;
+}
+
+/**
+ * Returns if the Finch was shaken since the last call to wasShaken (no matter
+ * how long ago that may have been), or since the start of the program if this
+ * is the first call to wasShaken.
+ *
+ * @return 1 if the Finch was shaken, 0 if not, -1 if the read failed.
+ */
+int Finch::wasShaken() {
+    int toReturn;
+    // We need to do at least one call to readAccelerations to get the current shaken state
+    // We are also using this call to detect failure to read
+    if(!readAccelerations().ok) {
+        return -1;
+    }
+    // Read and clear in one go, so a shake latched in between isn't lost.
+    toReturn = __atomic_exchange_n(&pimpl->wasShakenVal, 0, __ATOMIC_RELAXED);
+    return toReturn;
+}
+
+/**
+ * Used by the keep alive method, left public for creative uses but not
+ * ordinarily used by the user.
+ *
+ * This function reads the Finch's ping method, which simply returns the number
+ * of times the Finch has been pinged (a number from 0 to 255, overflow returns
+ * the value to 0).
+ *
+ * @return Number of times the counter method has been called, -1 if read
+ * failed.
+ */
+int Finch::counter() {
+    if (!initialized) {
+        return 0;
+    }
+
+    unsigned char bufToWrite[9];
+    unsigned char bufRead[9];
+
+    bufToWrite[0] = 0x0;
+    bufToWrite[1] = 'z';
+    if(finchRead(bufToWrite, bufRead) == 1) {
+        return (int(bufRead[0]));
+    }
+    else {
+        return -1;
+    }
+}
+
+/**
+ * Returns the number of replies that arrived after the request they belonged
+ * to had already given up on them (e.g. because an earlier read failed).
+ *
+ * @return The number of late replies seen since the Finch was constructed.
+ */
+unsigned long Finch::lateReports() {
+    return pimpl->tracker->lateReports();
+}
+
+/**
+ * Returns the number of replies whose report counter didn't match any request
+ * that had been sent.
+ *
+ * @return The number of orphaned replies seen since the Finch was constructed.
+ */
+unsigned long Finch::orphanedReports() {
+    return pimpl->tracker->orphanedReports();
+}
+
+/**
+ * Returns the state of the left obstacle sensor.
+ *
+ * @return The state of the left obstacle sensor: 1 for obstacle exists, 0 for
+ * no obstacle, -1 for read failed.
+ */
+int Finch::isObstacleLeftSide() {
+    ObstacleSensors reading = readObstacleSensors();
+    if(!reading.ok) {
+        return -1;
+    }
+    else {
+        return reading.left;
+    }
+}
+
+/**
+ * Returns the state of the right obstacle sensor.
+ *
+ * @return The state of the right obstacle sensor: 1 for obstacle exists, 0 for
+ * no obstacle, -1 for read failed.
  */
 int Finch::isObstacleRightSide() {
-    int* obstacles = getObstacleSensors();
-    if(obstacles == 0) {
+    ObstacleSensors reading = readObstacleSensors();
+    if(!reading.ok) {
         return -1;
     }
     else {
-        int result = obstacles[1];
-        delete [] obstacles;
-        return result;
+        return reading.right;
     }
 }
 
@@ -587,14 +1262,12 @@ int Finch::isObstacleRightSide() {
  * 0-255. -1 if read failed.
  */
 int Finch::getLeftLightSensor() {
-    int* lightSensors = getLightSensors();
-    if(lightSensors == 0) {
+    LightSensors reading = readLightSensors();
+    if(!reading.ok) {
         return -1;
     }
     else {
-        int result = lightSensors[0];
-        delete [] lightSensors;
-        return result;
+        return reading.left;
     }
 }
 
@@ -605,14 +1278,12 @@ int Finch::getLeftLightSensor() {
  * 0-255. -1 if read failed.
  */
 int Finch::getRightLightSensor() {
-    int* lightSensors = getLightSensors();
-    if(lightSensors == 0) {
+    LightSensors reading = readLightSensors();
+    if(!reading.ok) {
         return -1;
     }
     else {
-        int result = lightSensors[1];
-        delete [] lightSensors;
-        return result;
+        return reading.right;
     }
 }
 
@@ -624,14 +1295,12 @@ int Finch::getRightLightSensor() {
  * failed.
  */
 double Finch::getXAcceleration() {
-    double* accelerations = getAccelerations();
-    if(accelerations == 0) {
+    Accel reading = readAccelerations();
+    if(!reading.ok) {
         return -2;
     }
     else {
-        double result = accelerations[0];
-        delete [] accelerations;
-        return result;
+        return reading.x;
     }
 }
 
@@ -643,14 +1312,12 @@ double Finch::getXAcceleration() {
  * failed.
  */
 double Finch::getYAcceleration() {
-    double* accelerations = getAccelerations();
-    if(accelerations == 0) {
+    Accel reading = readAccelerations();
+    if(!reading.ok) {
         return -2;
     }
     else {
-        double result = accelerations[1];
-        delete [] accelerations;
-        return result;
+        return reading.y;
     }
 }
 
@@ -662,37 +1329,26 @@ double Finch::getYAcceleration() {
  * failed.
  */
 double Finch::getZAcceleration() {
-    double* accelerations = getAccelerations();
-    if(accelerations == 0) {
+    Accel reading = readAccelerations();
+    if(!reading.ok) {
         return -2;
     }
     else {
-        double result = accelerations[2];
-        delete [] accelerations;
-        return result;
+        return reading.z;
     }
 }
 
 /**
- * This method returns 1 if the beak is up (Finch sitting on its tail), 0
- * otherwise,  and -1 on failure.
+ * Works out which orientations the Finch is in from a single accelerometer
+ * read, so that all of the checks see the same sample.
  *
- * @return 1 if beak is pointed at ceiling, 0 if not, -1 if reading failed
+ * @return A bitmask of Orientation flags (ORIENTATION_NONE if the Finch isn't
+ * in any of the known orientations), -1 if reading failed.
  */
-int Finch::isBeakUp() {
-    double* accels = getAccelerations();
-    if (accels != 0) {
-        int result;
-        if (accels[0] < -0.8 && accels[0] > -1.5
-            && accels[1] > -0.3 && accels[1] < 0.3
-            && accels[2] > -0.3 && accels[2] < 0.3) {
-            result = 1;
-        }
-        else {
-            result = 0;
-        }
-        delete [] accels;
-        return result;
+int Finch::classifyOrientation() {
+    Accel accel = readAccelerations();
+    if (accel.ok) {
+        return classifyOrientation(accel);
     }
     else {
         return -1;
@@ -700,29 +1356,61 @@ int Finch::isBeakUp() {
 }
 
 /**
- * This method returns 1 if the beak is pointed at the floor, 0 otherwise,
- * and -1 on failure.
+ * Works out which orientations an already-captured accelerometer reading
+ * corresponds to. No I/O is performed.
  *
- * @return 1 if beak is pointed at the floor, 0 if not, -1 if reading failed.
+ * @param accel The reading to classify.
+ * @return A bitmask of Orientation flags, -1 if the reading is not ok.
  */
-int Finch::isBeakDown() {
-    double* accels = getAccelerations();
-    if (accels != 0) {
-        int result;
-        if (accels[0] < 1.5 && accels[0] > 0.8
-            && accels[1] > -0.3 && accels[1] < 0.3
-            && accels[2] > -0.3 && accels[2] < 0.3) {
-            result = 1;
-        }
-        else {
-            result = 0;
+int Finch::classifyOrientation(const Accel& accel) {
+    if (!accel.ok) {
+        return -1;
+    }
+
+    int result = ORIENTATION_NONE;
+    for (int i = 0; i < numOrientationRanges; i++) {
+        const OrientationRange& range = orientationRanges[i];
+        if (accel.x > range.minX && accel.x < range.maxX
+            && accel.y > range.minY && accel.y < range.maxY
+            && accel.z > range.minZ && accel.z < range.maxZ) {
+            result |= range.orientation;
         }
-        delete [] accels;
-        return result;
     }
-    else {
+    return result;
+}
+
+/**
+ * Checks a single orientation flag against a fresh accelerometer read.
+ *
+ * @return 1 if the Finch is in the given orientation, 0 if not, -1 if reading
+ * failed.
+ */
+int Finch::hasOrientation(int orientation) {
+    const int result = classifyOrientation();
+    if (result == -1) {
         return -1;
     }
+    return (result & orientation) ? 1 : 0;
+}
+
+/**
+ * This method returns 1 if the beak is up (Finch sitting on its tail), 0
+ * otherwise,  and -1 on failure.
+ *
+ * @return 1 if beak is pointed at ceiling, 0 if not, -1 if reading failed
+ */
+int Finch::isBeakUp() {
+    return hasOrientation(BEAK_UP);
+}
+
+/**
+ * This method returns 1 if the beak is pointed at the floor, 0 otherwise,
+ * and -1 on failure.
+ *
+ * @return 1 if beak is pointed at the floor, 0 if not, -1 if reading failed.
+ */
+int Finch::isBeakDown() {
+    return hasOrientation(BEAK_DOWN);
 }
 
 /**
@@ -732,23 +1420,7 @@ int Finch::isBeakDown() {
  * @return 1 if the Finch is level, 0 if not, -1 if reading failed.
  */
 int Finch::isFinchLevel() {
-    double* accels = getAccelerations();
-    if (accels != 0) {
-        int result;
-        if (accels[0] > -0.5 && accels[0] < 0.5
-            && accels[1] > -0.5 && accels[1] < 0.5
-            && accels[2] > 0.65 && accels[2] < 1.5) {
-            result = 1;
-        }
-        else {
-            result = 0;
-        }
-        delete [] accels;
-        return result;
-    }
-    else {
-        return false;
-    }
+    return hasOrientation(LEVEL);
 }
 
 /**
@@ -758,23 +1430,7 @@ int Finch::isFinchLevel() {
  * @return 1 if Finch is upside down, 0 if not, -1 if reading failed.
  */
 int Finch::isFinchUpsideDown() {
-    double* accels = getAccelerations();
-    if (accels != 0) {
-        int result;
-        if (accels[0] > -0.5 && accels[0] < 0.5
-            && accels[1] > -0.5 && accels[1] < 0.5
-            && accels[2] > -1.5 && accels[2] < -0.65) {
-            result = 1;
-        }
-        else {
-            result = 0;
-        }
-        delete [] accels;
-        return result;
-    }
-    else {
-        return -1;
-    }
+    return hasOrientation(UPSIDE_DOWN);
 }
 
 /**
@@ -784,23 +1440,7 @@ int Finch::isFinchUpsideDown() {
  * @return 1 if Finch's left wing is down, 0 if not, -1 if reading failed.
  */
 int Finch::isLeftWingDown() {
-    double* accels = getAccelerations();
-    if (accels != 0) {
-        int result;
-        if (accels[0] > -0.5 && accels[0] < 0.5
-            && accels[1] > 0.7 && accels[1] < 1.5
-            && accels[2] > -0.5 && accels[2] < 0.5) {
-            result = 1;
-        }
-        else {
-            result = 0;
-        }
-        delete [] accels;
-        return result;
-    }
-    else {
-        return -1;
-    }
+    return hasOrientation(LEFT_WING_DOWN);
 }
 
 /**
@@ -810,55 +1450,69 @@ int Finch::isLeftWingDown() {
  * @return 1 if Finch's right wing is down, 0 if not, -1 if reading failed.
  */
 int Finch::isRightWingDown() {
-    double* accels = getAccelerations();
-    if (accels != 0) {
-        int result;
-        if (accels[0] > -0.5 && accels[0] < 0.5
-            && accels[1] > -1.5 && accels[1] < -0.7
-            && accels[2] > -0.5 && accels[2] < 0.5) {
-            result = 1;
-        }
-        else {
-            result = 0;
-        }
-        delete [] accels;
-        return result;
-    }
-    else {
-        return -1;
-    }
+    return hasOrientation(RIGHT_WING_DOWN);
 }
 
 /**
- * Not for use by user. The function called to keep the Finch from moving into
- * idle mode while a program is running.
- * 
+ * Not for use by user. Called once a second (on the shared keep-alive timer
+ * thread) to keep the Finch from moving into idle mode while a program is
+ * running. Pings the Finch if nothing else has talked to it since the last
+ * check. Also checks the Finch is still plugged in, so that if it has been
+ * pulled out we start reconnecting straight away, even if nothing is
+ * talking to it.
  */
 void Finch::keepAlive() {
-    while(pimpl->stillRunning) {
-        // Delay for up to 1 second (but look around more often than that, so
-        // that the main thread isn't held up waiting for us to quit).
-        for (int i = 0; i < 10 && pimpl->stillRunning; ++i) {
-            usleep(100000);     // 1/10th of a second
-        }
-        if (!pimpl->stillRunning) {
-            break;
+    if (pimpl->openedPath && !finchPresent(pimpl->openedPath)) {
+        if (TraceLog::enabled()) {
+            TraceLog::instant("keep-alive: unplugged", TimerService::now());
         }
+        lostConnection();
+        return;
+    }
 
-        MutexLocker lock(pimpl->mtx, true);
-        if (!lock.isLocked()) {
-            // OK, we couldn't grab the lock, so the other thread must be doing
-            // something right now.  So there's nothing for us to do.
-        } else if (pimpl->syncCounter != 0) {
-            // We grabbed the lock, but either the other thread did something
-            // while we were sleeping, or else the last time we were active,
-            // we sent out a ping.  So there's nothing for us to do, except to
-            // clear the syncCounter.
-            pimpl->syncCounter = 0;
-        } else {
-            // OK, we need to send out a ping.
-            counter();
+    MutexLocker lock(pimpl->mtx, true);
+    if (!lock.isLocked()) {
+        // OK, we couldn't grab the lock, so the other thread must be doing
+        // something right now.  So there's nothing for us to do.
+        if (TraceLog::enabled()) {
+            TraceLog::instant("keep-alive: busy", TimerService::now());
+        }
+    } else if (pimpl->syncCounter != 0) {
+        // We grabbed the lock, but either the other thread did something
+        // since the last check, or else the last time we were active, we
+        // sent out a ping.  So there's nothing for us to do, except to clear
+        // the syncCounter.
+        pimpl->syncCounter = 0;
+        if (TraceLog::enabled()) {
+            TraceLog::instant("keep-alive: recent traffic", TimerService::now());
         }
+    } else {
+        // OK, we need to send out a ping. We don't wait for the reply, so
+        // that one slow Finch can't hold up the checks for all the others.
+        lock.unlock();
+        ping();
+    }
+}
+
+/**
+ * Sends a counter ('z') command report without waiting for the reply, which
+ * the tracker will quietly throw away when it arrives.
+ */
+void Finch::ping() {
+    unsigned char bufToWrite[9];
+    memset(bufToWrite, 0, sizeof(bufToWrite));
+    bufToWrite[1] = 'z';
+    const unsigned char reportCounter = pimpl->tracker->begin();
+    bufToWrite[8] = reportCounter;
+    TraceSpan span("keep-alive ping", 'z');
+    span.setCounter(reportCounter);
+
+    if (writeReports(bufToWrite, 1) < 1) {
+        pimpl->tracker->cancel(reportCounter);
+        lostConnection();
+    }
+    else {
+        pimpl->tracker->discard(reportCounter);
     }
 }
 
@@ -875,47 +1529,40 @@ int Finch::finchRead(unsigned char bufToWrite[], unsigned char bufRead[]) {
         return -1;
     }
 
-    int res; // Holds the result of the HIDAPI hid_write and hid_read commands
-    unsigned char tempReportCounter = pimpl->sendReportCounter;
-    // Use the "sendReportCounter" to associate a specific command report with a resulting
-    // read report.
-    // If we're using the 'z' command (counter command), we don't need to do this since we're
-    // only using it for the keepAlive thread.
-    if(bufToWrite[1] != 'z') {
-        bufToWrite[8] = pimpl->sendReportCounter;
-        pimpl->sendReportCounter++;
-    }
-
-    // Prevent the other thread from reading/writing at the same time
-    MutexLocker lock(pimpl->mtx);
-
-    // Update the syncCounter.
-    pimpl->syncCounter = 1;
+    // Use a report counter from the tracker to associate a specific command
+    // report with a resulting read report.
+    const unsigned char reportCounter = pimpl->tracker->begin();
+    bufToWrite[8] = reportCounter;
+    TraceSpan span("finchRead", bufToWrite[1]);
+    span.setCounter(reportCounter);
 
-    // Write a command report
-    res = hid_write(pimpl->finch_handle, bufToWrite, 9);
-    if(res == -1) {
+    // Write a command report. Replies are routed by the tracker, so other
+    // threads can send their own requests while we wait for ours.
+    if(writeReports(bufToWrite, 1) < 1) {
         std::cerr << "Error, failed to write a read command.";
         std::cerr << "Error is: " << hid_error(pimpl->finch_handle) << "\n";
+        pimpl->tracker->cancel(reportCounter);
+        lostConnection();
         return -1;
     }
-    else {
-        // Read the raw data using hid_read. If the returned report counter value does
-        // not match our value, try again (this is for safety only, in practice, this loop
-        // only runs once).
-        do {
-            res = hid_read(pimpl->finch_handle, bufRead, 9);
-            if(res == -1) {
-                std::cerr << "Error, failed to read.";
-                std::cerr << "Error is: " << hid_error(pimpl->finch_handle) << "\n";
-                return -1;
-            }
-        }
-        while((bufRead[7] != tempReportCounter) && (bufToWrite[1] != 'z'));
 
-        // If you got here, your read succeeded. Yeay!
-        return 1;
+    // Wait for the report carrying our counter.
+    const long long waitStart = TimerService::now();
+    const int readResult = pimpl->tracker->wait(pimpl->finch_handle, reportCounter, bufRead, replyTimeout);
+    pimpl->metrics->record(bufToWrite[1], CommandMetrics::READ_WAIT, TimerService::now() - waitStart);
+    if (readResult == 1 && pimpl->recorder->recording()) {
+        pimpl->recorder->recordReply(bufToWrite[1], bufRead);
+    }
+    if(readResult == -1) {
+        pimpl->metrics->recordError(bufToWrite[1]);
+        std::cerr << "Error, failed to read.";
+        std::cerr << "Error is: " << hid_error(pimpl->finch_handle) << "\n";
+        lostConnection();
+        return -1;
     }
+
+    // If you got here, your read succeeded. Yeay!
+    return 1;
 }
 
 /**
@@ -930,13 +1577,294 @@ int Finch::finchWrite(unsigned char bufToWrite[]) {
         return -1;
     }
 
-    // Prevent the other thread from reading/writing at the same time
+    if (writeReports(bufToWrite, 1) < 1) {
+        lostConnection();
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * Writes several command reports in one go. They are handed to the USB stack
+ * together and reach the Finch in order, so queueing up a burst of commands
+ * costs one trip through the library rather than one per command.
+ *
+ * @param reports The 9 byte command reports, in the order to send them.
+ * @param count The number of reports.
+ * @return 1 if every report was written, -1 if any of them failed.
+ */
+int Finch::finchWriteBatch(const unsigned char reports[][9], int count) {
+    if (!initialized || count < 0) {
+        return -1;
+    }
+
+    if (writeReports(reports[0], count) < count) {
+        lostConnection();
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * Writes command reports, laid out back to back, and waits for them to go out.
+ * The lock is only held while they are being submitted, not for the whole USB
+ * transaction, so other threads can get on with their own requests meanwhile.
+ *
+ * @param reports count 9 byte command reports.
+ * @param count The number of reports.
+ * @return The number of reports written successfully, from 0 to count.
+ */
+int Finch::writeReports(const unsigned char reports[], int count) {
+    WriteCompletion completion;
+    pthread_mutex_init(&completion.mtx, 0);
+    pthread_cond_init(&completion.cond, 0);
+    completion.done = false;
+    completion.written = 0;
+
+    const bool tracing = TraceLog::enabled();
+    const long long lockRequested = TimerService::now();
+    long long lockTaken;
+    int res;
+    {
+        // Prevent the other thread from writing at the same time, so each
+        // batch goes out in one piece.
+        MutexLocker lock(pimpl->mtx);
+        lockTaken = TimerService::now();
+
+        // Update the syncCounter.
+        pimpl->syncCounter = 1;
+
+        // Record the reports while they can't be overtaken by anyone else's.
+        if (pimpl->recorder->recording()) {
+            for (int i = 0; i < count; i++) {
+                pimpl->recorder->recordCommand(reports + i * 9);
+            }
+        }
+
+        res = hid_write_batch(pimpl->finch_handle, reports, 9, size_t(count), writeFinished, &completion);
+    }
+    const long long lockReleased = tracing ? TimerService::now() : 0;
+
+    if (res != -1) {
+        MutexLocker lock(completion.mtx);
+        while (!completion.done) {
+            pthread_cond_wait(&completion.cond, &completion.mtx);
+        }
+    }
+    pthread_cond_destroy(&completion.cond);
+    pthread_mutex_destroy(&completion.mtx);
+    const int written = (res == -1) ? 0 : completion.written;
+
+    // Every report in the batch waited for the lock, and went out, together.
+    const long long finished = TimerService::now();
+    for (int i = 0; i < count; i++) {
+        const unsigned char command = reports[i * 9 + 1];
+        pimpl->metrics->recordCall(command);
+        pimpl->metrics->record(command, CommandMetrics::LOCK_WAIT, lockTaken - lockRequested);
+        pimpl->metrics->record(command, CommandMetrics::WRITE, finished - lockTaken);
+        if (i >= written) {
+            pimpl->metrics->recordError(command);
+        }
+        if (tracing) {
+            TraceLog::span("write", lockTaken, finished, command, reports[i * 9 + 8]);
+        }
+    }
+    if (tracing) {
+        TraceLog::span("lock wait", lockRequested, lockTaken);
+        TraceLog::span("lock held", lockTaken, lockReleased);
+    }
+    return written;
+}
+
+/**
+ * Called whenever talking to the Finch fails. Unless we're already on it,
+ * starts trying to reconnect (on the shared timer thread), in case the Finch
+ * has been unplugged, or has dropped off the bus for a moment.
+ */
+void Finch::lostConnection() {
     MutexLocker lock(pimpl->mtx);
+    if (!initialized || pimpl->disconnecting || pimpl->reconnectTimer != 0) {
+        return;
+    }
 
-    // Update the syncCounter.
-    pimpl->syncCounter = 1;
+    const long long now = TimerService::now();
+    pimpl->lostAt = now;
+    pimpl->reconnectBackoff = firstReconnectDelay;
+    pimpl->reconnectTimer = TimerService::shared().schedule(
+        now + pimpl->reconnectBackoff, reconnectEntryPoint, this);
+    if (pimpl->reconnectTimer == -1) {
+        pimpl->reconnectTimer = 0;
+    }
+}
 
-    int returnVal;
-    returnVal = hid_write(pimpl->finch_handle, bufToWrite, 9);
-    return returnVal;
+/**
+ * Reconnect timer callback; runs on the shared timer thread. If the Finch
+ * still answers on the old handle, there's nothing to do. Otherwise tries to
+ * open it afresh, trying again later (backing off each time) if it isn't
+ * back yet. Once it's back, switches over to the new handle, and sends the
+ * LED, motor and buzzer settings the program last asked for.
+ *
+ * @return When to try again, or 0 if we're done.
+ */
+long long Finch::reconnectEntryPoint(void* pThis, long long /*deadline*/, long long firedAt) {
+    Finch* pthX = static_cast<Finch*>(pThis);
+    Impl* pimpl = pthX->pimpl;
+    TraceSpan span("reconnect attempt");
+    const bool present = pimpl->openedPath && finchPresent(pimpl->openedPath);
+
+    {
+        MutexLocker lock(pimpl->mtx);
+        if (pimpl->disconnecting) {
+            pimpl->reconnectTimer = 0;
+            return 0;
+        }
+
+        // Is the old handle still good? (e.g. if a read just failed once)
+        unsigned char bufToWrite[9];
+        memset(bufToWrite, 0, sizeof(bufToWrite));
+        bufToWrite[1] = 'z';
+        const unsigned char reportCounter = pimpl->tracker->begin();
+        bufToWrite[8] = reportCounter;
+        if (present && hid_write(pimpl->finch_handle, bufToWrite, 9) != -1) {
+            pimpl->tracker->discard(reportCounter);
+            pimpl->reconnectTimer = 0;
+            return 0;
+        }
+        pimpl->tracker->cancel(reportCounter);
+    }
+
+    char* openedPath;
+    hid_device* handle = openFinch(pimpl->path, &openedPath);
+    if (!handle) {
+        // Not back yet; wait a bit longer each time.
+        pimpl->reconnectBackoff = std::min(pimpl->reconnectBackoff * 2, maxReconnectDelay);
+        return firedAt + pimpl->reconnectBackoff;
+    }
+
+    {
+        MutexLocker lock(pimpl->mtx);
+
+        // Nothing else can write while we hold the lock; get everyone who's
+        // still waiting on a reply from the old handle off it before closing
+        // it.
+        pimpl->tracker->reset();
+        hid_close(pimpl->finch_handle);
+        pimpl->finch_handle = handle;
+        free(pimpl->openedPath);
+        pimpl->openedPath = openedPath;
+        pimpl->syncCounter = 1;
+        pimpl->reconnectTimer = 0;
+    }
+
+    // The Finch will have come back up in idle mode; put it back how the
+    // program left it.
+    pimpl->outputs->reapply();
+
+    MutexLocker lock(pimpl->mtx);
+    pimpl->reconnects++;
+    pimpl->lastRecovery = TimerService::now() - pimpl->lostAt;
+    return 0;
+}
+
+/**
+ * Returns the number of times the connection to the Finch has been lost and
+ * then re-established (e.g. after the USB cable was pulled out and plugged
+ * back in).
+ *
+ * @return The number of reconnections since the Finch was constructed.
+ */
+unsigned long Finch::reconnects() {
+    MutexLocker lock(pimpl->mtx);
+    return pimpl->reconnects;
+}
+
+/**
+ * Returns how long the most recent reconnection took, from the first failed
+ * transfer to the Finch's outputs being put back how they were.
+ *
+ * @return The time in milliseconds, or -1 if there hasn't been a reconnection.
+ */
+double Finch::lastRecoveryTime() {
+    MutexLocker lock(pimpl->mtx);
+    if (pimpl->reconnects == 0) {
+        return -1;
+    }
+    return double(pimpl->lastRecovery) / 1000000.0;
+}
+
+/**
+ * Returns call counts, error counts and latency percentiles for each kind of
+ * command sent to the Finch since it was constructed. The latency is split
+ * into waiting for the lock that keeps writes in order, writing the report,
+ * and waiting for the reply, so a slowdown can be put down to lock
+ * contention (e.g. with the keep-alive pings, which count as 'z' commands),
+ * the USB link, or neither. Commands written together in a batch (e.g. by
+ * the output thread while coalescing) each get the time of the whole batch.
+ *
+ * Safe to call at any time, from any thread; nothing has to stop for it.
+ * Commands still in flight may be only partly counted.
+ *
+ * @return The statistics for each command, in the order A, L, I, T, O, M, B,
+ * z, R, then every other command together (as '?').
+ */
+Finch::Stats Finch::stats() {
+    Stats snapshot;
+    pimpl->metrics->snapshot(snapshot);
+    return snapshot;
+}
+
+/**
+ * Starts tracing the HID traffic of every Finch in the program: each report
+ * written and read, keep-alive checks and pings, waiting for and holding
+ * each Finch's lock, and the sleeps in setMotors() and noteOn() with a
+ * duration. Each thread keeps its own record, so tracing slows things down
+ * very little; while it's off, it costs next to nothing.
+ *
+ * Setting the FINCH_TRACE environment variable to a file name does the same
+ * for a whole program, without changing it: tracing starts with the first
+ * Finch, and the trace is written to the file when the program exits.
+ *
+ * @return 1 if tracing started, -1 if it was already on.
+ */
+int Finch::startTracing() {
+    return TraceLog::start();
+}
+
+/**
+ * Stops tracing, and writes out everything traced since startTracing() as
+ * Chrome trace-event JSON, which can be opened in chrome://tracing or the
+ * Perfetto UI (ui.perfetto.dev).
+ *
+ * @param path The file to write the trace to.
+ * @return 1 if the trace was written, -1 if tracing wasn't on or the file
+ * couldn't be written.
+ */
+int Finch::stopTracing(const char* path) {
+    return TraceLog::stop(path);
+}
+
+/**
+ * Starts recording this Finch's session: every command report sent to it,
+ * and every reply it gives, with the time it went out or came back. The
+ * recording can be played back by building with HID_BACKEND=replay (see
+ * src/hid-replay.c), e.g. to reproduce a problem, or to test code that
+ * works on sensor readings against real data, without the robot.
+ *
+ * @param path The file to record to. An existing file is replaced.
+ * @return 1 if recording started, -1 if this Finch is already recording
+ * or the file couldn't be created.
+ */
+int Finch::startRecording(const char* path) {
+    return pimpl->recorder->start(path);
+}
+
+/**
+ * Stops recording, and finishes off the recording with its time index. The
+ * recording is also finished off when the Finch is destroyed.
+ *
+ * @return 1 if the whole recording was written, -1 if some of it couldn't
+ * be, or this Finch wasn't recording.
+ */
+int Finch::stopRecording() {
+    return pimpl->recorder->stop();
 }
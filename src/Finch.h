@@ -8,9 +8,99 @@
 #ifndef FINCH_H
 #define FINCH_H
 
+struct AsyncJob;
+struct StopWaiter;
+
 class Finch {
 public:
+    // A snapshot of every sensor on the Finch, filled in by readAll().
+    struct Sensors {
+        double accelerations[3]; // X, Y, and Z acceleration in G's
+        int tapped;              // 1 if this reading flagged a tap, 0 if not
+        int shaken;              // 1 if this reading flagged a shake, 0 if not
+        int lightSensors[2];     // Left and right light sensors (0 to 255)
+        int obstacleSensors[2];  // Left and right obstacle sensors (0 or 1)
+        double temperature;      // Temperature in degrees Celsius
+    };
+
+    // Value types returned by the read*() functions. None of them touch the
+    // heap; ok is false (and the readings are zero) if the read failed.
+    struct Accel {
+        bool ok;
+        double x, y, z;          // Acceleration in G's
+        bool tapped, shaken;     // Tap and shake bits of this reading
+    };
+    struct LightSensors {
+        bool ok;
+        int left, right;         // 0 to 255, higher means more light
+    };
+    struct ObstacleSensors {
+        bool ok;
+        int left, right;         // 1 if an obstacle is detected, 0 if not
+    };
+    struct Temperature {
+        bool ok;
+        double celsius;
+    };
+
+    // How late a set of timed actions ran, measured from their deadlines to
+    // when their commands had gone out.
+    struct Lateness {
+        unsigned long count;     // How many actions were measured
+        double meanMicros;       // Mean lateness in microseconds
+        double maxMicros;        // Worst lateness in microseconds
+    };
+
+    // The distribution of one stage of a command's latency, taken from a
+    // histogram, so the percentiles are good to within about 6%.
+    struct LatencySummary {
+        unsigned long count;     // How many times the stage was timed
+        double meanMicros;       // Mean time in microseconds
+        double p50Micros, p90Micros, p99Micros, p999Micros;
+        double maxMicros;        // Worst time in microseconds
+    };
+
+    // Counts and latencies for one kind of command report, split into the
+    // time spent waiting for the Finch's lock, writing the report, and
+    // waiting for the reply (for the commands that have one).
+    struct CommandStats {
+        char command;            // The command letter, or '?' for any other
+        unsigned long calls;     // Command reports sent (or tried)
+        unsigned long errors;    // Writes and reads that failed
+        LatencySummary lockWait;
+        LatencySummary write;
+        LatencySummary readWait;
+    };
+
+    // A snapshot of the per-command statistics, returned by stats().
+    struct Stats {
+        enum { numCommands = 10 };
+        CommandStats commands[numCommands]; // A, L, I, T, O, M, B, z, R, then any other
+    };
+
+    // Orientation bit flags returned by classifyOrientation().
+    enum Orientation {
+        ORIENTATION_NONE = 0,
+        BEAK_UP          = 1 << 0,
+        BEAK_DOWN        = 1 << 1,
+        LEVEL            = 1 << 2,
+        UPSIDE_DOWN      = 1 << 3,
+        LEFT_WING_DOWN   = 1 << 4,
+        RIGHT_WING_DOWN  = 1 << 5
+    };
+
+    // Completion callbacks for the *Async() functions. They are run on the
+    // Finch's I/O thread, and are passed the same result the blocking
+    // version of the function would have returned.
+    typedef void (*StatusCallback)(int result, void* context);
+    typedef void (*AccelCallback)(const Accel& accel, void* context);
+    typedef void (*LightSensorsCallback)(const LightSensors& light, void* context);
+    typedef void (*ObstacleSensorsCallback)(const ObstacleSensors& obstacles, void* context);
+    typedef void (*TemperatureCallback)(const Temperature& temperature, void* context);
+    typedef void (*SensorsCallback)(int result, const Sensors& sensors, void* context);
+
     Finch();
+    explicit Finch(const char* path);
     virtual ~Finch();
 
     // Call the following function to make sure that the object
@@ -28,10 +118,26 @@ public:
     int noteOn(int frequency);
     int noteOn(int frequency, int duration);
     int noteOff();
+    int setMotorsFor(int leftWheelSpeed, int rightWheelSpeed, int duration, StatusCallback onStop = 0, void* context = 0);
+    int noteOnFor(int frequency, int duration, StatusCallback onStop = 0, void* context = 0);
+    Lateness timedActionLateness();
     double getTemperature();
     double* getAccelerations();
     int* getLightSensors();
     int* getObstacleSensors();
+    int readAll(Sensors& sensors);
+    Accel readAccelerations();
+    LightSensors readLightSensors();
+    ObstacleSensors readObstacleSensors();
+    Temperature readTemperature();
+    int startPolling(int rateHz, int maxStaleness);
+    void stopPolling();
+    int readCachedSensors(Sensors& sensors, int maxStaleness);
+    int startCoalescing();
+    void stopCoalescing();
+    int flushOutputs();
+    unsigned long skippedOutputs();
+    unsigned long coalescedOutputs();
     int wasTapped();
     int wasShaken();
     int isObstacleLeftSide();
@@ -47,17 +153,56 @@ public:
     int isFinchUpsideDown();
     int isRightWingDown();
     int isLeftWingDown();
+    int classifyOrientation();
+    static int classifyOrientation(const Accel& accel);
     int counter();
+    int setLEDAsync(int red, int green, int blue, StatusCallback callback = 0, void* context = 0);
+    int setMotorsAsync(int leftWheelSpeed, int rightWheelSpeed, StatusCallback callback = 0, void* context = 0);
+    int setMotorsAsync(int leftWheelSpeed, int rightWheelSpeed, int duration, StatusCallback callback = 0, void* context = 0);
+    int noteOnAsync(int frequency, StatusCallback callback = 0, void* context = 0);
+    int noteOnAsync(int frequency, int duration, StatusCallback callback = 0, void* context = 0);
+    int noteOffAsync(StatusCallback callback = 0, void* context = 0);
+    int readAccelerationsAsync(AccelCallback callback, void* context = 0);
+    int readLightSensorsAsync(LightSensorsCallback callback, void* context = 0);
+    int readObstacleSensorsAsync(ObstacleSensorsCallback callback, void* context = 0);
+    int readTemperatureAsync(TemperatureCallback callback, void* context = 0);
+    int readAllAsync(SensorsCallback callback, void* context = 0);
+    int classifyOrientationAsync(StatusCallback callback, void* context = 0);
+    int wasTappedAsync(StatusCallback callback, void* context = 0);
+    int wasShakenAsync(StatusCallback callback, void* context = 0);
+    int counterAsync(StatusCallback callback, void* context = 0);
+    void waitForAsync();
+    unsigned long lateReports();
+    unsigned long orphanedReports();
+    unsigned long reconnects();
+    double lastRecoveryTime();
+    Stats stats();
+    static int startTracing();
+    static int stopTracing(const char* path);
+    int startRecording(const char* path);
+    int stopRecording();
     void keepAlive();
     int finchRead(unsigned char bufToWrite[], unsigned char bufRead[]);
     int finchWrite(unsigned char bufToWrite[]);
-    static void* keepAliveEntryPoint(void * pThis) {
-        Finch * pthX = static_cast<Finch*>(pThis);   // cast from void to Finch object
-        pthX->keepAlive();           // now call the true entry-point-function
-        return 0;          // the thread exit code
-    }
+    int finchWriteBatch(const unsigned char reports[][9], int count);
 
 private:
+    void setUp(const char* path);
+    int hasOrientation(int orientation);
+    void ping();
+    void lostConnection();
+    int writeReports(const unsigned char reports[], int count);
+    static long long reconnectEntryPoint(void* pThis, long long deadline, long long firedAt);
+    int submitAsync(const AsyncJob& job);
+    bool cachedSensors(Sensors& sensors);
+
+    typedef long long (*TimedStopCallback)(void* pThis, long long deadline, long long firedAt);
+    int scheduleTimedStop(volatile int& timer, int duration, TimedStopCallback callback);
+    void cancelTimedStop(volatile int& timer, StopWaiter& waiter);
+    void recordLateness(long long lateness);
+    static long long motorsOffEntryPoint(void* pThis, long long deadline, long long firedAt);
+    static long long noteOffEntryPoint(void* pThis, long long deadline, long long firedAt);
+
     volatile bool initialized;
     struct Impl;
     Impl* pimpl;
@@ -0,0 +1,294 @@
+/*
+ * File:   FinchAsync.cpp
+ *
+ * Asynchronous versions of the Finch's getters and setters. Each one queues
+ * its request on the Finch's I/O thread and returns straight away; the
+ * callback is run on the I/O thread once the request has completed, so it
+ * should be quick, and must not call waitForAsync().
+ */
+
+#include "Finch.h"
+#include "FinchImpl.h"
+#include "AsyncWorker.h"
+
+namespace {
+    AsyncJob makeJob(AsyncJob::Type type, void* context) {
+        AsyncJob job;
+        job.type = type;
+        job.args[0] = job.args[1] = job.args[2] = 0;
+        job.callback.status = 0;
+        job.context = context;
+        return job;
+    }
+}
+
+/**
+ * Queues a job on the I/O thread, creating the I/O thread's state the first
+ * time it's needed.
+ *
+ * @return 1 if the job was queued, -1 if it wasn't.
+ */
+int Finch::submitAsync(const AsyncJob& job) {
+    if (!initialized) {
+        return -1;
+    }
+
+    MutexLocker lock(pimpl->mtx);
+    if (!pimpl->async) {
+        pimpl->async = new AsyncWorker(*this);
+    }
+    lock.unlock();
+
+    return pimpl->async->submit(job);
+}
+
+/**
+ * Sets the color and intensity of the beak LED without waiting for the USB
+ * transfer to finish.
+ *
+ * @param callback Optional; called with the result setLED() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::setLEDAsync(int red, int green, int blue, StatusCallback callback, void* context) {
+    AsyncJob job = makeJob(AsyncJob::SET_LED, context);
+    job.args[0] = red;
+    job.args[1] = green;
+    job.args[2] = blue;
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Sets the speed of the left and right wheels without waiting for the USB
+ * transfer to finish.
+ *
+ * @param callback Optional; called with the result setMotors() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::setMotorsAsync(int leftWheelSpeed, int rightWheelSpeed, StatusCallback callback, void* context) {
+    AsyncJob job = makeJob(AsyncJob::SET_MOTORS, context);
+    job.args[0] = leftWheelSpeed;
+    job.args[1] = rightWheelSpeed;
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Sets the speed of the left and right wheels for a specified period of time,
+ * after which they turn off, without blocking. The stop is timed as for
+ * setMotorsFor(), so requests made after this one don't wait for it.
+ *
+ * @param duration The time in milliseconds to maintain the set speeds
+ * @param callback Optional; called with the result setMotors() would return,
+ *                 once the motors are off (or a newer setting has cancelled
+ *                 the stop). It runs on the timer thread, not the I/O
+ *                 thread.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::setMotorsAsync(int leftWheelSpeed, int rightWheelSpeed, int duration, StatusCallback callback, void* context) {
+    if (duration < 0) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::SET_MOTORS_DURATION, context);
+    job.args[0] = leftWheelSpeed;
+    job.args[1] = rightWheelSpeed;
+    job.args[2] = duration;
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Turns on the buzzer without waiting for the USB transfer to finish.
+ *
+ * @param callback Optional; called with the result noteOn() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::noteOnAsync(int frequency, StatusCallback callback, void* context) {
+    AsyncJob job = makeJob(AsyncJob::NOTE_ON, context);
+    job.args[0] = frequency;
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Beeps the buzzer for a specified period of time without blocking. The
+ * noteOff is timed as for noteOnFor(), so requests made after this one don't
+ * wait for it.
+ *
+ * @param duration The duration in milliseconds to hold the note for.
+ * @param callback Optional; called with the result noteOn() would return,
+ *                 once the note is over (or a newer one has cancelled the
+ *                 noteOff). It runs on the timer thread, not the I/O thread.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::noteOnAsync(int frequency, int duration, StatusCallback callback, void* context) {
+    if (duration < 0) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::NOTE_ON_DURATION, context);
+    job.args[0] = frequency;
+    job.args[1] = duration;
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Turns off the buzzer without waiting for the USB transfer to finish.
+ *
+ * @param callback Optional; called with the result noteOff() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::noteOffAsync(StatusCallback callback, void* context) {
+    AsyncJob job = makeJob(AsyncJob::NOTE_OFF, context);
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Reads the accelerometer in the background.
+ *
+ * @param callback Called with the reading readAccelerations() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::readAccelerationsAsync(AccelCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::READ_ACCELERATIONS, context);
+    job.callback.accel = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Reads the light sensors in the background.
+ *
+ * @param callback Called with the reading readLightSensors() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::readLightSensorsAsync(LightSensorsCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::READ_LIGHT_SENSORS, context);
+    job.callback.light = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Reads the obstacle sensors in the background.
+ *
+ * @param callback Called with the reading readObstacleSensors() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::readObstacleSensorsAsync(ObstacleSensorsCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::READ_OBSTACLE_SENSORS, context);
+    job.callback.obstacles = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Reads the temperature in the background.
+ *
+ * @param callback Called with the reading readTemperature() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::readTemperatureAsync(TemperatureCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::READ_TEMPERATURE, context);
+    job.callback.temperature = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Reads every sensor in the background.
+ *
+ * @param callback Called with the result and readings readAll() would give.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::readAllAsync(SensorsCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::READ_ALL, context);
+    job.callback.sensors = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Classifies the Finch's orientation in the background.
+ *
+ * @param callback Called with the bitmask classifyOrientation() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::classifyOrientationAsync(StatusCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::CLASSIFY_ORIENTATION, context);
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Checks in the background whether the Finch has been tapped.
+ *
+ * @param callback Called with the value wasTapped() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::wasTappedAsync(StatusCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::WAS_TAPPED, context);
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Checks in the background whether the Finch has been shaken.
+ *
+ * @param callback Called with the value wasShaken() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::wasShakenAsync(StatusCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::WAS_SHAKEN, context);
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Reads the Finch's ping counter in the background.
+ *
+ * @param callback Called with the value counter() would return.
+ * @return 1 if the request was queued, -1 if it wasn't.
+ */
+int Finch::counterAsync(StatusCallback callback, void* context) {
+    if (!callback) {
+        return -1;
+    }
+    AsyncJob job = makeJob(AsyncJob::COUNTER, context);
+    job.callback.status = callback;
+    return submitAsync(job);
+}
+
+/**
+ * Blocks until every asynchronous request made so far has completed and had
+ * its callback run. Does nothing if called from inside a callback.
+ */
+void Finch::waitForAsync() {
+    MutexLocker lock(pimpl->mtx);
+    AsyncWorker* async = pimpl->async;
+    lock.unlock();
+
+    if (async) {
+        async->drain();
+    }
+}
@@ -0,0 +1,108 @@
+/*
+ * File:   FinchImpl.h
+ *
+ * Hidden state for the Finch, shared by the source files that make up the
+ * Finch library. Not for use by user programs.
+ */
+
+#ifndef FINCHIMPL_H
+#define FINCHIMPL_H
+
+#include <pthread.h>
+#include "Finch.h"
+#include "hidapi.h"
+
+class ReportTracker;
+class AsyncWorker;
+class SensorPoller;
+class OutputCoalescer;
+class CommandMetrics;
+class SessionRecorder;
+
+// Convenience class to handle locking/unlocking the mutex.
+class MutexLocker {
+public:
+    MutexLocker(pthread_mutex_t& mutex)
+        : mtx(mutex), locked(false) {
+        locked = pthread_mutex_lock(&mtx) == 0;
+    }
+    MutexLocker(pthread_mutex_t& mutex, bool tryOnly)
+        : mtx(mutex), locked(false) {
+        if (tryOnly) {
+            locked = pthread_mutex_trylock(&mtx) == 0;
+        }
+        else {
+            locked = pthread_mutex_lock(&mtx) == 0;
+        }
+    }
+    ~MutexLocker() {
+        unlock();
+    }
+
+    void unlock() {
+        if (locked) {
+            pthread_mutex_unlock(&mtx);
+            locked = false;
+        }
+    }
+
+    bool isLocked() const {
+        return locked;
+    }
+
+private:
+    pthread_mutex_t& mtx;
+    bool locked;
+};
+
+// A callback waiting for a timed stop (see setMotorsFor()) to be done, and
+// the result to pass it.
+struct StopWaiter {
+    Finch::StatusCallback callback;
+    void* context;
+    int result;
+};
+
+/* Hidden state for the Finch. */
+struct Finch::Impl {
+    hid_device *finch_handle; // The handle to communicate with the Finch
+    char* path; // The device path to open, or null to open the first Finch found
+    char* openedPath; // Where finch_handle was opened (only changed by connect() and on the shared timer thread)
+    ReportTracker* tracker; // Used to match incoming and outgoing reports in the finchRead function
+    // Whether the Finch has been tapped/shaken since the last wasTapped()/
+    // wasShaken(). Set and cleared with __atomic builtins only.
+    int wasTappedVal;
+    int wasShakenVal;
+
+    AsyncWorker* async; // The I/O thread behind the *Async() functions, created on first use
+    SensorPoller* poller; // The background sensor poller, created by startPolling()
+    OutputCoalescer* outputs; // Shadow registers for the LED, motors and buzzer
+    CommandMetrics* metrics; // Per-command counts and latency histograms, returned by stats()
+    SessionRecorder* recorder; // Records the session to a file, between startRecording() and stopRecording()
+
+    // Pending stops for setMotorsFor() and noteOnFor(), on the precise timer
+    // thread (0 if none), whoever is waiting for them (guarded by mtx), and
+    // how late the stops have been so far
+    volatile int motorsOffTimer;
+    volatile int noteOffTimer;
+    StopWaiter motorsOffWaiter;
+    StopWaiter noteOffWaiter;
+    unsigned long timedStops;
+    long long timedTotalLateness; // In nanoseconds
+    long long timedMaxLateness;
+
+    // Reconnecting after the Finch drops off the bus (guarded by mtx)
+    int reconnectTimer; // Our timer on the shared timer thread while reconnecting, 0 if not
+    long long reconnectBackoff; // Nanoseconds until the next attempt
+    long long lostAt; // When the connection was lost (CLOCK_MONOTONIC nanoseconds)
+    long long lastRecovery; // How long the last reconnection took, in nanoseconds
+    unsigned long reconnects;
+    bool disconnecting; // Set by disConnect(), so we don't try to reconnect
+
+    // Keep-alive stuff (and synchronization)
+    int keepAliveTimer; // Our timer on the shared keep-alive thread
+    pthread_mutex_t mtx;
+    volatile int syncCounter;
+};
+
+#endif  /* FINCHIMPL_H */
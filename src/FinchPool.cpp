@@ -0,0 +1,194 @@
+/*
+ * File:   FinchPool.cpp
+ *
+ * Discovery of, and parallel connection to, every Finch on the USB bus.
+ */
+
+#include "FinchPool.h"
+#include <algorithm>
+#include <pthread.h>
+#include "hidapi.h"
+#include "FleetWorkers.h"
+
+namespace {
+    bool pathOrder(const std::pair<std::string, std::wstring>& a,
+                   const std::pair<std::string, std::wstring>& b) {
+        return a.first < b.first;
+    }
+
+    // The arguments and per-robot results of a fleet-wide operation.
+    struct Collective {
+        int args[3];
+        std::vector<int>* results;
+        std::vector<Finch::Sensors>* sensors;
+    };
+
+    void setLEDOperation(Finch& finch, int index, void* context) {
+        Collective* collective = static_cast<Collective*>(context);
+        (*collective->results)[size_t(index)] =
+            finch.setLED(collective->args[0], collective->args[1], collective->args[2]);
+    }
+
+    void setMotorsOperation(Finch& finch, int index, void* context) {
+        Collective* collective = static_cast<Collective*>(context);
+        (*collective->results)[size_t(index)] =
+            finch.setMotors(collective->args[0], collective->args[1]);
+    }
+
+    void readAllOperation(Finch& finch, int index, void* context) {
+        Collective* collective = static_cast<Collective*>(context);
+        (*collective->results)[size_t(index)] =
+            finch.readAll((*collective->sensors)[size_t(index)]);
+    }
+
+    int countSuccesses(const std::vector<int>& results) {
+        int succeeded = 0;
+        for (size_t i = 0; i < results.size(); i++) {
+            if (results[i] != -1) {
+                succeeded++;
+            }
+        }
+        return succeeded;
+    }
+}
+
+FinchPool::FinchPool() : workers(0) {
+    // Find every Finch (VID 0x2354, PID 0x1111), once each. The serial
+    // number is the only string needed, so don't ask them for the rest.
+    std::vector<std::pair<std::string, std::wstring> > found;
+    struct hid_device_info* devs = hid_enumerate_filtered(0x2354, 0x1111, HID_ENUMERATE_SERIAL_NUMBER);
+    for (struct hid_device_info* dev = devs; dev; dev = dev->next) {
+        if (!dev->path) {
+            continue;
+        }
+        found.push_back(std::make_pair(std::string(dev->path),
+            std::wstring(dev->serial_number ? dev->serial_number : L"")));
+    }
+    hid_free_enumeration(devs);
+
+    std::sort(found.begin(), found.end(), pathOrder);
+    for (size_t i = 0; i < found.size(); i++) {
+        if (i > 0 && found[i].first == found[i - 1].first) {
+            continue;
+        }
+        Member member;
+        member.path = found[i].first;
+        member.serialNumber = found[i].second;
+        member.finch = 0;
+        members.push_back(member);
+    }
+
+    // Connect to them all at once; each connection is mostly spent waiting
+    // on USB, so there's no sense in doing them one after another.
+    std::vector<pthread_t> threads(members.size());
+    std::vector<bool> started(members.size(), false);
+    for (size_t i = 0; i < members.size(); i++) {
+        started[i] = pthread_create(&threads[i], 0, entryPoint, &members[i]) == 0;
+        if (!started[i]) {
+            // Couldn't get a thread, so connect from this one.
+            (void)entryPoint(&members[i]);
+        }
+    }
+    for (size_t i = 0; i < members.size(); i++) {
+        if (started[i]) {
+            (void)pthread_join(threads[i], 0);
+        }
+    }
+
+    // Keep just the ones we managed to connect to.
+    std::vector<Member> connected;
+    for (size_t i = 0; i < members.size(); i++) {
+        if (members[i].finch->isInitialized()) {
+            connected.push_back(members[i]);
+        }
+        else {
+            delete members[i].finch;
+        }
+    }
+    members.swap(connected);
+
+    for (size_t i = 0; i < members.size(); i++) {
+        byPath[members[i].path] = int(i);
+        if (!members[i].serialNumber.empty()) {
+            bySerialNumber[members[i].serialNumber] = int(i);
+        }
+    }
+
+    std::vector<Finch*> fleet;
+    for (size_t i = 0; i < members.size(); i++) {
+        fleet.push_back(members[i].finch);
+    }
+    workers = new FleetWorkers(fleet);
+}
+
+FinchPool::~FinchPool() {
+    delete workers;
+    for (size_t i = 0; i < members.size(); i++) {
+        delete members[i].finch;
+    }
+}
+
+int FinchPool::size() const {
+    return int(members.size());
+}
+
+Finch& FinchPool::operator[](int index) {
+    return *members.at(size_t(index)).finch;
+}
+
+const std::string& FinchPool::path(int index) const {
+    return members.at(size_t(index)).path;
+}
+
+const std::wstring& FinchPool::serialNumber(int index) const {
+    return members.at(size_t(index)).serialNumber;
+}
+
+Finch* FinchPool::findByPath(const char* path) {
+    std::map<std::string, int>::const_iterator it = byPath.find(path);
+    return (it == byPath.end()) ? 0 : members[size_t(it->second)].finch;
+}
+
+Finch* FinchPool::findBySerialNumber(const wchar_t* serialNumber) {
+    std::map<std::wstring, int>::const_iterator it = bySerialNumber.find(serialNumber);
+    return (it == bySerialNumber.end()) ? 0 : members[size_t(it->second)].finch;
+}
+
+int FinchPool::setLED(int red, int green, int blue) {
+    std::vector<int> results(members.size(), -1);
+    Collective collective;
+    collective.args[0] = red;
+    collective.args[1] = green;
+    collective.args[2] = blue;
+    collective.results = &results;
+    collective.sensors = 0;
+    workers->forEach(setLEDOperation, &collective);
+    return countSuccesses(results);
+}
+
+int FinchPool::setMotors(int leftWheelSpeed, int rightWheelSpeed) {
+    std::vector<int> results(members.size(), -1);
+    Collective collective;
+    collective.args[0] = leftWheelSpeed;
+    collective.args[1] = rightWheelSpeed;
+    collective.args[2] = 0;
+    collective.results = &results;
+    collective.sensors = 0;
+    workers->forEach(setMotorsOperation, &collective);
+    return countSuccesses(results);
+}
+
+int FinchPool::readAll(std::vector<Finch::Sensors>& sensors, std::vector<int>& results) {
+    sensors.assign(members.size(), Finch::Sensors());
+    results.assign(members.size(), -1);
+    Collective collective;
+    collective.args[0] = collective.args[1] = collective.args[2] = 0;
+    collective.results = &results;
+    collective.sensors = &sensors;
+    workers->forEach(readAllOperation, &collective);
+    return countSuccesses(results);
+}
+
+void FinchPool::forEach(Operation operation, void* context) {
+    workers->forEach(operation, context);
+}
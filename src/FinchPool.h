@@ -0,0 +1,96 @@
+/*
+ * File:   FinchPool.h
+ *
+ * Finds every Finch plugged into the computer and connects to all of them,
+ * so that one program can drive a whole room of robots:
+ *
+ *     FinchPool finches;
+ *     for (int i = 0; i < finches.size(); i++) {
+ *         finches[i].setLED(0, 255, 0);
+ *     }
+ *
+ * The robots are connected to in parallel, each on a thread of its own, so
+ * the start-up time doesn't grow with the number of robots. They are listed
+ * in order of device path, and can also be looked up by path or by serial
+ * number.
+ *
+ * The fleet-wide operations (setLED(), setMotors(), readAll() and forEach())
+ * act on every robot at once, using a fixed pool of worker threads with one
+ * lane per robot, so a sweep of the whole fleet takes about as long as one
+ * robot's round trip rather than one per robot.
+ */
+
+#ifndef FINCHPOOL_H
+#define FINCHPOOL_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Finch.h"
+
+class FleetWorkers;
+
+class FinchPool {
+public:
+    // Enumerates and connects to every Finch found. Robots that can't be
+    // connected to (e.g. because another program is using them) are left
+    // out.
+    FinchPool();
+
+    // Disconnects from every robot in the pool.
+    ~FinchPool();
+
+    // The number of robots connected to.
+    int size() const;
+
+    // The robot at index, from 0 to size() - 1.
+    Finch& operator[](int index);
+
+    // The device path and serial number of the robot at index.
+    const std::string& path(int index) const;
+    const std::wstring& serialNumber(int index) const;
+
+    // Look a robot up by device path or serial number. Return null if there
+    // is no such robot in the pool.
+    Finch* findByPath(const char* path);
+    Finch* findBySerialNumber(const wchar_t* serialNumber);
+
+    // Set the LED or motors on every robot at once. Return the number of
+    // robots the command succeeded on.
+    int setLED(int red, int green, int blue);
+    int setMotors(int leftWheelSpeed, int rightWheelSpeed);
+
+    // Reads every sensor on every robot at once. sensors[i] and results[i]
+    // get what readAll() on robot i filled in and returned. Returns the
+    // number of robots read successfully.
+    int readAll(std::vector<Finch::Sensors>& sensors, std::vector<int>& results);
+
+    // Runs operation(finch, index, context) for every robot at once, on the
+    // pool's worker threads, and waits for them all to finish.
+    typedef void (*Operation)(Finch& finch, int index, void* context);
+    void forEach(Operation operation, void* context);
+
+private:
+    struct Member {
+        std::string path;
+        std::wstring serialNumber;
+        Finch* finch;
+    };
+
+    static void* entryPoint(void* pMember) {
+        Member* member = static_cast<Member*>(pMember);
+        member->finch = new Finch(member->path.c_str());
+        return 0;
+    }
+
+    std::vector<Member> members;
+    std::map<std::string, int> byPath;
+    std::map<std::wstring, int> bySerialNumber;
+    FleetWorkers* workers;
+
+    // This class is not copy-safe.
+    FinchPool(const FinchPool&);
+    FinchPool& operator=(const FinchPool&);
+};
+
+#endif  /* FINCHPOOL_H */
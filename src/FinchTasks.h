@@ -0,0 +1,474 @@
+/*
+ * File:   FinchTasks.h
+ *
+ * C++20 coroutine interface for Finch programs. Each robot behaviour is a
+ * coroutine returning FinchTask, and every behaviour runs on one thread,
+ * driven by a FinchScheduler. When a behaviour co_awaits a Finch operation,
+ * it is parked until the Finch's I/O thread reports that the operation has
+ * completed (or until its timer fires), and the thread is free to run the
+ * other behaviours in the meantime:
+ *
+ *     FinchTask wander(AwaitableFinch& finch) {
+ *         for (;;) {
+ *             Finch::ObstacleSensors obstacles = co_await finch.obstacleSensors();
+ *             if (obstacles.left || obstacles.right) {
+ *                 co_await finch.drive(-100, 100, std::chrono::milliseconds(500));
+ *             }
+ *             co_await finch.motors(150, 150);
+ *         }
+ *     }
+ *
+ *     Finch myFinch;
+ *     FinchScheduler scheduler;
+ *     AwaitableFinch finch(myFinch, scheduler);
+ *     scheduler.spawn(wander(finch));
+ *     scheduler.run();
+ *
+ * This header is not used by the library itself, so only programs that
+ * include it need to be compiled as C++20 (e.g. g++ -std=c++20).
+ */
+
+#ifndef FINCHTASKS_H
+#define FINCHTASKS_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "FinchTasks.h needs C++20 coroutine support (compile with -std=c++20)"
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "Finch.h"
+
+class FinchScheduler;
+
+// The return type of a robot behaviour. A behaviour doesn't start running
+// until it is handed to FinchScheduler::spawn(), and the scheduler cleans it
+// up once it returns.
+class FinchTask {
+public:
+    struct promise_type {
+        FinchScheduler* scheduler = nullptr;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() noexcept {
+            }
+        };
+
+        FinchTask get_return_object() {
+            return FinchTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    FinchTask(FinchTask&& other) noexcept
+        : handle(std::exchange(other.handle, {})) {
+    }
+    ~FinchTask() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+private:
+    friend class FinchScheduler;
+
+    explicit FinchTask(std::coroutine_handle<promise_type> coroutine)
+        : handle(coroutine) {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+
+    FinchTask(const FinchTask&) = delete;
+    FinchTask& operator=(const FinchTask&) = delete;
+};
+
+// Runs any number of behaviours on the calling thread, resuming each one when
+// the operation it is waiting on completes or its timer fires.
+class FinchScheduler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Hands a behaviour over to the scheduler. Call this before run(), or
+    // from inside a behaviour.
+    void spawn(FinchTask task) {
+        std::coroutine_handle<FinchTask::promise_type> handle = std::exchange(task.handle, {});
+        handle.promise().scheduler = this;
+        ++liveTasks;
+        wake(handle);
+    }
+
+    // Queues work to run on the scheduler's thread. Safe to call from any
+    // thread (the Finch's I/O thread uses it to report completions).
+    void post(std::function<void()> work) {
+        std::lock_guard<std::mutex> lock(mtx);
+        ready.push_back(std::move(work));
+        wakeup.notify_one();
+    }
+
+    // Queues a suspended behaviour to be resumed on the scheduler's thread.
+    // Safe to call from any thread.
+    void wake(std::coroutine_handle<> handle) {
+        post([handle]() { handle.resume(); });
+    }
+
+    // Runs work on the scheduler's thread once the deadline has passed. Must
+    // be called from the scheduler's thread.
+    void at(Clock::time_point deadline, std::function<void()> work) {
+        timers.push(Timer(deadline, nextTimerId++, std::move(work)));
+    }
+
+    // Suspends the calling behaviour for the given amount of time.
+    auto sleep(Clock::duration duration) {
+        struct SleepAwaiter {
+            FinchScheduler& scheduler;
+            Clock::duration duration;
+
+            bool await_ready() const noexcept {
+                return duration <= Clock::duration::zero();
+            }
+            void await_suspend(std::coroutine_handle<> handle) {
+                scheduler.at(Clock::now() + duration, [handle]() { handle.resume(); });
+            }
+            void await_resume() const noexcept {
+            }
+        };
+        return SleepAwaiter{*this, duration};
+    }
+
+    // Runs behaviours until every one of them has returned.
+    void run() {
+        std::vector<std::function<void()> > batch;
+        while (liveTasks > 0) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (ready.empty()) {
+                    if (timers.empty()) {
+                        wakeup.wait(lock, [this]() { return !ready.empty(); });
+                    }
+                    else {
+                        wakeup.wait_until(lock, timers.top().deadline,
+                                          [this]() { return !ready.empty(); });
+                    }
+                }
+                batch.swap(ready);
+            }
+
+            for (std::size_t i = 0; i < batch.size(); i++) {
+                batch[i]();
+            }
+            batch.clear();
+
+            const Clock::time_point now = Clock::now();
+            while (!timers.empty() && timers.top().deadline <= now) {
+                std::function<void()> work = timers.top().work;
+                timers.pop();
+                work();
+            }
+        }
+    }
+
+    // The number of behaviours that have been spawned and not yet returned.
+    std::size_t tasks() const {
+        return liveTasks;
+    }
+
+private:
+    friend struct FinchTask::promise_type::FinalAwaiter;
+
+    struct Timer {
+        Timer(Clock::time_point when, unsigned long id, std::function<void()> what)
+            : deadline(when), sequence(id), work(std::move(what)) {
+        }
+
+        // Orders the queue soonest-first, breaking ties in the order the
+        // timers were set.
+        bool operator<(const Timer& other) const {
+            if (deadline != other.deadline) {
+                return deadline > other.deadline;
+            }
+            return sequence > other.sequence;
+        }
+
+        Clock::time_point deadline;
+        unsigned long sequence;
+        std::function<void()> work;
+    };
+
+    void finished(std::coroutine_handle<> handle) {
+        --liveTasks;
+        handle.destroy();
+    }
+
+    std::mutex mtx;
+    std::condition_variable wakeup;
+    std::vector<std::function<void()> > ready;
+    std::priority_queue<Timer> timers;
+    unsigned long nextTimerId = 0;
+    std::size_t liveTasks = 0;
+};
+
+inline void FinchTask::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+    handle.promise().scheduler->finished(handle);
+}
+
+// Wraps a Finch so that its operations can be co_awaited from behaviours run
+// by the given scheduler.
+class AwaitableFinch {
+public:
+    typedef FinchScheduler::Clock Clock;
+
+    // Result of sensors(): the value readAll() returned, and the readings.
+    struct SensorsResult {
+        int result;
+        Finch::Sensors sensors;
+    };
+
+    AwaitableFinch(Finch& finch, FinchScheduler& scheduler)
+        : finch(finch), scheduler(scheduler) {
+    }
+
+    auto accel() {
+        return ReadingAwaiter<Finch::Accel>(scheduler, [this](Finch::AccelCallback callback, void* context) {
+            return finch.readAccelerationsAsync(callback, context);
+        });
+    }
+
+    auto lightSensors() {
+        return ReadingAwaiter<Finch::LightSensors>(scheduler, [this](Finch::LightSensorsCallback callback, void* context) {
+            return finch.readLightSensorsAsync(callback, context);
+        });
+    }
+
+    auto obstacleSensors() {
+        return ReadingAwaiter<Finch::ObstacleSensors>(scheduler, [this](Finch::ObstacleSensorsCallback callback, void* context) {
+            return finch.readObstacleSensorsAsync(callback, context);
+        });
+    }
+
+    auto temperature() {
+        return ReadingAwaiter<Finch::Temperature>(scheduler, [this](Finch::TemperatureCallback callback, void* context) {
+            return finch.readTemperatureAsync(callback, context);
+        });
+    }
+
+    auto sensors() {
+        return SensorsAwaiter(*this);
+    }
+
+    auto orientation() {
+        return StatusAwaiter(scheduler, [this](Finch::StatusCallback callback, void* context) {
+            return finch.classifyOrientationAsync(callback, context);
+        });
+    }
+
+    auto led(int red, int green, int blue) {
+        return StatusAwaiter(scheduler, [this, red, green, blue](Finch::StatusCallback callback, void* context) {
+            return finch.setLEDAsync(red, green, blue, callback, context);
+        });
+    }
+
+    auto motors(int leftWheelSpeed, int rightWheelSpeed) {
+        return StatusAwaiter(scheduler, [this, leftWheelSpeed, rightWheelSpeed](Finch::StatusCallback callback, void* context) {
+            return finch.setMotorsAsync(leftWheelSpeed, rightWheelSpeed, callback, context);
+        });
+    }
+
+    // Runs the wheels for the given time, then stops them. Resumes with the
+    // result of starting the wheels.
+    auto drive(int leftWheelSpeed, int rightWheelSpeed, Clock::duration duration) {
+        return TimedAwaiter(scheduler, duration,
+            [this, leftWheelSpeed, rightWheelSpeed](Finch::StatusCallback callback, void* context) {
+                return finch.setMotorsAsync(leftWheelSpeed, rightWheelSpeed, callback, context);
+            },
+            [this](Finch::StatusCallback callback, void* context) {
+                return finch.setMotorsAsync(0, 0, callback, context);
+            });
+    }
+
+    // Plays a note for the given time, then turns the buzzer off. Resumes
+    // with the result of starting the note.
+    auto tone(int frequency, Clock::duration duration) {
+        return TimedAwaiter(scheduler, duration,
+            [this, frequency](Finch::StatusCallback callback, void* context) {
+                return finch.noteOnAsync(frequency, callback, context);
+            },
+            [this](Finch::StatusCallback callback, void* context) {
+                return finch.noteOffAsync(callback, context);
+            });
+    }
+
+private:
+    // Waits on one of the Finch's read*Async() functions.
+    template <typename Reading>
+    class ReadingAwaiter {
+    public:
+        typedef void (*Callback)(const Reading&, void*);
+
+        ReadingAwaiter(FinchScheduler& scheduler, std::function<int(Callback, void*)> start)
+            : scheduler(scheduler), start(std::move(start)), reading() {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter = handle;
+            // If the request couldn't be queued, carry on with a failed reading.
+            return start(&ReadingAwaiter::completed, this) == 1;
+        }
+        Reading await_resume() const noexcept {
+            return reading;
+        }
+
+    private:
+        static void completed(const Reading& result, void* context) {
+            ReadingAwaiter* self = static_cast<ReadingAwaiter*>(context);
+            self->reading = result;
+            self->scheduler.wake(self->waiter);
+        }
+
+        FinchScheduler& scheduler;
+        std::function<int(Callback, void*)> start;
+        Reading reading;
+        std::coroutine_handle<> waiter;
+    };
+
+    // Waits on one of the Finch's *Async() functions that report an int.
+    class StatusAwaiter {
+    public:
+        StatusAwaiter(FinchScheduler& scheduler, std::function<int(Finch::StatusCallback, void*)> start)
+            : scheduler(scheduler), start(std::move(start)), result(-1) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter = handle;
+            return start(&StatusAwaiter::completed, this) == 1;
+        }
+        int await_resume() const noexcept {
+            return result;
+        }
+
+    private:
+        static void completed(int status, void* context) {
+            StatusAwaiter* self = static_cast<StatusAwaiter*>(context);
+            self->result = status;
+            self->scheduler.wake(self->waiter);
+        }
+
+        FinchScheduler& scheduler;
+        std::function<int(Finch::StatusCallback, void*)> start;
+        int result;
+        std::coroutine_handle<> waiter;
+    };
+
+    // Waits on readAllAsync().
+    class SensorsAwaiter {
+    public:
+        explicit SensorsAwaiter(AwaitableFinch& owner)
+            : owner(owner), result() {
+            result.result = -1;
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter = handle;
+            return owner.finch.readAllAsync(&SensorsAwaiter::completed, this) == 1;
+        }
+        SensorsResult await_resume() const noexcept {
+            return result;
+        }
+
+    private:
+        static void completed(int status, const Finch::Sensors& sensors, void* context) {
+            SensorsAwaiter* self = static_cast<SensorsAwaiter*>(context);
+            self->result.result = status;
+            self->result.sensors = sensors;
+            self->owner.scheduler.wake(self->waiter);
+        }
+
+        AwaitableFinch& owner;
+        SensorsResult result;
+        std::coroutine_handle<> waiter;
+    };
+
+    // Starts something, waits (on the scheduler, not the thread) for the
+    // given time, then stops it again.
+    class TimedAwaiter {
+    public:
+        typedef std::function<int(Finch::StatusCallback, void*)> Step;
+
+        TimedAwaiter(FinchScheduler& scheduler, Clock::duration duration, Step start, Step stop)
+            : scheduler(scheduler), duration(duration), start(std::move(start)),
+              stop(std::move(stop)), result(-1) {
+        }
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle) {
+            waiter = handle;
+            return start(&TimedAwaiter::started, this) == 1;
+        }
+        int await_resume() const noexcept {
+            return result;
+        }
+
+    private:
+        static void started(int status, void* context) {
+            TimedAwaiter* self = static_cast<TimedAwaiter*>(context);
+            self->result = status;
+            // Back on the scheduler's thread, set the timer for the stop.
+            self->scheduler.post([self]() {
+                self->scheduler.at(Clock::now() + self->duration, [self]() {
+                    if (self->stop(&TimedAwaiter::stopped, self) != 1) {
+                        self->waiter.resume();
+                    }
+                });
+            });
+        }
+
+        static void stopped(int /*status*/, void* context) {
+            TimedAwaiter* self = static_cast<TimedAwaiter*>(context);
+            self->scheduler.wake(self->waiter);
+        }
+
+        FinchScheduler& scheduler;
+        Clock::duration duration;
+        Step start;
+        Step stop;
+        int result;
+        std::coroutine_handle<> waiter;
+    };
+
+    Finch& finch;
+    FinchScheduler& scheduler;
+};
+
+#endif  /* FINCHTASKS_H */
@@ -0,0 +1,210 @@
+/*
+ * File:   FinchTimeline.cpp
+ *
+ * Timeline playback. Each timeline has a TimerService of its own, so its
+ * actions run on a dedicated thread; there is only ever one timer, which
+ * runs the next action and then reschedules itself for the one after.
+ */
+
+#include "FinchTimeline.h"
+#include <algorithm>
+#include "FinchImpl.h"
+#include "TimerService.h"
+
+namespace {
+    // How long before each action's deadline the playback thread stops
+    // sleeping and starts spinning.
+    const long long playbackSpin = 200000LL; // 200 microseconds
+}
+
+FinchTimeline::FinchTimeline(Finch& owner)
+    : finch(owner), timers(new TimerService(playbackSpin)), startTime(0), next(0), failures(0), timerId(0), playing(false) {
+    pthread_mutex_init(&mtx, 0);
+    pthread_cond_init(&cond, 0);
+}
+
+FinchTimeline::~FinchTimeline() {
+    stop();
+    delete timers;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mtx);
+}
+
+int FinchTimeline::led(int atMs, int red, int green, int blue) {
+    return add(Action::LED, atMs, red, green, blue);
+}
+
+int FinchTimeline::motors(int atMs, int leftWheelSpeed, int rightWheelSpeed) {
+    return add(Action::MOTORS, atMs, leftWheelSpeed, rightWheelSpeed, 0);
+}
+
+int FinchTimeline::noteOn(int atMs, int frequency) {
+    return add(Action::NOTE_ON, atMs, frequency, 0, 0);
+}
+
+int FinchTimeline::noteOff(int atMs) {
+    return add(Action::NOTE_OFF, atMs, 0, 0, 0);
+}
+
+int FinchTimeline::clear() {
+    MutexLocker lock(mtx);
+    if (playing) {
+        return -1;
+    }
+    actions.clear();
+    return 1;
+}
+
+int FinchTimeline::size() {
+    MutexLocker lock(mtx);
+    return int(actions.size());
+}
+
+int FinchTimeline::play() {
+    MutexLocker lock(mtx);
+    if (playing) {
+        return -1;
+    }
+
+    // Put the actions in time order (keeping ties in the order they were
+    // added), and forget the last playback.
+    std::stable_sort(actions.begin(), actions.end(), earlier);
+    for (size_t i = 0; i < actions.size(); i++) {
+        actions[i].lateness = -1;
+    }
+    next = 0;
+    failures = 0;
+    if (actions.empty()) {
+        return 1;
+    }
+
+    startTime = TimerService::now();
+    timerId = timers->schedule(startTime + actions[0].atMs * 1000000LL, entryPoint, this);
+    if (timerId == -1) {
+        return -1;
+    }
+    playing = true;
+    return 1;
+}
+
+int FinchTimeline::wait() {
+    MutexLocker lock(mtx);
+    while (playing) {
+        pthread_cond_wait(&cond, &mtx);
+    }
+    return (failures > 0) ? -1 : 1;
+}
+
+void FinchTimeline::stop() {
+    int id;
+    {
+        MutexLocker lock(mtx);
+        if (!playing) {
+            return;
+        }
+        id = timerId;
+    }
+    // Waits for an action that's already under way.
+    timers->cancel(id);
+
+    MutexLocker lock(mtx);
+    playing = false;
+    pthread_cond_broadcast(&cond);
+}
+
+bool FinchTimeline::isPlaying() {
+    MutexLocker lock(mtx);
+    return playing;
+}
+
+double FinchTimeline::lateness(int index) {
+    MutexLocker lock(mtx);
+    if (index < 0 || size_t(index) >= actions.size() || actions[size_t(index)].lateness < 0) {
+        return -1;
+    }
+    return double(actions[size_t(index)].lateness) / 1000.0;
+}
+
+Finch::Lateness FinchTimeline::lateness() {
+    Finch::Lateness result = Finch::Lateness();
+    long long total = 0;
+    long long worst = 0;
+
+    MutexLocker lock(mtx);
+    for (size_t i = 0; i < actions.size(); i++) {
+        if (actions[i].lateness >= 0) {
+            result.count++;
+            total += actions[i].lateness;
+            worst = std::max(worst, actions[i].lateness);
+        }
+    }
+    if (result.count > 0) {
+        result.meanMicros = double(total) / double(result.count) / 1000.0;
+        result.maxMicros = double(worst) / 1000.0;
+    }
+    return result;
+}
+
+int FinchTimeline::add(Action::Type type, int atMs, int arg0, int arg1, int arg2) {
+    if (atMs < 0) {
+        return -1;
+    }
+
+    MutexLocker lock(mtx);
+    if (playing) {
+        return -1;
+    }
+    Action action;
+    action.type = type;
+    action.atMs = atMs;
+    action.args[0] = arg0;
+    action.args[1] = arg1;
+    action.args[2] = arg2;
+    action.lateness = -1;
+    actions.push_back(action);
+    return 1;
+}
+
+// Runs the next action on the playback thread, and returns the deadline of
+// the one after (or 0 if that was the last).
+long long FinchTimeline::step(long long deadline) {
+    Action action;
+    {
+        MutexLocker lock(mtx);
+        if (!playing || next >= actions.size()) {
+            return 0;
+        }
+        action = actions[next];
+    }
+
+    // Measured once the command is out, so a slow write shows up too
+    const int result = execute(action);
+    const long long lateness = TimerService::now() - deadline;
+
+    MutexLocker lock(mtx);
+    actions[next].lateness = lateness;
+    if (result == -1) {
+        failures++;
+    }
+    next++;
+    if (next < actions.size()) {
+        return startTime + actions[next].atMs * 1000000LL;
+    }
+    playing = false;
+    pthread_cond_broadcast(&cond);
+    return 0;
+}
+
+int FinchTimeline::execute(const Action& action) {
+    switch (action.type) {
+        case Action::LED:
+            return finch.setLED(action.args[0], action.args[1], action.args[2]);
+        case Action::MOTORS:
+            return finch.setMotors(action.args[0], action.args[1]);
+        case Action::NOTE_ON:
+            return finch.noteOn(action.args[0]);
+        case Action::NOTE_OFF:
+            return finch.noteOff();
+    }
+    return -1;
+}
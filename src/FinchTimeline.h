@@ -0,0 +1,117 @@
+/*
+ * File:   FinchTimeline.h
+ *
+ * Plays back a choreographed sequence of motor, LED and buzzer commands.
+ * The whole sequence is put together up front, with each action stamped
+ * with its time (in milliseconds) from the start of playback:
+ *
+ *     FinchTimeline dance(myFinch);
+ *     dance.motors(0, 150, -150);
+ *     dance.led(0, 255, 0, 0);
+ *     dance.noteOn(250, 880);
+ *     dance.noteOff(500);
+ *     dance.motors(1000, 0, 0);
+ *     dance.play();
+ *     dance.wait();
+ *
+ * Playback runs on a thread belonging to the timeline, and every action is
+ * timed against an absolute deadline worked out from the start time, so the
+ * time taken by one command doesn't push back the ones after it. How late
+ * each action actually went out is recorded, to check the timing under load.
+ */
+
+#ifndef FINCHTIMELINE_H
+#define FINCHTIMELINE_H
+
+#include <vector>
+#include <pthread.h>
+#include "Finch.h"
+
+class TimerService;
+
+class FinchTimeline {
+public:
+    explicit FinchTimeline(Finch& owner);
+    ~FinchTimeline();
+
+    // Add an action at the given time (in milliseconds from the start of
+    // playback). Actions with the same time run in the order they were
+    // added. Return 1 if the action was added, -1 if the time is negative or
+    // the timeline is playing.
+    int led(int atMs, int red, int green, int blue);
+    int motors(int atMs, int leftWheelSpeed, int rightWheelSpeed);
+    int noteOn(int atMs, int frequency);
+    int noteOff(int atMs);
+
+    // Removes every action. Returns -1 if the timeline is playing.
+    int clear();
+
+    // The number of actions in the timeline.
+    int size();
+
+    // Starts playing the timeline from the beginning, and returns straight
+    // away. Returns 1 if playback started, -1 if it didn't.
+    int play();
+
+    // Blocks until playback has finished. Returns 1 if every action that ran
+    // succeeded, -1 if any of them failed.
+    int wait();
+
+    // Stops playback early; actions that haven't run yet are skipped.
+    void stop();
+
+    bool isPlaying();
+
+    // How late (in microseconds) the given action, in time order, went out
+    // during the last playback, counting the time to write it; -1 if it
+    // hasn't run.
+    double lateness(int index);
+
+    // How late the actions were, over the whole of the last playback.
+    Finch::Lateness lateness();
+
+private:
+    struct Action {
+        enum Type {
+            LED,
+            MOTORS,
+            NOTE_ON,
+            NOTE_OFF
+        };
+
+        Type type;
+        int atMs;
+        int args[3];
+        long long lateness;   // In nanoseconds, -1 until it has run
+    };
+
+    static bool earlier(const Action& a, const Action& b) {
+        return a.atMs < b.atMs;
+    }
+
+    static long long entryPoint(void* pThis, long long deadline, long long /*firedAt*/) {
+        FinchTimeline* pthX = static_cast<FinchTimeline*>(pThis);
+        return pthX->step(deadline);
+    }
+
+    int add(Action::Type type, int atMs, int arg0, int arg1, int arg2);
+    long long step(long long deadline);
+    int execute(const Action& action);
+
+    Finch& finch;
+    TimerService* timers;  // Our own playback thread
+    std::vector<Action> actions;
+    long long startTime;   // CLOCK_MONOTONIC nanoseconds
+    size_t next;           // The next action to run
+    int failures;
+    int timerId;
+    bool playing;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+
+    // This class is not copy-safe.
+    FinchTimeline(const FinchTimeline&);
+    FinchTimeline& operator=(const FinchTimeline&);
+};
+
+#endif  /* FINCHTIMELINE_H */
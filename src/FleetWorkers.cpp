@@ -0,0 +1,114 @@
+/*
+ * File:   FleetWorkers.cpp
+ *
+ * Work-stealing worker pool for fleet-wide operations.
+ */
+
+#include "FleetWorkers.h"
+#include "FinchImpl.h"
+
+FleetWorkers::FleetWorkers(const std::vector<Finch*>& fleet)
+    : finches(fleet), lanes(fleet.size()), workers(fleet.size()), currentOperation(0), currentContext(0), remaining(0), stopping(false) {
+    pthread_mutex_init(&mtx, 0);
+    pthread_cond_init(&cond, 0);
+    pthread_mutex_init(&batchMtx, 0);
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].owner = this;
+        workers[i].lane = int(i);
+        workers[i].started = pthread_create(&workers[i].threadid, 0, entryPoint, &workers[i]) == 0;
+    }
+}
+
+FleetWorkers::~FleetWorkers() {
+    {
+        MutexLocker lock(mtx);
+        stopping = true;
+        pthread_cond_broadcast(&cond);
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i].started) {
+            (void)pthread_join(workers[i].threadid, 0);
+        }
+    }
+    pthread_mutex_destroy(&batchMtx);
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mtx);
+}
+
+void FleetWorkers::forEach(Operation operation, void* context) {
+    MutexLocker batchLock(batchMtx);
+
+    pthread_mutex_lock(&mtx);
+    currentOperation = operation;
+    currentContext = context;
+    remaining = int(finches.size());
+    for (size_t i = 0; i < finches.size(); i++) {
+        lanes[i].push_back(int(i));
+    }
+    pthread_cond_broadcast(&cond);
+
+    // Pitch in rather than sit idle; this also means the work gets done even
+    // if some of the workers couldn't be started.
+    int index;
+    while (take(0, index)) {
+        pthread_mutex_unlock(&mtx);
+        operation(*finches[size_t(index)], index, context);
+        pthread_mutex_lock(&mtx);
+        remaining--;
+    }
+    while (remaining > 0) {
+        pthread_cond_wait(&cond, &mtx);
+    }
+    currentOperation = 0;
+    currentContext = 0;
+    pthread_mutex_unlock(&mtx);
+}
+
+// Takes the next piece of work, from the front of our own lane if there is
+// any, otherwise from the back of someone else's. Called with mtx held.
+bool FleetWorkers::take(int lane, int& index) {
+    const int numLanes = int(lanes.size());
+    if (numLanes == 0) {
+        return false;
+    }
+    if (!lanes[size_t(lane)].empty()) {
+        index = lanes[size_t(lane)].front();
+        lanes[size_t(lane)].pop_front();
+        return true;
+    }
+    for (int i = 1; i < numLanes; i++) {
+        std::deque<int>& victim = lanes[size_t((lane + i) % numLanes)];
+        if (!victim.empty()) {
+            index = victim.back();
+            victim.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void FleetWorkers::run(int lane) {
+    pthread_mutex_lock(&mtx);
+    for (;;) {
+        int index;
+        if (take(lane, index)) {
+            const Operation operation = currentOperation;
+            void* const context = currentContext;
+            pthread_mutex_unlock(&mtx);
+
+            operation(*finches[size_t(index)], index, context);
+
+            pthread_mutex_lock(&mtx);
+            if (--remaining == 0) {
+                pthread_cond_broadcast(&cond);
+            }
+            continue;
+        }
+        if (stopping) {
+            break;
+        }
+        pthread_cond_wait(&cond, &mtx);
+    }
+    pthread_mutex_unlock(&mtx);
+}
@@ -0,0 +1,66 @@
+/*
+ * File:   FleetWorkers.h
+ *
+ * A fixed pool of worker threads behind FinchPool's fleet-wide operations.
+ * There is one lane (a queue of work) and one worker per Finch; each piece
+ * of work for a Finch goes on that Finch's lane, and a worker that runs out
+ * of work on its own lane steals from the back of the others', so a single
+ * slow robot doesn't leave the rest of the workers idle.
+ */
+
+#ifndef FLEETWORKERS_H
+#define FLEETWORKERS_H
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "Finch.h"
+
+class FleetWorkers {
+public:
+    // One piece of work: operation(finch, index, context) for the Finch at
+    // index in the pool.
+    typedef void (*Operation)(Finch& finch, int index, void* context);
+
+    explicit FleetWorkers(const std::vector<Finch*>& fleet);
+    ~FleetWorkers();
+
+    // Runs operation once for every Finch, all at the same time, and waits
+    // for every one of them to finish. Calls from different threads take
+    // turns.
+    void forEach(Operation operation, void* context);
+
+private:
+    struct Worker {
+        FleetWorkers* owner;
+        int lane;
+        pthread_t threadid;
+        bool started;
+    };
+
+    static void* entryPoint(void* pWorker) {
+        Worker* worker = static_cast<Worker*>(pWorker);
+        worker->owner->run(worker->lane);
+        return 0;
+    }
+
+    void run(int lane);
+    bool take(int lane, int& index);
+
+    std::vector<Finch*> finches;
+    std::vector<std::deque<int> > lanes;  // Indexes of the Finches still to do
+    std::vector<Worker> workers;
+    Operation currentOperation;
+    void* currentContext;
+    int remaining;          // Work in the current batch not yet finished
+    bool stopping;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    pthread_mutex_t batchMtx; // Held for the whole of forEach()
+
+    // This class is not copy-safe.
+    FleetWorkers(const FleetWorkers&);
+    FleetWorkers& operator=(const FleetWorkers&);
+};
+
+#endif  /* FLEETWORKERS_H */
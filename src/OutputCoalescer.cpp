@@ -0,0 +1,258 @@
+/*
+ * File:   OutputCoalescer.cpp
+ *
+ * Shadow registers for the Finch's outputs, and the optional output thread
+ * that coalesces bursts of output commands.
+ *
+ * Each output (LED, motors, buzzer) has one register holding the setting
+ * last sent to the Finch, and one slot for the newest setting that is still
+ * waiting to go out. Setting an output again before its previous setting has
+ * gone out simply overwrites the slot, so however fast a program changes an
+ * output, the output thread only ever sends the latest value, at whatever
+ * rate hid_write() allows. Whatever is waiting when the output thread gets
+ * round to it goes out as one batch.
+ */
+
+#include "OutputCoalescer.h"
+#include <cstring>
+#include "FinchImpl.h"
+#include "TimerService.h"
+
+OutputCoalescer::OutputCoalescer(Finch& owner)
+    : finch(owner), skippedCount(0), coalescedCount(0), failures(0), sending(0), running(false), stopping(false) {
+    memset(registers, 0, sizeof(registers));
+    pthread_mutex_init(&mtx, 0);
+    pthread_mutex_init(&sendMtx, 0);
+    pthread_cond_init(&cond, 0);
+}
+
+OutputCoalescer::~OutputCoalescer() {
+    stop();
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&sendMtx);
+    pthread_mutex_destroy(&mtx);
+}
+
+int OutputCoalescer::write(Output output, const unsigned char report[]) {
+    {
+        MutexLocker lock(mtx);
+        if (running) {
+            Register& reg = registers[output];
+            // While a setting for this output is on its way out, sent is
+            // about to change and can't be trusted; send() checks again.
+            if (reg.pending) {
+                coalescedCount++;
+            }
+            else if (reg.inFlight == 0 && finchHas(output, report)) {
+                skippedCount++;
+                return 1;
+            }
+            memcpy(reg.next, report, settingsLength);
+            reg.pending = true;
+            pthread_cond_broadcast(&cond);
+            return 1;
+        }
+    }
+    return send(output, report);
+}
+
+int OutputCoalescer::start() {
+    MutexLocker lock(mtx);
+    if (running) {
+        return 1;
+    }
+    if (stopping) {
+        // The last output thread is still on its way out.
+        return -1;
+    }
+    if (pthread_create(&threadid, 0, entryPoint, this) != 0) {
+        return -1;
+    }
+    running = true;
+    return 1;
+}
+
+void OutputCoalescer::stop() {
+    {
+        MutexLocker lock(mtx);
+        if (!running || stopping) {
+            return;
+        }
+        stopping = true;
+        pthread_cond_broadcast(&cond);
+    }
+    (void)pthread_join(threadid, 0);
+
+    MutexLocker lock(mtx);
+    stopping = false;
+}
+
+int OutputCoalescer::flush() {
+    MutexLocker lock(mtx);
+    for (;;) {
+        bool pending = sending > 0;
+        for (int i = 0; i < numOutputs; i++) {
+            pending = pending || registers[i].pending;
+        }
+        if (!pending || !running) {
+            break;
+        }
+        pthread_cond_wait(&cond, &mtx);
+    }
+
+    const int result = (failures > 0) ? -1 : 1;
+    failures = 0;
+    return result;
+}
+
+void OutputCoalescer::invalidate() {
+    MutexLocker sendLock(sendMtx);
+    MutexLocker lock(mtx);
+    for (int i = 0; i < numOutputs; i++) {
+        registers[i].known = false;
+    }
+}
+
+int OutputCoalescer::reapply() {
+    Output outputs[numOutputs];
+    unsigned char settings[numOutputs][settingsLength];
+    int count = 0;
+    {
+        MutexLocker lock(mtx);
+        for (int i = 0; i < numOutputs; i++) {
+            if (registers[i].used) {
+                outputs[count] = static_cast<Output>(i);
+                memcpy(settings[count], registers[i].sent, settingsLength);
+                registers[i].known = false;
+                count++;
+            }
+        }
+    }
+    return send(count, outputs, settings);
+}
+
+unsigned long OutputCoalescer::skipped() {
+    MutexLocker lock(mtx);
+    return skippedCount;
+}
+
+unsigned long OutputCoalescer::coalesced() {
+    MutexLocker lock(mtx);
+    return coalescedCount;
+}
+
+// Whether the Finch is known to have the given setting already; mtx must be
+// held. A note only lasts as long as the duration sent with it (at most about
+// 65 seconds), after which the Finch turns the buzzer off by itself.
+bool OutputCoalescer::finchHas(Output output, const unsigned char settings[]) {
+    const Register& reg = registers[output];
+    if (!reg.known || memcmp(reg.sent, settings, settingsLength) != 0) {
+        return false;
+    }
+    if (output == BUZZER && (settings[4] != 0 || settings[5] != 0)) {
+        const long long duration = (settings[2] << 8) | settings[3];
+        return TimerService::now() - reg.sentAt < duration * 1000000LL;
+    }
+    return true;
+}
+
+// Sends one setting to the Finch, unless it's already what the Finch has, and
+// updates the shadow register to match.
+int OutputCoalescer::send(Output output, const unsigned char settings[]) {
+    unsigned char batch[1][settingsLength];
+    memcpy(batch[0], settings, settingsLength);
+    return send(1, &output, batch);
+}
+
+// Sends settings for up to one of each output to the Finch in a single batch,
+// leaving out any the Finch already has, and updates the shadow registers to
+// match.
+int OutputCoalescer::send(int count, const Output outputs[], const unsigned char settings[][settingsLength]) {
+    MutexLocker sendLock(sendMtx);
+
+    unsigned char bufToWrite[numOutputs][9];
+    int toSend[numOutputs];   // Which of the settings are going out
+    int numToSend = 0;
+    memset(bufToWrite, 0, sizeof(bufToWrite));
+    {
+        MutexLocker lock(mtx);
+        for (int i = 0; i < count; i++) {
+            Register& reg = registers[outputs[i]];
+            if (finchHas(outputs[i], settings[i])) {
+                skippedCount++;
+                continue;
+            }
+            memcpy(bufToWrite[numToSend], settings[i], settingsLength);
+            toSend[numToSend++] = i;
+            reg.inFlight++;
+        }
+    }
+    if (numToSend == 0) {
+        return 1;
+    }
+
+    // Taken before the write, so a note is never thought to last longer
+    // than it does.
+    const long long sentAt = TimerService::now();
+    const int res = finch.finchWriteBatch(bufToWrite, numToSend);
+
+    MutexLocker lock(mtx);
+    for (int j = 0; j < numToSend; j++) {
+        Register& reg = registers[outputs[toSend[j]]];
+        memcpy(reg.sent, settings[toSend[j]], settingsLength);
+        reg.inFlight--;
+        reg.sentAt = sentAt;
+        reg.used = true;
+        // If it failed, we can't tell whether the Finch took it or not.
+        reg.known = res != -1;
+    }
+    return res;
+}
+
+void OutputCoalescer::run() {
+    pthread_mutex_lock(&mtx);
+    for (;;) {
+        // Take whatever is waiting on every output, so a fast LED animation
+        // can't hold up a change to the motors; it all goes out together.
+        Output outputs[numOutputs];
+        unsigned char settings[numOutputs][settingsLength];
+        int count = 0;
+        for (;;) {
+            for (int i = 0; i < numOutputs; i++) {
+                if (registers[i].pending) {
+                    outputs[count] = static_cast<Output>(i);
+                    memcpy(settings[count], registers[i].next, settingsLength);
+                    registers[i].pending = false;
+                    registers[i].inFlight++;
+                    count++;
+                }
+            }
+            if (count > 0 || stopping) {
+                break;
+            }
+            pthread_cond_wait(&cond, &mtx);
+        }
+        if (count == 0) {
+            // Asked to stop, and nothing left to send.
+            break;
+        }
+
+        sending += count;
+        pthread_mutex_unlock(&mtx);
+
+        const int res = send(count, outputs, settings);
+
+        pthread_mutex_lock(&mtx);
+        sending -= count;
+        for (int i = 0; i < count; i++) {
+            registers[outputs[i]].inFlight--;
+        }
+        if (res == -1) {
+            failures++;
+        }
+        pthread_cond_broadcast(&cond);
+    }
+    running = false;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+}
@@ -0,0 +1,108 @@
+/*
+ * File:   OutputCoalescer.h
+ *
+ * Keeps a shadow copy of the Finch's output settings (beak LED, motors and
+ * buzzer), so that commands which wouldn't change anything are never sent.
+ * Optionally runs a thread that sends output commands on the caller's
+ * behalf, collapsing bursts of them so that only the newest setting of each
+ * output goes out, as fast as the device will take them.
+ */
+
+#ifndef OUTPUTCOALESCER_H
+#define OUTPUTCOALESCER_H
+
+#include <pthread.h>
+#include "Finch.h"
+
+class OutputCoalescer {
+public:
+    enum Output {
+        LED,
+        MOTORS,
+        BUZZER,
+        numOutputs
+    };
+
+    explicit OutputCoalescer(Finch& owner);
+    ~OutputCoalescer();
+
+    // Sends the command report for one output, unless the Finch is already
+    // known to have exactly that setting. While coalescing, the report is
+    // handed to the output thread instead, replacing any older report for
+    // the same output that hasn't gone out yet. Returns 1 if the report was
+    // sent, skipped or queued, -1 if sending it failed.
+    int write(Output output, const unsigned char report[]);
+
+    // Starts sending output commands from the output thread. Returns 1 on
+    // success, -1 on failure.
+    int start();
+
+    // Sends whatever is still queued, then stops the output thread.
+    void stop();
+
+    // Waits until every queued report has gone out. Returns -1 if any report
+    // sent by the output thread since the last flush failed, 1 otherwise.
+    int flush();
+
+    // Forgets what the Finch's outputs are set to, so the next command for
+    // each one is always sent (e.g. after the Finch has been reset).
+    void invalidate();
+
+    // Sends the last setting asked for on each output again (e.g. after
+    // reconnecting to a Finch that has been reset). Returns -1 if any of
+    // them failed, 1 otherwise.
+    int reapply();
+
+    // Commands that weren't sent because the Finch already had that setting.
+    unsigned long skipped();
+    // Commands that were replaced by a newer one before they went out.
+    unsigned long coalesced();
+
+private:
+    // Bytes 0 to 5 of the command report: the report ID, the command letter
+    // and up to four arguments. Nothing else is significant for an output.
+    static const int settingsLength = 6;
+
+    struct Register {
+        bool used;                             // Whether anything has been sent yet
+        bool known;                            // Whether sent is what the Finch has
+        unsigned char sent[settingsLength];    // The last setting sent (or tried)
+        long long sentAt;                      // When sent went out (TimerService::now())
+        bool pending;                          // Whether next is waiting to go out
+        unsigned char next[settingsLength];    // The newest setting not yet sent
+        int inFlight;                          // Settings taken to be sent, but not yet
+                                               // reflected in sent
+    };
+
+    static void* entryPoint(void* pThis) {
+        OutputCoalescer* pthX = static_cast<OutputCoalescer*>(pThis);
+        pthX->run();
+        return 0;
+    }
+
+    void run();
+    bool finchHas(Output output, const unsigned char settings[]);
+    int send(Output output, const unsigned char settings[]);
+    int send(int count, const Output outputs[], const unsigned char settings[][settingsLength]);
+
+    Finch& finch;
+    Register registers[numOutputs];
+    unsigned long skippedCount;
+    unsigned long coalescedCount;
+    int failures;       // Failed sends by the output thread since the last flush
+    int sending;        // Reports taken off the registers but not yet sent
+
+    pthread_t threadid;
+    pthread_mutex_t mtx;      // Guards everything above
+    pthread_mutex_t sendMtx;  // Held across each check-and-send, so the shadow
+                              // always matches the order things reached the Finch
+    pthread_cond_t cond;
+    bool running;
+    bool stopping;
+
+    // This class is not copy-safe.
+    OutputCoalescer(const OutputCoalescer&);
+    OutputCoalescer& operator=(const OutputCoalescer&);
+};
+
+#endif  /* OUTPUTCOALESCER_H */
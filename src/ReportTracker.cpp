@@ -0,0 +1,210 @@
+/*
+ * File:   ReportTracker.cpp
+ *
+ * Matches the Finch's input reports to the requests that asked for them.
+ *
+ * Each outgoing command report carries an 8-bit counter in byte 8, which the
+ * Finch echoes back in byte 7 of its reply. There is one slot per counter
+ * value; a request claims a free slot, and whichever thread is currently
+ * reading from the device drops each reply into the slot it names. Counters
+ * are handed out in increasing order and wrap around from 255 to 0, skipping
+ * any that are still in flight.
+ */
+
+#include "ReportTracker.h"
+#include <cstring>
+#include <time.h>
+#include "TraceLog.h"
+
+namespace {
+    struct timespec toTimespec(long long ns) {
+        struct timespec ts;
+        ts.tv_sec = time_t(ns / 1000000000LL);
+        ts.tv_nsec = long(ns % 1000000000LL);
+        return ts;
+    }
+}
+
+ReportTracker::ReportTracker()
+    : nextCounter(0), readerActive(false), late(0), orphaned(0) {
+    pthread_mutex_init(&mtx, 0);
+
+    // Reply deadlines are CLOCK_MONOTONIC, like every other time in the library.
+    pthread_condattr_t cond_attr;
+    (void)pthread_condattr_init(&cond_attr);
+    (void)pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &cond_attr);
+    (void)pthread_condattr_destroy(&cond_attr);
+    for (int i = 0; i < numSlots; i++) {
+        slots[i].state = FREE;
+    }
+}
+
+ReportTracker::~ReportTracker() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mtx);
+}
+
+unsigned char ReportTracker::begin() {
+    pthread_mutex_lock(&mtx);
+    for (;;) {
+        // Prefer a counter that is completely idle...
+        for (int i = 0; i < numSlots; i++) {
+            const unsigned char counter = static_cast<unsigned char>(nextCounter + i);
+            if (slots[counter].state == FREE) {
+                slots[counter].state = PENDING;
+                nextCounter = static_cast<unsigned char>(counter + 1);
+                pthread_mutex_unlock(&mtx);
+                return counter;
+            }
+        }
+        // ...but if there are none, recycle one whose reply was given up on.
+        for (int i = 0; i < numSlots; i++) {
+            const unsigned char counter = static_cast<unsigned char>(nextCounter + i);
+            if (slots[counter].state == ABANDONED || slots[counter].state == DISCARDED) {
+                slots[counter].state = PENDING;
+                nextCounter = static_cast<unsigned char>(counter + 1);
+                pthread_mutex_unlock(&mtx);
+                return counter;
+            }
+        }
+        pthread_cond_wait(&cond, &mtx);
+    }
+}
+
+void ReportTracker::cancel(unsigned char counter) {
+    pthread_mutex_lock(&mtx);
+    slots[counter].state = FREE;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+}
+
+void ReportTracker::abandon(unsigned char counter) {
+    pthread_mutex_lock(&mtx);
+    slots[counter].state = (slots[counter].state == DONE) ? FREE : ABANDONED;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+}
+
+void ReportTracker::discard(unsigned char counter) {
+    pthread_mutex_lock(&mtx);
+    slots[counter].state = (slots[counter].state == DONE) ? FREE : DISCARDED;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+}
+
+int ReportTracker::wait(hid_device* handle, unsigned char counter, unsigned char bufRead[], int timeout) {
+    Slot& slot = slots[counter];
+    const long long deadline = TimerService::now() + timeout * 1000000LL;
+    const struct timespec wakeAt = toTimespec(deadline);
+
+    pthread_mutex_lock(&mtx);
+    while (slot.state == PENDING) {
+        const long long remaining = deadline - TimerService::now();
+        if (remaining <= 0) {
+            // No reply in time; it may still show up later.
+            break;
+        }
+        if (readerActive) {
+            // Someone else is reading; they'll wake us when something arrives.
+            (void)pthread_cond_timedwait(&cond, &mtx, &wakeAt);
+            continue;
+        }
+
+        // Nobody is reading, so it's our turn. The lock is dropped while we
+        // wait on the device (no longer than our own deadline, since the
+        // others waiting behind us may have earlier ones to keep), so other
+        // requests can still come and go.
+        unsigned char report[9];
+        readerActive = true;
+        pthread_mutex_unlock(&mtx);
+        const long long readStart = TraceLog::enabled() ? TimerService::now() : 0;
+        const int res = hid_read_timeout(handle, report, sizeof(report), int((remaining + 999999) / 1000000));
+        if (readStart != 0) {
+            TraceLog::span("read", readStart, TimerService::now(), 0, (res > 0) ? report[7] : -1);
+        }
+        pthread_mutex_lock(&mtx);
+        readerActive = false;
+
+        if (res == -1) {
+            failPending();
+        }
+        else if (res > 0) {
+            route(report);
+        }
+        pthread_cond_broadcast(&cond);
+    }
+
+    int result;
+    if (slot.state == DONE) {
+        memcpy(bufRead, slot.report, sizeof(slot.report));
+        slot.state = FREE;
+        result = 1;
+    }
+    else {
+        // The read failed or timed out; unless the reply has already turned
+        // up, it may still do so.
+        slot.state = (slot.state == FAILED_LATE) ? FREE : ABANDONED;
+        result = -1;
+    }
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+    return result;
+}
+
+void ReportTracker::reset() {
+    pthread_mutex_lock(&mtx);
+    failPending();
+    pthread_cond_broadcast(&cond);
+    while (readerActive) {
+        pthread_cond_wait(&cond, &mtx);
+    }
+    pthread_mutex_unlock(&mtx);
+}
+
+unsigned long ReportTracker::lateReports() {
+    pthread_mutex_lock(&mtx);
+    const unsigned long result = late;
+    pthread_mutex_unlock(&mtx);
+    return result;
+}
+
+unsigned long ReportTracker::orphanedReports() {
+    pthread_mutex_lock(&mtx);
+    const unsigned long result = orphaned;
+    pthread_mutex_unlock(&mtx);
+    return result;
+}
+
+// Hands a report to the request it belongs to. Called with mtx held.
+void ReportTracker::route(const unsigned char report[]) {
+    Slot& slot = slots[report[7]];
+    if (slot.state == PENDING) {
+        memcpy(slot.report, report, sizeof(slot.report));
+        slot.state = DONE;
+    }
+    else if (slot.state == ABANDONED) {
+        slot.state = FREE;
+        late++;
+    }
+    else if (slot.state == FAILED) {
+        // Its waiter hasn't woken up to the failure yet.
+        slot.state = FAILED_LATE;
+        late++;
+    }
+    else if (slot.state == DISCARDED) {
+        slot.state = FREE;
+    }
+    else {
+        orphaned++;
+    }
+}
+
+// Fails every request still waiting on a reply. Called with mtx held.
+void ReportTracker::failPending() {
+    for (int i = 0; i < numSlots; i++) {
+        if (slots[i].state == PENDING) {
+            slots[i].state = FAILED;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * File:   ReportTracker.h
+ *
+ * Matches the Finch's input reports to the requests that asked for them, so
+ * that several requests can be in flight on one device at the same time.
+ */
+
+#ifndef REPORTTRACKER_H
+#define REPORTTRACKER_H
+
+#include <pthread.h>
+#include "hidapi.h"
+
+class ReportTracker {
+public:
+    ReportTracker();
+    ~ReportTracker();
+
+    // Reserves a report counter for a new request (the value to put in byte 8
+    // of the command report). Blocks if every counter is already in flight.
+    unsigned char begin();
+
+    // Releases a counter whose command report was never sent.
+    void cancel(unsigned char counter);
+
+    // Gives up on a counter whose command report was sent, but whose reply
+    // is no longer wanted. If the reply turns up, it is counted as late.
+    void abandon(unsigned char counter);
+
+    // Marks a counter whose command report was sent without anyone waiting
+    // for the reply (e.g. a keep-alive ping). The reply is dropped silently.
+    void discard(unsigned char counter);
+
+    // Waits up to timeout milliseconds for the reply tagged with counter
+    // (byte 7 of the input report) and copies it into bufRead. Whichever
+    // waiter gets there first reads reports off the device and hands each
+    // one to the waiter it belongs to. Returns -1 if the read failed or the
+    // time ran out, in which case the request is abandoned.
+    int wait(hid_device* handle, unsigned char counter, unsigned char bufRead[], int timeout);
+
+    // Fails every request still waiting on a reply, and waits until nobody
+    // is reading from the device, so that the device handle can be swapped
+    // for a new one (e.g. after reconnecting). The caller must make sure no
+    // new requests are sent on the old handle in the meantime.
+    void reset();
+
+    // Replies that arrived after their request was abandoned or failed.
+    unsigned long lateReports();
+    // Replies whose counter didn't belong to any request.
+    unsigned long orphanedReports();
+
+private:
+    // FAILED_LATE is a failed request whose reply has turned up since
+    // (and been counted as late) before its waiter noticed the failure.
+    enum SlotState { FREE, PENDING, DONE, FAILED, FAILED_LATE, ABANDONED, DISCARDED };
+
+    struct Slot {
+        SlotState state;
+        unsigned char report[9];
+    };
+
+    static const int numSlots = 256; // One per value of the 8-bit counter
+
+    void route(const unsigned char report[]);
+    void failPending();
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    Slot slots[numSlots];
+    unsigned char nextCounter;
+    bool readerActive;
+    unsigned long late;
+    unsigned long orphaned;
+
+    // This class is not copy-safe.
+    ReportTracker(const ReportTracker&);
+    ReportTracker& operator=(const ReportTracker&);
+};
+
+#endif  /* REPORTTRACKER_H */
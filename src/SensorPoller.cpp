@@ -0,0 +1,139 @@
+/*
+ * File:   SensorPoller.cpp
+ *
+ * Background sensor polling, published through a seqlock.
+ */
+
+#include "SensorPoller.h"
+#include <cstring>
+#include <time.h>
+#include "FinchImpl.h"
+#include "TimerService.h"
+
+namespace {
+    struct timespec toTimespec(long long ns) {
+        struct timespec ts;
+        ts.tv_sec = time_t(ns / 1000000000LL);
+        ts.tv_nsec = long(ns % 1000000000LL);
+        return ts;
+    }
+}
+
+SensorPoller::SensorPoller(Finch& owner)
+    : finch(owner), periodNs(0), staleness(-1), sequence(0), snapshot(), snapshotTime(0), running(false), stopping(false) {
+    pthread_mutex_init(&mtx, 0);
+
+    // Wait against the monotonic clock, so the polling rate isn't thrown off
+    // when the wall clock is adjusted.
+    pthread_condattr_t cond_attr;
+    (void)pthread_condattr_init(&cond_attr);
+    (void)pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &cond_attr);
+    (void)pthread_condattr_destroy(&cond_attr);
+}
+
+SensorPoller::~SensorPoller() {
+    stop();
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mtx);
+}
+
+int SensorPoller::start(int rateHz, int maxStaleness) {
+    if (rateHz <= 0 || maxStaleness < 0) {
+        return -1;
+    }
+
+    stop();
+
+    MutexLocker lock(mtx);
+    periodNs = 1000000000LL / rateHz;
+    stopping = false;
+    if (pthread_create(&threadid, 0, entryPoint, this) != 0) {
+        return -1;
+    }
+    running = true;
+    __atomic_store_n(&staleness, maxStaleness, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void SensorPoller::stop() {
+    {
+        MutexLocker lock(mtx);
+        if (!running) {
+            return;
+        }
+        stopping = true;
+        __atomic_store_n(&staleness, -1, __ATOMIC_RELAXED);
+        pthread_cond_broadcast(&cond);
+    }
+    (void)pthread_join(threadid, 0);
+
+    MutexLocker lock(mtx);
+    running = false;
+}
+
+bool SensorPoller::latest(Finch::Sensors& sensors, int maxAge) {
+    long long takenAt;
+    for (;;) {
+        const unsigned int before = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            // A new reading is being written right now; try again.
+            continue;
+        }
+        memcpy(&sensors, &snapshot, sizeof(sensors));
+        takenAt = snapshotTime;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sequence, __ATOMIC_RELAXED) == before) {
+            break;
+        }
+    }
+    return takenAt != 0 && TimerService::now() - takenAt <= maxAge * 1000000LL;
+}
+
+bool SensorPoller::latest(Finch::Sensors& sensors) {
+    const int maxAge = __atomic_load_n(&staleness, __ATOMIC_RELAXED);
+    if (maxAge < 0) {
+        return false;
+    }
+    return latest(sensors, maxAge);
+}
+
+// Only ever called from the polling thread, so there is a single writer.
+void SensorPoller::publish(const Finch::Sensors& sensors, long long takenAt) {
+    const unsigned int before = __atomic_load_n(&sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&sequence, before + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&snapshot, &sensors, sizeof(snapshot));
+    snapshotTime = takenAt;
+    __atomic_store_n(&sequence, before + 2, __ATOMIC_RELEASE);
+}
+
+void SensorPoller::run() {
+    long long deadline = TimerService::now();
+    for (;;) {
+        Finch::Sensors sensors;
+        if (finch.readAll(sensors) == 1) {
+            publish(sensors, TimerService::now());
+        }
+
+        // Sleep until the next poll is due (or we're told to stop). Deadlines
+        // are absolute, so time spent reading doesn't slow the rate down; if
+        // we've fallen more than a period behind, we just start afresh.
+        deadline += periodNs;
+        const long long now = TimerService::now();
+        if (deadline < now) {
+            deadline = now;
+        }
+        const struct timespec wakeAt = toTimespec(deadline);
+
+        MutexLocker lock(mtx);
+        while (!stopping && TimerService::now() < deadline) {
+            if (pthread_cond_timedwait(&cond, &mtx, &wakeAt) != 0) {
+                break;
+            }
+        }
+        if (stopping) {
+            break;
+        }
+    }
+}
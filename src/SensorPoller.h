@@ -0,0 +1,67 @@
+/*
+ * File:   SensorPoller.h
+ *
+ * Optional background thread that keeps reading every sensor on the Finch at
+ * a fixed rate, and publishes the latest readings through a seqlock so that
+ * any number of threads can pick them up without taking a lock or touching
+ * the USB link.
+ */
+
+#ifndef SENSORPOLLER_H
+#define SENSORPOLLER_H
+
+#include <pthread.h>
+#include "Finch.h"
+
+class SensorPoller {
+public:
+    explicit SensorPoller(Finch& owner);
+    ~SensorPoller();
+
+    // Starts (or restarts) the polling thread, reading every sensor rateHz
+    // times a second. Returns 1 on success, -1 on failure.
+    int start(int rateHz, int maxStaleness);
+
+    // Stops the polling thread (waiting for it to finish its current read).
+    void stop();
+
+    // Copies out the latest readings, as long as they were taken no more than
+    // maxAge milliseconds ago. Returns false if there is no such reading.
+    bool latest(Finch::Sensors& sensors, int maxAge);
+
+    // As above, using the staleness limit given to start(). Always returns
+    // false while the polling thread is stopped.
+    bool latest(Finch::Sensors& sensors);
+
+private:
+    static void* entryPoint(void* pThis) {
+        SensorPoller* pthX = static_cast<SensorPoller*>(pThis);
+        pthX->run();
+        return 0;
+    }
+
+    void run();
+    void publish(const Finch::Sensors& sensors, long long takenAt);
+
+    Finch& finch;
+    long long periodNs;
+    int staleness; // In milliseconds, -1 while stopped
+
+    // The seqlock. The sequence number is odd while a new reading is being
+    // written; readers retry if it was odd, or changed, while they copied.
+    unsigned int sequence;
+    Finch::Sensors snapshot;
+    long long snapshotTime; // CLOCK_MONOTONIC nanoseconds, 0 if none yet
+
+    pthread_t threadid;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    bool running;
+    bool stopping;
+
+    // This class is not copy-safe.
+    SensorPoller(const SensorPoller&);
+    SensorPoller& operator=(const SensorPoller&);
+};
+
+#endif  /* SENSORPOLLER_H */
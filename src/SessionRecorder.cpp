@@ -0,0 +1,129 @@
+/*
+ * File:   SessionRecorder.cpp
+ *
+ * Writes Finch session recordings.
+ *
+ * Records go through stdio with a large buffer, so recording a report is
+ * usually just a copy into memory. Each timestamp is taken under the lock,
+ * so the records are in time order however many threads are talking to
+ * the Finch. The time index is kept in memory, and written at the end.
+ */
+
+#include "SessionRecorder.h"
+#include <cstring>
+#include <time.h>
+#include "finch-recording.h"
+#include "FinchImpl.h"
+#include "TimerService.h"
+
+namespace {
+    const size_t fileBufferSize = 1 << 16;
+
+    void putU32(unsigned char* out, unsigned long value) {
+        for (int i = 0; i < 4; i++) {
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+    }
+
+    void putU64(unsigned char* out, unsigned long long value) {
+        for (int i = 0; i < 8; i++) {
+            out[i] = static_cast<unsigned char>(value >> (8 * i));
+        }
+    }
+}
+
+SessionRecorder::SessionRecorder()
+    : active(0), file(0), startedAt(0), records(0), failed(false) {
+    pthread_mutex_init(&mtx, 0);
+}
+
+SessionRecorder::~SessionRecorder() {
+    (void)stop();
+    pthread_mutex_destroy(&mtx);
+}
+
+int SessionRecorder::start(const char* path) {
+    MutexLocker lock(mtx);
+    if (file) {
+        return -1;
+    }
+    file = fopen(path, "wb");
+    if (!file) {
+        return -1;
+    }
+    (void)setvbuf(file, 0, _IOFBF, fileBufferSize);
+
+    struct timespec wallClock;
+    clock_gettime(CLOCK_REALTIME, &wallClock);
+    unsigned char header[FINCH_REC_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, FINCH_REC_MAGIC, FINCH_REC_MAGIC_SIZE);
+    putU32(header + 8, FINCH_REC_VERSION);
+    putU32(header + 12, FINCH_REC_RECORD_SIZE);
+    putU64(header + 16, static_cast<unsigned long long>(wallClock.tv_sec) * 1000000000ULL +
+                        static_cast<unsigned long long>(wallClock.tv_nsec));
+    failed = fwrite(header, sizeof(header), 1, file) != 1;
+
+    startedAt = TimerService::now();
+    records = 0;
+    index.clear();
+    __atomic_store_n(&active, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int SessionRecorder::stop() {
+    MutexLocker lock(mtx);
+    if (!file) {
+        return -1;
+    }
+    __atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+
+    // The index, then the trailer that says where to find it.
+    const long indexOffset = ftell(file);
+    for (size_t i = 0; i < index.size(); i++) {
+        unsigned char entry[FINCH_REC_INDEX_ENTRY_SIZE];
+        putU64(entry, static_cast<unsigned long long>(i) * FINCH_REC_INDEX_INTERVAL_NS);
+        putU64(entry + 8, index[i]);
+        failed = failed || fwrite(entry, sizeof(entry), 1, file) != 1;
+    }
+    unsigned char trailer[FINCH_REC_TRAILER_SIZE];
+    putU64(trailer, static_cast<unsigned long long>(indexOffset));
+    putU64(trailer + 8, index.size());
+    memcpy(trailer + 16, FINCH_REC_INDEX_MAGIC, FINCH_REC_MAGIC_SIZE);
+    failed = failed || indexOffset < 0 || fwrite(trailer, sizeof(trailer), 1, file) != 1;
+
+    failed = (fclose(file) != 0) || failed;
+    file = 0;
+    index.clear();
+    return failed ? -1 : 1;
+}
+
+void SessionRecorder::recordCommand(const unsigned char report[]) {
+    append(FINCH_REC_OUT, report[1], report, FINCH_REC_REPORT_SIZE);
+}
+
+void SessionRecorder::recordReply(unsigned char command, const unsigned char reply[]) {
+    append(FINCH_REC_IN, command, reply, 8);
+}
+
+void SessionRecorder::append(unsigned char direction, unsigned char command, const unsigned char report[], int length) {
+    MutexLocker lock(mtx);
+    if (!file) {
+        // Stopped since the caller checked.
+        return;
+    }
+
+    const long long time = TimerService::now() - startedAt;
+    while (static_cast<long long>(index.size()) * FINCH_REC_INDEX_INTERVAL_NS <= time) {
+        index.push_back(records);
+    }
+
+    unsigned char record[FINCH_REC_RECORD_SIZE];
+    memset(record, 0, sizeof(record));
+    putU64(record + FINCH_REC_TIME, static_cast<unsigned long long>(time));
+    record[FINCH_REC_DIRECTION] = direction;
+    record[FINCH_REC_COMMAND] = command;
+    memcpy(record + FINCH_REC_REPORT, report, size_t(length));
+    failed = failed || fwrite(record, sizeof(record), 1, file) != 1;
+    records++;
+}
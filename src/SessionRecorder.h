@@ -0,0 +1,57 @@
+/*
+ * File:   SessionRecorder.h
+ *
+ * Records every report a Finch is sent, and every reply it gives, with
+ * CLOCK_MONOTONIC timestamps, to a compact binary file with a time index
+ * (see finch-recording.h). The replay backend (hid-replay.c) plays such
+ * recordings back through the ordinary Finch API.
+ */
+
+#ifndef SESSIONRECORDER_H
+#define SESSIONRECORDER_H
+
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+
+class SessionRecorder {
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    // Starts recording to path, replacing the file if there is one. Returns
+    // 1 on success, -1 if already recording or the file can't be created.
+    int start(const char* path);
+
+    // Writes the time index and closes the file. Returns 1 if the whole
+    // recording was written, -1 if not (or if it wasn't recording).
+    int stop();
+
+    // Whether it's recording; check this before recording anything.
+    bool recording() {
+        return __atomic_load_n(&active, __ATOMIC_RELAXED) != 0;
+    }
+
+    // Records a 9 byte command report going out to the Finch.
+    void recordCommand(const unsigned char report[]);
+
+    // Records the 8 byte reply to a command.
+    void recordReply(unsigned char command, const unsigned char reply[]);
+
+private:
+    void append(unsigned char direction, unsigned char command, const unsigned char report[], int length);
+
+    pthread_mutex_t mtx;            // Guards everything below
+    int active;
+    FILE* file;
+    long long startedAt;            // CLOCK_MONOTONIC nanoseconds
+    unsigned long long records;
+    std::vector<unsigned long long> index; // Record number at the start of each second
+    bool failed;                    // Whether any write has failed
+
+    // This class is not copy-safe.
+    SessionRecorder(const SessionRecorder&);
+    SessionRecorder& operator=(const SessionRecorder&);
+};
+
+#endif  /* SESSIONRECORDER_H */
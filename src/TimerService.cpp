@@ -0,0 +1,179 @@
+/*
+ * File:   TimerService.cpp
+ *
+ * A single-threaded timer heap, driven by a condition variable waiting on
+ * CLOCK_MONOTONIC.
+ */
+
+#include "TimerService.h"
+#include <algorithm>
+#include <time.h>
+#include "FinchImpl.h"
+
+namespace {
+    pthread_once_t sharedOnce = PTHREAD_ONCE_INIT;
+    TimerService* sharedInstance = 0;
+
+    void createShared() {
+        // Never destroyed: Finch objects with static storage duration may
+        // still be using it while the program exits.
+        sharedInstance = new TimerService;
+    }
+
+    // How long before each deadline the precise instance starts spinning.
+    // Comfortably more than the usual wake-up latency of a sleeping thread.
+    const long long preciseSpin = 200000LL; // 200 microseconds
+
+    pthread_once_t preciseOnce = PTHREAD_ONCE_INIT;
+    TimerService* preciseInstance = 0;
+
+    void createPrecise() {
+        // Never destroyed, for the same reason as the shared instance.
+        preciseInstance = new TimerService(preciseSpin);
+    }
+
+    struct timespec toTimespec(long long ns) {
+        struct timespec ts;
+        ts.tv_sec = time_t(ns / 1000000000LL);
+        ts.tv_nsec = long(ns % 1000000000LL);
+        return ts;
+    }
+}
+
+TimerService::TimerService(long long spinNs)
+    : spin(spinNs), nextId(1), runningId(0), running(false), stopping(false) {
+    pthread_mutex_init(&mtx, 0);
+
+    pthread_condattr_t cond_attr;
+    (void)pthread_condattr_init(&cond_attr);
+    (void)pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &cond_attr);
+    (void)pthread_condattr_destroy(&cond_attr);
+}
+
+TimerService::~TimerService() {
+    {
+        MutexLocker lock(mtx);
+        stopping = true;
+        pthread_cond_broadcast(&cond);
+    }
+    if (running) {
+        (void)pthread_join(threadid, 0);
+    }
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mtx);
+}
+
+TimerService& TimerService::shared() {
+    (void)pthread_once(&sharedOnce, createShared);
+    return *sharedInstance;
+}
+
+TimerService& TimerService::precise() {
+    (void)pthread_once(&preciseOnce, createPrecise);
+    return *preciseInstance;
+}
+
+long long TimerService::now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int TimerService::schedule(long long deadline, Callback callback, void* context) {
+    MutexLocker lock(mtx);
+    if (stopping) {
+        return -1;
+    }
+    if (!running) {
+        if (pthread_create(&threadid, 0, entryPoint, this) != 0) {
+            return -1;
+        }
+        running = true;
+    }
+
+    const int id = nextId++;
+    Timer timer;
+    timer.callback = callback;
+    timer.context = context;
+    timer.deadline = deadline;
+    timers[id] = timer;
+    push(deadline, id);
+    pthread_cond_broadcast(&cond);
+    return id;
+}
+
+void TimerService::cancel(int id) {
+    MutexLocker lock(mtx);
+    timers.erase(id);
+    if (running && pthread_equal(threadid, pthread_self())) {
+        // Cancelled from inside a callback; no need (and no way) to wait.
+        return;
+    }
+    while (runningId == id) {
+        pthread_cond_wait(&cond, &mtx);
+    }
+}
+
+// Called with mtx held.
+void TimerService::push(long long deadline, int id) {
+    HeapEntry entry;
+    entry.deadline = deadline;
+    entry.id = id;
+    heap.push_back(entry);
+    std::push_heap(heap.begin(), heap.end());
+}
+
+void TimerService::run() {
+    pthread_mutex_lock(&mtx);
+    while (!stopping) {
+        if (heap.empty()) {
+            pthread_cond_wait(&cond, &mtx);
+            continue;
+        }
+
+        const HeapEntry next = heap.front();
+        std::map<int, Timer>::iterator it = timers.find(next.id);
+        if (it == timers.end() || it->second.deadline != next.deadline) {
+            // Stale entry; drop it.
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+            continue;
+        }
+
+        // Sleep until the deadline (less the spin window). New timers wake us
+        // early, and we go round again in case they're due sooner.
+        const long long wakeAt = next.deadline - spin;
+        if (now() < wakeAt) {
+            const struct timespec ts = toTimespec(wakeAt);
+            pthread_cond_timedwait(&cond, &mtx, &ts);
+            continue;
+        }
+
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+        const Timer timer = it->second;
+        runningId = next.id;
+        pthread_mutex_unlock(&mtx);
+
+        // Spin out whatever is left of the wait, then run the callback.
+        while (now() < timer.deadline) {
+        }
+        const long long nextDeadline = timer.callback(timer.context, timer.deadline, now());
+
+        pthread_mutex_lock(&mtx);
+        runningId = 0;
+        it = timers.find(next.id);
+        if (it != timers.end()) {
+            if (nextDeadline > 0) {
+                it->second.deadline = nextDeadline;
+                push(nextDeadline, next.id);
+            }
+            else {
+                timers.erase(it);
+            }
+        }
+        pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&mtx);
+}
@@ -0,0 +1,90 @@
+/*
+ * File:   TimerService.h
+ *
+ * Runs callbacks at absolute CLOCK_MONOTONIC deadlines, for any number of
+ * timers, on a single thread. The Finch library uses one process-wide
+ * instance to send keep-alive pings for every Finch, instead of giving each
+ * Finch a thread of its own, and a second one, which spins for the last
+ * stretch before each deadline, to end timed actions on time.
+ */
+
+#ifndef TIMERSERVICE_H
+#define TIMERSERVICE_H
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+
+class TimerService {
+public:
+    // Called on the timer thread once deadline has passed; firedAt is when
+    // the callback actually ran. Returns the next deadline for this timer, or
+    // 0 if it shouldn't run again. All times are CLOCK_MONOTONIC nanoseconds.
+    typedef long long (*Callback)(void* context, long long deadline, long long firedAt);
+
+    // spinNs is how long before each deadline the timer thread stops sleeping
+    // and starts spinning, trading CPU time for accuracy. 0 means never spin.
+    explicit TimerService(long long spinNs = 0);
+    ~TimerService();
+
+    // The process-wide instance, used for keep-alive pings.
+    static TimerService& shared();
+
+    // The process-wide instance for timed actions (e.g. setMotorsFor()),
+    // which spins just before each deadline for accuracy.
+    static TimerService& precise();
+
+    // The current CLOCK_MONOTONIC time, in nanoseconds.
+    static long long now();
+
+    // Sets up a timer, starting the timer thread if needed. Returns an id
+    // that can be passed to cancel(), or -1 on failure.
+    int schedule(long long deadline, Callback callback, void* context);
+
+    // Removes a timer. If its callback is running on another thread, waits
+    // for it to return first, so the context can safely be freed afterwards.
+    void cancel(int id);
+
+private:
+    struct Timer {
+        Callback callback;
+        void* context;
+        long long deadline;
+    };
+
+    // Heap entries go stale when a timer is cancelled or rescheduled; they
+    // are recognized (and skipped) by their deadline no longer matching.
+    struct HeapEntry {
+        long long deadline;
+        int id;
+        bool operator<(const HeapEntry& other) const {
+            return deadline > other.deadline; // Soonest on top
+        }
+    };
+
+    static void* entryPoint(void* pThis) {
+        TimerService* pthX = static_cast<TimerService*>(pThis);
+        pthX->run();
+        return 0;
+    }
+
+    void run();
+    void push(long long deadline, int id);
+
+    const long long spin;
+    pthread_t threadid;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    std::map<int, Timer> timers;
+    std::vector<HeapEntry> heap;
+    int nextId;
+    int runningId;      // The timer whose callback is running, 0 if none
+    bool running;
+    bool stopping;
+
+    // This class is not copy-safe.
+    TimerService(const TimerService&);
+    TimerService& operator=(const TimerService&);
+};
+
+#endif  /* TIMERSERVICE_H */
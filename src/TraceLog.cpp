@@ -0,0 +1,178 @@
+/*
+ * File:   TraceLog.cpp
+ *
+ * Per-thread trace buffers, and writing them out as Chrome trace-event JSON.
+ *
+ * Each thread that records something gets a buffer of its own the first
+ * time, found again through a thread-local pointer, so threads never wait
+ * on each other to record. The buffers stay on a process-wide list (even
+ * after their thread has gone) so that stop() can collect them all. Each has
+ * a lock of its own, only ever contended while stop() is reading it.
+ */
+
+#include "TraceLog.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include "FinchImpl.h"
+
+int TraceLog::active = 0;
+
+namespace {
+    struct Event {
+        const char* name;
+        long long start;
+        long long duration;     // -1 for an instant event
+        int counter;
+        unsigned char command;
+    };
+
+    // Beyond this, a thread's events are counted but not kept, so a trace
+    // left running can't eat all the memory.
+    const size_t maxEventsPerThread = 1000000;
+
+    struct TraceBuffer {
+        pthread_mutex_t mtx;    // Guards everything below
+        int tid;                // Numbered in the order threads first traced something
+        std::vector<Event> events;
+        unsigned long dropped;
+        TraceBuffer* next;
+    };
+
+    pthread_mutex_t listMtx = PTHREAD_MUTEX_INITIALIZER; // Guards everything below
+    TraceBuffer* buffers = 0;
+    int nextTid = 1;
+    long long startedAt = 0;
+
+    __thread TraceBuffer* threadBuffer = 0;
+
+    TraceBuffer* bufferForThisThread() {
+        if (!threadBuffer) {
+            TraceBuffer* buffer = new TraceBuffer;
+            pthread_mutex_init(&buffer->mtx, 0);
+            buffer->dropped = 0;
+
+            MutexLocker lock(listMtx);
+            buffer->tid = nextTid++;
+            buffer->next = buffers;
+            buffers = buffer;
+            threadBuffer = buffer;
+        }
+        return threadBuffer;
+    }
+
+    void record(const Event& event) {
+        TraceBuffer* buffer = bufferForThisThread();
+        MutexLocker lock(buffer->mtx);
+        if (buffer->events.size() >= maxEventsPerThread) {
+            buffer->dropped++;
+        }
+        else {
+            buffer->events.push_back(event);
+        }
+    }
+
+    pthread_once_t environmentOnce = PTHREAD_ONCE_INIT;
+    char* environmentPath = 0;
+
+    void writeAtExit() {
+        (void)TraceLog::stop(environmentPath);
+    }
+
+    void startFromEnvironmentOnce() {
+        const char* path = getenv("FINCH_TRACE");
+        if (path && *path && TraceLog::start() == 1) {
+            environmentPath = strdup(path);
+            atexit(writeAtExit);
+        }
+    }
+}
+
+int TraceLog::start() {
+    MutexLocker lock(listMtx);
+    if (enabled()) {
+        return -1;
+    }
+    for (TraceBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+        MutexLocker bufferLock(buffer->mtx);
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+    startedAt = TimerService::now();
+    __atomic_store_n(&active, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int TraceLog::stop(const char* path) {
+    MutexLocker lock(listMtx);
+    if (!enabled()) {
+        return -1;
+    }
+    __atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+
+    FILE* out = path ? fopen(path, "w") : 0;
+    const int pid = int(getpid());
+    unsigned long dropped = 0;
+    bool first = true;
+
+    if (out) {
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    }
+    for (TraceBuffer* buffer = buffers; buffer; buffer = buffer->next) {
+        MutexLocker bufferLock(buffer->mtx);
+        for (size_t i = 0; out && i < buffer->events.size(); i++) {
+            const Event& event = buffer->events[i];
+            fprintf(out, "%s\n{\"name\":\"%s", first ? "" : ",", event.name);
+            if (event.command >= ' ' && event.command < 127 && event.command != '"' && event.command != '\\') {
+                fprintf(out, " %c", event.command);
+            }
+            fprintf(out, "\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f", pid, buffer->tid,
+                    double(event.start - startedAt) / 1000.0);
+            if (event.duration < 0) {
+                fprintf(out, ",\"ph\":\"i\",\"s\":\"t\"");
+            }
+            else {
+                fprintf(out, ",\"ph\":\"X\",\"dur\":%.3f", double(event.duration) / 1000.0);
+            }
+            if (event.counter >= 0) {
+                fprintf(out, ",\"args\":{\"counter\":%d}", event.counter);
+            }
+            fprintf(out, "}");
+            first = false;
+        }
+        dropped += buffer->dropped;
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+    if (!out) {
+        return -1;
+    }
+    fprintf(out, "\n],\"otherData\":{\"droppedEvents\":%lu}}\n", dropped);
+    return (fclose(out) == 0) ? 1 : -1;
+}
+
+void TraceLog::startFromEnvironment() {
+    pthread_once(&environmentOnce, startFromEnvironmentOnce);
+}
+
+void TraceLog::span(const char* name, long long start, long long end, unsigned char command, int counter) {
+    Event event;
+    event.name = name;
+    event.start = start;
+    event.duration = (end > start) ? end - start : 0;
+    event.counter = counter;
+    event.command = command;
+    record(event);
+}
+
+void TraceLog::instant(const char* name, long long at, unsigned char command, int counter) {
+    Event event;
+    event.name = name;
+    event.start = at;
+    event.duration = -1;
+    event.counter = counter;
+    event.command = command;
+    record(event);
+}
@@ -0,0 +1,75 @@
+/*
+ * File:   TraceLog.h
+ *
+ * Optional process-wide trace of the library's HID traffic: every report
+ * written and read, keep-alive checks, time spent waiting for and holding
+ * each Finch's lock, and timed sleeps. Each thread records into its own
+ * buffer, and the whole lot is written out as Chrome trace-event JSON,
+ * which chrome://tracing and the Perfetto UI can open. While tracing is off,
+ * each trace point costs one relaxed load of a flag.
+ */
+
+#ifndef TRACELOG_H
+#define TRACELOG_H
+
+#include "TimerService.h"
+
+class TraceLog {
+public:
+    // Whether tracing is on; check this before taking any timestamps.
+    static bool enabled() {
+        return __atomic_load_n(&active, __ATOMIC_RELAXED) != 0;
+    }
+
+    // Throws away anything traced so far, and starts tracing. Returns 1 on
+    // success, -1 if tracing was already on.
+    static int start();
+
+    // Stops tracing and writes everything traced to path. Returns 1 on
+    // success, -1 if tracing wasn't on or the file couldn't be written.
+    static int stop(const char* path);
+
+    // Starts tracing if the FINCH_TRACE environment variable names a file,
+    // and arranges for the trace to be written there when the program exits.
+    // Only looks the first time it's called.
+    static void startFromEnvironment();
+
+    // Records, on the calling thread, something that ran from start to end
+    // (TimerService::now() times), or happened at a moment. name must be a
+    // string literal. command is the command letter it concerns (0 if none),
+    // and counter the report counter (-1 if none).
+    static void span(const char* name, long long start, long long end, unsigned char command = 0, int counter = -1);
+    static void instant(const char* name, long long at, unsigned char command = 0, int counter = -1);
+
+private:
+    static int active;
+};
+
+// Traces the lifetime of a scope as a span, if tracing was on when it began.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* spanName, unsigned char spanCommand = 0)
+        : name(spanName), command(spanCommand), counter(-1), start(TraceLog::enabled() ? TimerService::now() : 0) {
+    }
+    ~TraceSpan() {
+        if (start != 0) {
+            TraceLog::span(name, start, TimerService::now(), command, counter);
+        }
+    }
+
+    void setCounter(int reportCounter) {
+        counter = reportCounter;
+    }
+
+private:
+    const char* name;
+    unsigned char command;
+    int counter;
+    long long start;
+
+    // This class is not copy-safe.
+    TraceSpan(const TraceSpan&);
+    TraceSpan& operator=(const TraceSpan&);
+};
+
+#endif  /* TRACELOG_H */
@@ -0,0 +1,57 @@
+/*******************************************************
+ Finch session recordings
+
+ The file format written by the library's session recorder
+ (SessionRecorder.cpp) and played back by the replay backend
+ (hid-replay.c).
+
+ A recording is a 32 byte header, then one fixed size record for every
+ report that went to or came from the Finch, in time order, then (if the
+ recording was stopped cleanly) a time index and a trailer. Every
+ number is little-endian.
+
+   Header:   magic "FINCHREC", u32 version, u32 record size,
+             u64 wall-clock time at the start (ns since 1970),
+             u64 reserved (0)
+   Record:   u64 time (ns since the start), u8 direction, u8 command
+             letter, 9 report bytes, 1 reserved byte (0). A command
+             report is stored whole, report ID first; a reply is its 8
+             bytes, then a 0.
+   Index:    for each whole second of the recording, u64 time and
+             u64 record number of the first record at or after it.
+   Trailer:  u64 offset of the index, u64 number of index entries,
+             magic "FINCHIDX".
+
+ Since the records are all the same size and in time order, a recording
+ without an index (e.g. from a program that crashed) can still be
+ searched by time, just not as quickly.
+********************************************************/
+
+#ifndef FINCH_RECORDING_H__
+#define FINCH_RECORDING_H__
+
+#define FINCH_REC_MAGIC "FINCHREC"
+#define FINCH_REC_INDEX_MAGIC "FINCHIDX"
+#define FINCH_REC_MAGIC_SIZE 8
+#define FINCH_REC_VERSION 1
+
+#define FINCH_REC_HEADER_SIZE 32
+#define FINCH_REC_RECORD_SIZE 20
+#define FINCH_REC_INDEX_ENTRY_SIZE 16
+#define FINCH_REC_TRAILER_SIZE 24
+
+/* Where each field of a record starts. */
+#define FINCH_REC_TIME 0
+#define FINCH_REC_DIRECTION 8
+#define FINCH_REC_COMMAND 9
+#define FINCH_REC_REPORT 10
+#define FINCH_REC_REPORT_SIZE 9
+
+/* Record directions. */
+#define FINCH_REC_OUT 0     /* A command report sent to the Finch */
+#define FINCH_REC_IN 1      /* A reply from the Finch */
+
+/* How far apart the index entries are. */
+#define FINCH_REC_INDEX_INTERVAL_NS 1000000000LL
+
+#endif
@@ -0,0 +1,661 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Alan Ott
+ Signal 11 Software
+
+ 8/22/2009
+ Linux Version - 6/2/2010
+ hidraw Version
+
+ Copyright 2009, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+/* This backend leaves the device to the kernel's own HID driver and
+   talks to it through /dev/hidrawN with plain read(), write() and
+   poll(). There are no transfers to manage and no thread per device:
+   the kernel queues the input reports, and a read blocks the caller
+   only. Device details come from sysfs, so neither libusb nor libudev
+   is needed. Build with HID_BACKEND=hidraw to use it instead of
+   hid-linux.c. */
+
+#define _GNU_SOURCE // needed for wcsdup() before glibc 2.10
+
+/* C */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <locale.h>
+#include <errno.h>
+#include <limits.h>
+
+/* Unix */
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+
+/* Linux */
+#include <linux/hidraw.h>
+#include <linux/input.h>
+
+#include "hidapi.h"
+
+#define HIDRAW_CLASS_DIR "/sys/class/hidraw"
+
+/* Bus type of a USB device, in HID_ID of the uevent file. */
+#define HID_BUS_USB 0x03
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hid_device_ {
+    int device_handle;
+    int blocking;
+    char *name;             /* The hidrawN name of the device in sysfs */
+};
+
+enum device_string_id {
+    DEVICE_STRING_MANUFACTURER,
+    DEVICE_STRING_PRODUCT,
+    DEVICE_STRING_SERIAL
+};
+
+static hid_device *new_hid_device(void) {
+    hid_device *dev = calloc(1, sizeof(hid_device));
+    dev->device_handle = -1;
+    dev->blocking = 1;
+    dev->name = NULL;
+
+    return dev;
+}
+
+static void free_hid_device(hid_device *dev) {
+    free(dev->name);
+    free(dev);
+}
+
+static wchar_t *utf8_to_wchar_t(const char *utf8) {
+    wchar_t *ret = NULL;
+
+    if (utf8) {
+        size_t wlen = mbstowcs(NULL, utf8, 0);
+        if ((size_t) -1 == wlen) {
+            return wcsdup(L"");
+        }
+        ret = calloc(wlen + 1, sizeof(wchar_t));
+        mbstowcs(ret, utf8, wlen + 1);
+        ret[wlen] = 0x0000;
+    }
+
+    return ret;
+}
+
+/* Reads the first line of a sysfs attribute, without the newline.
+   The caller frees it. */
+static char *read_sysfs_line(const char *dir, const char *attribute) {
+    char path[PATH_MAX];
+    char line[256];
+    FILE *f;
+    size_t len;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, attribute);
+    f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        line[--len] = '\0';
+    }
+    return strdup(line);
+}
+
+/* Reads an attribute holding a hex number, such as idVendor or
+   bInterfaceNumber. */
+static int read_sysfs_hex(const char *dir, const char *attribute, unsigned int *value) {
+    char *line = read_sysfs_line(dir, attribute);
+    int ret = -1;
+
+    if (line) {
+        if (sscanf(line, "%x", value) == 1) {
+            ret = 0;
+        }
+        free(line);
+    }
+    return ret;
+}
+
+/* Picks the bus type, IDs, name and serial number out of the uevent
+   file of a HID device. name and serial are set to NULL if missing;
+   the caller frees them. */
+static int parse_uevent(const char *hid_dir, unsigned int *bus_type,
+                        unsigned short *vendor_id, unsigned short *product_id,
+                        char **name, char **serial) {
+    char path[PATH_MAX];
+    char line[256];
+    FILE *f;
+    int found_id = 0;
+
+    *name = NULL;
+    *serial = NULL;
+
+    snprintf(path, sizeof(path), "%s/uevent", hid_dir);
+    f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *value = strchr(line, '=');
+        size_t len;
+
+        if (!value) {
+            continue;
+        }
+        *value++ = '\0';
+        len = strlen(value);
+        while (len > 0 && value[len - 1] == '\n') {
+            value[--len] = '\0';
+        }
+
+        if (strcmp(line, "HID_ID") == 0) {
+            /* e.g. HID_ID=0003:00002354:00001111 */
+            unsigned int vid, pid;
+            if (sscanf(value, "%x:%x:%x", bus_type, &vid, &pid) == 3) {
+                *vendor_id = (unsigned short) vid;
+                *product_id = (unsigned short) pid;
+                found_id = 1;
+            }
+        }
+        else if (strcmp(line, "HID_NAME") == 0 && !*name) {
+            *name = strdup(value);
+        }
+        else if (strcmp(line, "HID_UNIQ") == 0 && !*serial) {
+            *serial = strdup(value);
+        }
+    }
+    fclose(f);
+
+    if (!found_id) {
+        free(*name);
+        free(*serial);
+        *name = NULL;
+        *serial = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Cuts the last component off a path, in place. */
+static int parent_dir(char *path) {
+    char *slash = strrchr(path, '/');
+
+    if (!slash || slash == path) {
+        return -1;
+    }
+    *slash = '\0';
+    return 0;
+}
+
+/* Fills in a hid_device_info for /dev/<name>, with the strings flags asks
+   for, or returns NULL if it isn't a hidraw device with the given IDs (0
+   matches any). */
+static struct hid_device_info *new_device_info(const char *name, unsigned short vendor_id, unsigned short product_id, int flags) {
+    struct hid_device_info *info;
+    char link[PATH_MAX];
+    char hid_dir[PATH_MAX];
+    char *hid_name = NULL;
+    char *hid_serial = NULL;
+    unsigned int bus_type = 0;
+    unsigned short dev_vid = 0, dev_pid = 0;
+
+    snprintf(link, sizeof(link), HIDRAW_CLASS_DIR "/%s/device", name);
+    if (!realpath(link, hid_dir)) {
+        return NULL;
+    }
+    if (parse_uevent(hid_dir, &bus_type, &dev_vid, &dev_pid, &hid_name, &hid_serial) < 0) {
+        return NULL;
+    }
+    if ((vendor_id != 0x0 && vendor_id != dev_vid) ||
+            (product_id != 0x0 && product_id != dev_pid)) {
+        free(hid_name);
+        free(hid_serial);
+        return NULL;
+    }
+
+    info = calloc(1, sizeof(struct hid_device_info));
+    info->next = NULL;
+    info->path = malloc(strlen("/dev/") + strlen(name) + 1);
+    sprintf(info->path, "/dev/%s", name);
+    info->vendor_id = dev_vid;
+    info->product_id = dev_pid;
+    if (flags & HID_ENUMERATE_SERIAL_NUMBER) {
+        info->serial_number = utf8_to_wchar_t(hid_serial ? hid_serial : "");
+    }
+    info->release_number = 0x0;
+    info->interface_number = -1;
+
+    if (bus_type == HID_BUS_USB) {
+        /* The HID device sits under its USB interface, which sits under
+           the USB device, e.g.
+           .../usb1/1-1/1-1:1.0/0003:2354:1111.0001 */
+        char intf_dir[PATH_MAX];
+        char usb_dir[PATH_MAX];
+        unsigned int value;
+
+        strcpy(intf_dir, hid_dir);
+        if (parent_dir(intf_dir) == 0) {
+            if (read_sysfs_hex(intf_dir, "bInterfaceNumber", &value) == 0) {
+                info->interface_number = (int) value;
+            }
+            strcpy(usb_dir, intf_dir);
+            if (parent_dir(usb_dir) == 0) {
+                if (flags & HID_ENUMERATE_NAMES) {
+                    char *manufacturer = read_sysfs_line(usb_dir, "manufacturer");
+                    char *product = read_sysfs_line(usb_dir, "product");
+
+                    info->manufacturer_string = utf8_to_wchar_t(manufacturer);
+                    info->product_string = utf8_to_wchar_t(product);
+                    free(manufacturer);
+                    free(product);
+                }
+                if (read_sysfs_hex(usb_dir, "bcdDevice", &value) == 0) {
+                    info->release_number = (unsigned short) value;
+                }
+            }
+        }
+    }
+
+    /* Whatever sysfs didn't say, HID_NAME covers. */
+    if (flags & HID_ENUMERATE_NAMES) {
+        if (!info->manufacturer_string) {
+            info->manufacturer_string = utf8_to_wchar_t("");
+        }
+        if (!info->product_string) {
+            info->product_string = utf8_to_wchar_t(hid_name ? hid_name : "");
+        }
+    }
+
+    free(hid_name);
+    free(hid_serial);
+    return info;
+}
+
+/* The name of the hidraw device at path, e.g. "hidraw0" for
+   "/dev/hidraw0". */
+static const char *hidraw_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+static int get_device_string(hid_device *dev, enum device_string_id key, wchar_t *string, size_t maxlen) {
+    struct hid_device_info *info;
+    const wchar_t *str = NULL;
+
+    if (maxlen == 0) {
+        return -1;
+    }
+    info = new_device_info(dev->name, 0x0, 0x0, HID_ENUMERATE_STRINGS);
+    if (!info) {
+        return -1;
+    }
+    switch (key) {
+    case DEVICE_STRING_MANUFACTURER:
+        str = info->manufacturer_string;
+        break;
+    case DEVICE_STRING_PRODUCT:
+        str = info->product_string;
+        break;
+    case DEVICE_STRING_SERIAL:
+        str = info->serial_number;
+        break;
+    }
+    wcsncpy(string, str ? str : L"", maxlen);
+    string[maxlen - 1] = L'\0';
+    hid_free_enumeration(info);
+
+    return 0;
+}
+
+
+int HID_API_EXPORT hid_init(void) {
+    const char *locale;
+
+    /* Set the locale if it's not set, so mbstowcs() can read the
+       UTF-8 strings in sysfs. */
+    locale = setlocale(LC_CTYPE, NULL);
+    if (!locale) {
+        setlocale(LC_CTYPE, "");
+    }
+
+    return 0;
+}
+
+int HID_API_EXPORT hid_exit(void) {
+    /* Nothing to do for this in the hidraw implementation. */
+    return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id) {
+    return hid_enumerate_filtered(vendor_id, product_id, HID_ENUMERATE_STRINGS);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(unsigned short vendor_id, unsigned short product_id, int flags) {
+    /* Opening a hidraw device goes straight to its path, so there's
+       nothing for an index to save. */
+    struct hid_device_info *root = NULL; // return object
+    struct hid_device_info *cur_dev = NULL;
+    DIR *dir;
+    struct dirent *entry;
+
+    hid_init();
+
+    dir = opendir(HIDRAW_CLASS_DIR);
+    if (!dir) {
+        return NULL;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        struct hid_device_info *tmp;
+
+        if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+            continue;
+        }
+        tmp = new_device_info(entry->d_name, vendor_id, product_id, flags);
+        if (!tmp) {
+            continue;
+        }
+        if (cur_dev) {
+            cur_dev->next = tmp;
+        }
+        else {
+            root = tmp;
+        }
+        cur_dev = tmp;
+    }
+    closedir(dir);
+
+    return root;
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs) {
+    struct hid_device_info *d = devs;
+    while (d) {
+        struct hid_device_info *next = d->next;
+        free(d->path);
+        free(d->serial_number);
+        free(d->manufacturer_string);
+        free(d->product_string);
+        free(d);
+        d = next;
+    }
+}
+
+hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, wchar_t *serial_number) {
+    struct hid_device_info *devs, *cur_dev;
+    const char *path_to_open = NULL;
+    hid_device *handle = NULL;
+
+    devs = hid_enumerate_filtered(vendor_id, product_id,
+                                  serial_number ? HID_ENUMERATE_SERIAL_NUMBER : 0);
+    cur_dev = devs;
+    while (cur_dev) {
+        if (cur_dev->vendor_id == vendor_id &&
+                cur_dev->product_id == product_id) {
+            if (serial_number) {
+                if (cur_dev->serial_number &&
+                        wcscmp(serial_number, cur_dev->serial_number) == 0) {
+                    path_to_open = cur_dev->path;
+                    break;
+                }
+            }
+            else {
+                path_to_open = cur_dev->path;
+                break;
+            }
+        }
+        cur_dev = cur_dev->next;
+    }
+
+    if (path_to_open) {
+        /* Open the device */
+        handle = hid_open_path(path_to_open);
+    }
+
+    hid_free_enumeration(devs);
+
+    return handle;
+}
+
+int HID_API_EXPORT hid_set_event_mode(int mode) {
+    /* The kernel does the reading from the device. */
+    return (mode == HID_EVENTS_SHARED || mode == HID_EVENTS_PER_DEVICE) ? 0 : -1;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path) {
+    hid_device *dev;
+    struct hidraw_devinfo info;
+
+    hid_init();
+
+    dev = new_hid_device();
+
+    /* The descriptor is always non-blocking; blocking reads wait in
+       poll(), which is also how a timeout is put on them. */
+    dev->device_handle = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (dev->device_handle < 0) {
+        free_hid_device(dev);
+        return NULL;
+    }
+
+    /* Make sure it really is a hidraw device. */
+    if (ioctl(dev->device_handle, HIDIOCGRAWINFO, &info) < 0) {
+        close(dev->device_handle);
+        free_hid_device(dev);
+        return NULL;
+    }
+
+    dev->name = strdup(hidraw_name(path));
+    return dev;
+}
+
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length) {
+    ssize_t res;
+
+    /* hidraw takes the report ID as the first byte, 0x0 included, and
+       leaves it off what goes to a device without numbered reports. */
+    do {
+        res = write(dev->device_handle, data, length);
+    } while (res < 0 && errno == EINTR);
+
+    return (int) res;
+}
+
+int HID_API_EXPORT hid_write_async(hid_device *dev, const unsigned char *data, size_t length, hid_write_callback callback, void *user_data) {
+    return hid_write_batch(dev, data, length, 1, callback, user_data);
+}
+
+int HID_API_EXPORT hid_write_batch(hid_device *dev, const unsigned char *data, size_t report_length, size_t count, hid_write_callback callback, void *user_data) {
+    /* write() on hidraw waits for the interrupt transfer, so the reports
+       are simply written one after the other. */
+    int written = 0;
+    size_t i;
+
+    if (report_length == 0) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (hid_write(dev, data + i * report_length, report_length) < 0) {
+            break;
+        }
+        written++;
+    }
+    if (callback) {
+        callback(dev, user_data, written);
+    }
+    return 0;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds) {
+    for (;;) {
+        struct pollfd fds;
+        ssize_t bytes_read;
+        int ret;
+
+        bytes_read = read(dev->device_handle, data, length);
+        if (bytes_read >= 0) {
+            return (int) bytes_read;
+        }
+        if (errno != EAGAIN && errno != EINTR) {
+            /* e.g. ENODEV, when the device has been unplugged. */
+            return -1;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (milliseconds == 0) {
+            return 0;
+        }
+
+        fds.fd = dev->device_handle;
+        fds.events = POLLIN;
+        fds.revents = 0;
+        ret = poll(&fds, 1, milliseconds);
+        if (ret == 0) {
+            /* Timeout */
+            return 0;
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            return -1;
+        }
+        /* Something to read; if another thread gets to it first, the
+           read above finds nothing and we wait again. */
+    }
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length) {
+    return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock) {
+    dev->blocking = !nonblock;
+
+    return 0;
+}
+
+int HID_API_EXPORT hid_set_input_queue(hid_device *dev, int depth, int policy) {
+    /* The kernel keeps the queue: 64 reports per open descriptor,
+       dropping the newest when it's full. It can't be changed. */
+    (void) dev;
+    (void) depth;
+    (void) policy;
+
+    return -1;
+}
+
+unsigned long HID_API_EXPORT hid_get_dropped_input_reports(hid_device *dev) {
+    /* The kernel doesn't say how many it has dropped. */
+    (void) dev;
+
+    return 0;
+}
+
+int HID_API_EXPORT hid_set_input_transfers(hid_device *dev, int count) {
+    /* The kernel does the reading from the device. */
+    (void) dev;
+
+    return (count >= 1 && count <= 32) ? 0 : -1;
+}
+
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length) {
+    int res;
+
+    res = ioctl(dev->device_handle, HIDIOCSFEATURE(length), data);
+    if (res < 0) {
+        return -1;
+    }
+
+    return res;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length) {
+    int res;
+
+    res = ioctl(dev->device_handle, HIDIOCGFEATURE(length), data);
+    if (res < 0) {
+        return -1;
+    }
+
+    return res;
+}
+
+
+void HID_API_EXPORT hid_close(hid_device *dev) {
+    if (!dev) {
+        return;
+    }
+
+    close(dev->device_handle);
+    free_hid_device(dev);
+}
+
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    return get_device_string(dev, DEVICE_STRING_MANUFACTURER, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    return get_device_string(dev, DEVICE_STRING_PRODUCT, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    return get_device_string(dev, DEVICE_STRING_SERIAL, string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen) {
+    /* hidraw has no way to ask for a string descriptor by index. */
+    (void) dev;
+    (void) string_index;
+    (void) string;
+    (void) maxlen;
+
+    return -1;
+}
+
+
+HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev) {
+    (void) dev;
+
+    return NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
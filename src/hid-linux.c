@@ -40,6 +40,9 @@
 #include <sys/utsname.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <wchar.h>
 
 /* GNU / LibUSB */
@@ -66,11 +69,44 @@ Linux/libusb HIDAPI programs are encouraged to use the interface number
 instead to differentiate between interfaces on a composite HID device. */
 /*#define INVASIVE_GET_USAGE*/
 
-/* Linked List of input reports received from the device. */
-struct input_report {
-    uint8_t *data;
-    size_t len;
-    struct input_report *next;
+/* How many input reports are queued up for hid_read() by default, until
+   hid_set_input_queue() says otherwise. */
+#define DEFAULT_INPUT_QUEUE_DEPTH 32
+
+/* How many interrupt IN transfers are kept submitted by default, until
+   hid_set_input_transfers() says otherwise, and the most there can be. */
+#define DEFAULT_INPUT_TRANSFERS 4
+#define MAX_INPUT_TRANSFERS 32
+
+/* An interrupt IN transfer, and where it's up to. Transfers are handed out
+   sequence numbers as they are submitted, and their reports are queued in
+   that order, whatever order they complete in. */
+enum input_transfer_state {
+    TRANSFER_IDLE,       /* Not submitted (not yet, or retired) */
+    TRANSFER_SUBMITTED,  /* Waiting for the device */
+    TRANSFER_COMPLETED   /* Finished, but its report isn't queued yet */
+};
+
+struct input_transfer {
+    struct libusb_transfer *transfer;
+    struct hid_device_ *dev;
+    unsigned seq;
+    int state;
+};
+
+/* Fixed-size ring of input reports received from the device. It is filled
+   by read_callback() on the libusb event thread (the only producer), and
+   emptied by hid_read() with dev->mutex held (so there is only ever one
+   consumer at a time). Every slot is allocated up front, so nothing is
+   allocated or freed per report. head and tail are free-running counters;
+   report n lives in slot (n % depth). */
+struct input_ring {
+    uint8_t *data;       /* depth slots of slot_size bytes each */
+    size_t *lens;        /* The length of the report in each slot */
+    size_t slot_size;
+    unsigned depth;
+    unsigned head;       /* The next report to fill in (producer only) */
+    unsigned tail;       /* The next report to hand out */
 };
 
 
@@ -96,20 +132,224 @@ struct hid_device_ {
 
     /* Read thread objects */
     pthread_t thread;
-    pthread_mutex_t mutex; /* Protects input_reports */
+    pthread_mutex_t mutex; /* Serializes readers, and changes to the queue */
     pthread_cond_t condition;
     pthread_barrier_t barrier; /* Ensures correct startup sequence */
     int shutdown_thread;
-    struct libusb_transfer *transfer;
 
-    /* List of received input reports. */
-    struct input_report *input_reports;
+    /* The interrupt IN transfers. The first num_transfers are allocated,
+       and the first active_transfers of those are kept submitted. The
+       next one submitted gets sequence number submit_seq, and the report
+       of the one numbered deliver_seq is the next to be queued. */
+    struct input_transfer transfers[MAX_INPUT_TRANSFERS];
+    int num_transfers;
+    int active_transfers;
+    unsigned submit_seq;
+    unsigned deliver_seq;
+    int transfers_stopped;  /* Set once read_thread() is done with them */
+
+    /* OUT transfers submitted by hid_write_batch() and not yet completed. */
+    int writes_in_flight;
+
+    /* Whether the shared event thread handles this device's events, rather
+       than a read_thread() of its own. */
+    int shared_events;
+
+    /* Queue of received input reports, and what to do when it's full. */
+    struct input_ring *ring;
+    int queue_policy;
+    unsigned long dropped_reports;
+
+    /* Handshakes between the producer and everyone else. producing is set
+       while read_callback() is using the ring without the mutex; ring_frozen
+       is set while hid_set_input_queue() is replacing it; waiters counts the
+       readers asleep on the condition variable. */
+    int producing;
+    int ring_frozen;
+    int waiters;
 };
 
 static int initialized = 0;
 
 uint16_t get_usb_code_for_current_locale(void);
-static int return_data(hid_device *dev, unsigned char *data, size_t length);
+
+static struct input_ring *ring_new(unsigned depth, size_t slot_size) {
+    struct input_ring *ring = calloc(1, sizeof(struct input_ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->data = malloc(depth * slot_size);
+    ring->lens = calloc(depth, sizeof(size_t));
+    if (!ring->data || !ring->lens) {
+        free(ring->data);
+        free(ring->lens);
+        free(ring);
+        return NULL;
+    }
+    ring->slot_size = slot_size;
+    ring->depth = depth;
+    return ring;
+}
+
+static void ring_free(struct input_ring *ring) {
+    if (ring) {
+        free(ring->data);
+        free(ring->lens);
+        free(ring);
+    }
+}
+
+static unsigned ring_count(struct input_ring *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+           - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Adds a report to the ring; only ever called by one thread at a time. If
+   the ring is full, HID_QUEUE_DROP_OLDEST makes room by dropping the oldest
+   report (racing the consumer for it); the other policies leave the ring
+   alone. Returns 1 if the report was queued, 0 if not. */
+static int ring_push(hid_device *dev, struct input_ring *ring, int policy, const uint8_t *data, size_t len) {
+    const unsigned head = ring->head;
+    unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t slot;
+
+    while (head - tail >= ring->depth) {
+        if (policy != HID_QUEUE_DROP_OLDEST) {
+            return 0;
+        }
+        if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_add_fetch(&dev->dropped_reports, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        /* The consumer took one first; tail has been reloaded. */
+    }
+
+    if (len > ring->slot_size) {
+        len = ring->slot_size;
+    }
+    slot = head % ring->depth;
+    memcpy(ring->data + slot * ring->slot_size, data, len);
+    ring->lens[slot] = len;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Takes the oldest report off the ring, copying up to length bytes of it
+   into data. Returns the number of bytes copied, or -1 if the ring is
+   empty. */
+static int ring_pop(struct input_ring *ring, unsigned char *data, size_t length) {
+    for (;;) {
+        unsigned tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        const unsigned head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t slot, len;
+
+        if (tail == head) {
+            return -1;
+        }
+        slot = tail % ring->depth;
+        len = (length < ring->lens[slot]) ? length : ring->lens[slot];
+        if (len > 0) {
+            memcpy(data, ring->data + slot * ring->slot_size, len);
+        }
+        if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return (int)len;
+        }
+        /* The producer dropped this report (and may have reused its slot)
+           while we were copying it; move on to the next one. */
+    }
+}
+
+/* Submits a transfer again, unless the device is being closed or the
+   transfer has been retired by hid_set_input_transfers(). Called by whoever
+   is delivering reports (see deliver_reports()). */
+static void resubmit_transfer(hid_device *dev, struct input_transfer *it) {
+    if (dev->shutdown_thread || it - dev->transfers >= dev->active_transfers) {
+        it->state = TRANSFER_IDLE;
+        return;
+    }
+    it->seq = dev->submit_seq;
+    it->state = TRANSFER_SUBMITTED;
+    if (libusb_submit_transfer(it->transfer) == 0) {
+        dev->submit_seq++;
+    }
+    else {
+        it->state = TRANSFER_IDLE;
+    }
+}
+
+/* Queues the reports of completed transfers, in the order the transfers
+   were submitted, and resubmits them. Under HID_QUEUE_BLOCK, stops at the
+   first report there isn't room for, leaving it (and everything after it)
+   with its transfer until hid_read() makes room. Only one thread at a time
+   may deliver: read_callback() on its fast path, or anyone holding
+   dev->mutex while the fast path is out of use. Returns the number of
+   reports queued. */
+static int deliver_reports(hid_device *dev) {
+    int queued = 0;
+
+    for (;;) {
+        struct input_transfer *it = NULL;
+        struct libusb_transfer *transfer;
+        int i;
+
+        for (i = 0; i < dev->num_transfers; i++) {
+            if (dev->transfers[i].state == TRANSFER_COMPLETED
+                    && dev->transfers[i].seq == dev->deliver_seq) {
+                it = &dev->transfers[i];
+                break;
+            }
+        }
+        if (!it) {
+            /* Still waiting for the next one in line, if anything. */
+            break;
+        }
+
+        transfer = it->transfer;
+        if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+            if (dev->queue_policy == HID_QUEUE_BLOCK && ring_count(dev->ring) >= dev->ring->depth) {
+                break;
+            }
+            if (!ring_push(dev, dev->ring, dev->queue_policy, transfer->buffer, (size_t) transfer->actual_length)) {
+                __atomic_add_fetch(&dev->dropped_reports, 1, __ATOMIC_RELAXED);
+            }
+            queued++;
+        }
+        dev->deliver_seq++;
+        resubmit_transfer(dev, it);
+    }
+    return queued;
+}
+
+/* Sends read_callback() the slow way, which needs dev->mutex, and waits for
+   it to finish if it's in the middle of the fast path. After this, whoever
+   holds dev->mutex may use the producer's side of the queue. Called with
+   dev->mutex locked. */
+static void freeze_producer(hid_device *dev) {
+    __atomic_store_n(&dev->ring_frozen, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&dev->producing, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+}
+
+static void thaw_producer(hid_device *dev) {
+    __atomic_store_n(&dev->ring_frozen, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Takes the oldest input report off the queue. Called with dev->mutex
+   locked. Returns the number of bytes copied, or -1 if there's nothing
+   queued. */
+static int take_report(hid_device *dev, unsigned char *data, size_t length) {
+    const int res = ring_pop(dev->ring, data, length);
+
+    /* Under HID_QUEUE_BLOCK the producer always takes the mutex, so we
+       can deliver any reports that were waiting for room. */
+    if (res >= 0 && dev->queue_policy == HID_QUEUE_BLOCK && deliver_reports(dev) > 0) {
+        pthread_cond_broadcast(&dev->condition);
+    }
+    return res;
+}
 
 static hid_device *new_hid_device(void) {
     hid_device *dev = calloc(1, sizeof(hid_device));
@@ -123,8 +363,19 @@ static hid_device *new_hid_device(void) {
     dev->serial_index = 0;
     dev->blocking = 1;
     dev->shutdown_thread = 0;
-    dev->transfer = NULL;
-    dev->input_reports = NULL;
+    dev->num_transfers = 0;
+    dev->active_transfers = 0;
+    dev->submit_seq = 0;
+    dev->deliver_seq = 0;
+    dev->transfers_stopped = 0;
+    dev->writes_in_flight = 0;
+    dev->shared_events = 0;
+    dev->ring = NULL;
+    dev->queue_policy = HID_QUEUE_DROP_OLDEST;
+    dev->dropped_reports = 0;
+    dev->producing = 0;
+    dev->ring_frozen = 0;
+    dev->waiters = 0;
 
     pthread_mutex_init(&dev->mutex, NULL);
     pthread_cond_init(&dev->condition, NULL);
@@ -139,6 +390,9 @@ static void free_hid_device(hid_device *dev) {
     pthread_cond_destroy(&dev->condition);
     pthread_mutex_destroy(&dev->mutex);
 
+    /* Free the input report queue */
+    ring_free(dev->ring);
+
     /* Free the device itself */
     free(dev);
 }
@@ -387,6 +641,103 @@ static char *make_path(libusb_device *dev, int interface_number) {
     return strdup(str);
 }
 
+/* Picks the bus number, device address and interface number back out of
+   a path made by make_path(). */
+static int parse_path(const char *path, int *bus, int *address, int *interface_number) {
+    return (sscanf(path, "%x:%x:%x", bus, address, interface_number) == 3) ? 0 : -1;
+}
+
+/* The devices found by hid_enumerate(), by path, so that hid_open_path()
+   can go straight to the one it wants instead of listing every device on
+   the bus again. Each entry holds a reference to its libusb_device. An
+   entry is dropped if the device can't be opened through it (e.g.
+   because it has been unplugged since), and the whole index when the
+   library is shut down. */
+struct device_index_entry {
+    char *path;
+    libusb_device *usb_dev;
+    struct device_index_entry *next;
+};
+
+static struct device_index_entry *device_index = NULL;
+static pthread_mutex_t device_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void device_index_add(const char *path, libusb_device *usb_dev) {
+    struct device_index_entry *entry;
+
+    pthread_mutex_lock(&device_index_mutex);
+    for (entry = device_index; entry; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) {
+            break;
+        }
+    }
+    if (!entry) {
+        entry = calloc(1, sizeof(struct device_index_entry));
+        entry->path = strdup(path);
+        entry->next = device_index;
+        device_index = entry;
+    }
+    if (entry->usb_dev != usb_dev) {
+        /* New, or something else has turned up at the same address. */
+        if (entry->usb_dev) {
+            libusb_unref_device(entry->usb_dev);
+        }
+        entry->usb_dev = libusb_ref_device(usb_dev);
+    }
+    pthread_mutex_unlock(&device_index_mutex);
+}
+
+/* Returns the device at path, with a reference the caller must drop, or
+   NULL if it isn't in the index. */
+static libusb_device *device_index_find(const char *path) {
+    struct device_index_entry *entry;
+    libusb_device *usb_dev = NULL;
+
+    pthread_mutex_lock(&device_index_mutex);
+    for (entry = device_index; entry; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) {
+            usb_dev = libusb_ref_device(entry->usb_dev);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&device_index_mutex);
+
+    return usb_dev;
+}
+
+/* Drops the entry for path, unless it has been replaced by another device
+   since usb_dev was found there. */
+static void device_index_remove(const char *path, libusb_device *usb_dev) {
+    struct device_index_entry **link;
+
+    pthread_mutex_lock(&device_index_mutex);
+    for (link = &device_index; *link; link = &(*link)->next) {
+        struct device_index_entry *entry = *link;
+        if (strcmp(entry->path, path) == 0) {
+            if (entry->usb_dev == usb_dev) {
+                *link = entry->next;
+                libusb_unref_device(entry->usb_dev);
+                free(entry->path);
+                free(entry);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&device_index_mutex);
+}
+
+static void device_index_clear(void) {
+    pthread_mutex_lock(&device_index_mutex);
+    while (device_index) {
+        struct device_index_entry *entry = device_index;
+        device_index = entry->next;
+        libusb_unref_device(entry->usb_dev);
+        free(entry->path);
+        free(entry);
+    }
+    pthread_mutex_unlock(&device_index_mutex);
+}
+
 
 int HID_API_EXPORT hid_init(void) {
     if (!initialized) {
@@ -401,6 +752,7 @@ int HID_API_EXPORT hid_init(void) {
 
 int HID_API_EXPORT hid_exit(void) {
     if (initialized) {
+        device_index_clear();
         libusb_exit(NULL);
         initialized = 0;
     }
@@ -409,6 +761,10 @@ int HID_API_EXPORT hid_exit(void) {
 }
 
 struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id) {
+    return hid_enumerate_filtered(vendor_id, product_id, HID_ENUMERATE_STRINGS);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(unsigned short vendor_id, unsigned short product_id, int flags) {
     libusb_device **devs;
     libusb_device *dev;
     libusb_device_handle *handle;
@@ -443,6 +799,13 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
             continue;
         }
 
+        /* Check the VID/PID against the arguments before reading
+           anything more from the device. */
+        if (!(vendor_id == 0x0 && product_id == 0x0) &&
+                !(vendor_id == dev_vid && product_id == dev_pid)) {
+            continue;
+        }
+
         res = libusb_get_active_config_descriptor(dev, &conf_desc);
         if (res < 0) {
             libusb_get_config_descriptor(dev, 0, &conf_desc);
@@ -454,120 +817,129 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
                     const struct libusb_interface_descriptor *intf_desc;
                     intf_desc = &intf->altsetting[k];
                     if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
+                        struct hid_device_info *tmp;
+
                         interface_num = intf_desc->bInterfaceNumber;
 
-                        /* Check the VID/PID against the arguments */
-                        if ((vendor_id == 0x0 && product_id == 0x0) ||
-                                (vendor_id == dev_vid && product_id == dev_pid)) {
-                            struct hid_device_info *tmp;
+                        /* VID/PID match. Create the record. */
+                        tmp = calloc(1, sizeof(struct hid_device_info));
+                        if (cur_dev) {
+                            cur_dev->next = tmp;
+                        }
+                        else {
+                            root = tmp;
+                        }
+                        cur_dev = tmp;
 
-                            /* VID/PID match. Create the record. */
-                            tmp = calloc(1, sizeof(struct hid_device_info));
-                            if (cur_dev) {
-                                cur_dev->next = tmp;
-                            }
-                            else {
-                                root = tmp;
-                            }
-                            cur_dev = tmp;
+                        /* Fill out the record */
+                        cur_dev->next = NULL;
+                        cur_dev->path = make_path(dev, interface_num);
 
-                            /* Fill out the record */
-                            cur_dev->next = NULL;
-                            cur_dev->path = make_path(dev, interface_num);
+                        /* Remember where it is, for hid_open_path(). */
+                        device_index_add(cur_dev->path, dev);
 
+                        /* Reading the strings means opening the device
+                           and asking it for each one, so only do it if
+                           it has any that are wanted. */
+                        if (((flags & HID_ENUMERATE_SERIAL_NUMBER) && desc.iSerialNumber > 0) ||
+                                ((flags & HID_ENUMERATE_NAMES) && (desc.iManufacturer > 0 || desc.iProduct > 0))) {
                             res = libusb_open(dev, &handle);
+                        }
+                        else {
+                            res = -1;
+                        }
 
-                            if (res >= 0) {
-                                /* Serial Number */
-                                if (desc.iSerialNumber > 0)
-                                    cur_dev->serial_number =
-                                        get_usb_string(handle, desc.iSerialNumber);
-
-                                /* Manufacturer and Product strings */
-                                if (desc.iManufacturer > 0)
-                                    cur_dev->manufacturer_string =
-                                        get_usb_string(handle, desc.iManufacturer);
-                                if (desc.iProduct > 0)
-                                    cur_dev->product_string =
-                                        get_usb_string(handle, desc.iProduct);
+                        if (res >= 0) {
+                            /* Serial Number */
+                            if ((flags & HID_ENUMERATE_SERIAL_NUMBER) && desc.iSerialNumber > 0)
+                                cur_dev->serial_number =
+                                    get_usb_string(handle, desc.iSerialNumber);
+
+                            /* Manufacturer and Product strings */
+                            if ((flags & HID_ENUMERATE_NAMES) && desc.iManufacturer > 0)
+                                cur_dev->manufacturer_string =
+                                    get_usb_string(handle, desc.iManufacturer);
+                            if ((flags & HID_ENUMERATE_NAMES) && desc.iProduct > 0)
+                                cur_dev->product_string =
+                                    get_usb_string(handle, desc.iProduct);
 
 #ifdef INVASIVE_GET_USAGE
-                                /*
-                                This section is removed because it is too
-                                invasive on the system. Getting a Usage Page
-                                and Usage requires parsing the HID Report
-                                descriptor. Getting a HID Report descriptor
-                                involves claiming the interface. Claiming the
-                                interface involves detaching the kernel driver.
-                                Detaching the kernel driver is hard on the system
-                                because it will unclaim interfaces (if another
-                                app has them claimed) and the re-attachment of
-                                the driver will sometimes change /dev entry names.
-                                It is for these reasons that this section is
-                                #if 0. For composite devices, use the interface
-                                field in the hid_device_info struct to distinguish
-                                between interfaces. */
-                                int detached = 0;
-                                unsigned char data[256];
-
-                                /* Usage Page and Usage */
-                                res = libusb_kernel_driver_active(handle, interface_num);
-                                if (res == 1) {
-                                    res = libusb_detach_kernel_driver(handle, interface_num);
-                                    if (res < 0) {
-                                        LOG("Couldn't detach kernel driver, even though a kernel driver was attached.");
-                                    }
-                                    else {
-                                        detached = 1;
-                                    }
+                            /*
+                            This section is removed because it is too
+                            invasive on the system. Getting a Usage Page
+                            and Usage requires parsing the HID Report
+                            descriptor. Getting a HID Report descriptor
+                            involves claiming the interface. Claiming the
+                            interface involves detaching the kernel driver.
+                            Detaching the kernel driver is hard on the system
+                            because it will unclaim interfaces (if another
+                            app has them claimed) and the re-attachment of
+                            the driver will sometimes change /dev entry names.
+                            It is for these reasons that this section is
+                            #if 0. For composite devices, use the interface
+                            field in the hid_device_info struct to distinguish
+                            between interfaces. */
+                            int detached = 0;
+                            unsigned char data[256];
+
+                            /* Usage Page and Usage */
+                            res = libusb_kernel_driver_active(handle, interface_num);
+                            if (res == 1) {
+                                res = libusb_detach_kernel_driver(handle, interface_num);
+                                if (res < 0) {
+                                    LOG("Couldn't detach kernel driver, even though a kernel driver was attached.");
+                                }
+                                else {
+                                    detached = 1;
                                 }
-                                res = libusb_claim_interface(handle, interface_num);
+                            }
+                            res = libusb_claim_interface(handle, interface_num);
+                            if (res >= 0) {
+                                /* Get the HID Report Descriptor. */
+                                res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN | LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_REPORT << 8) | interface_num, 0, data, sizeof(data), 5000);
                                 if (res >= 0) {
-                                    /* Get the HID Report Descriptor. */
-                                    res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN | LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_REPORT << 8) | interface_num, 0, data, sizeof(data), 5000);
-                                    if (res >= 0) {
-                                        unsigned short page = 0, usage = 0;
-                                        /* Parse the usage and usage page
-                                           out of the report descriptor. */
-                                        get_usage(data, res,  &page, &usage);
-                                        cur_dev->usage_page = page;
-                                        cur_dev->usage = usage;
-                                    }
-                                    else {
-                                        LOG("libusb_control_transfer() for getting the HID report failed with %d\n", res);
-                                    }
-
-                                    /* Release the interface */
-                                    res = libusb_release_interface(handle, interface_num);
-                                    if (res < 0) {
-                                        LOG("Can't release the interface.\n");
-                                    }
+                                    unsigned short page = 0, usage = 0;
+                                    /* Parse the usage and usage page
+                                       out of the report descriptor. */
+                                    get_usage(data, res,  &page, &usage);
+                                    cur_dev->usage_page = page;
+                                    cur_dev->usage = usage;
                                 }
                                 else {
-                                    LOG("Can't claim interface %d\n", res);
+                                    LOG("libusb_control_transfer() for getting the HID report failed with %d\n", res);
                                 }
 
-                                /* Re-attach kernel driver if necessary. */
-                                if (detached) {
-                                    res = libusb_attach_kernel_driver(handle, interface_num);
-                                    if (res < 0) {
-                                        LOG("Couldn't re-attach kernel driver.\n");
-                                    }
+                                /* Release the interface */
+                                res = libusb_release_interface(handle, interface_num);
+                                if (res < 0) {
+                                    LOG("Can't release the interface.\n");
                                 }
-#endif /*******************/
-
-                                libusb_close(handle);
                             }
-                            /* VID/PID */
-                            cur_dev->vendor_id = dev_vid;
-                            cur_dev->product_id = dev_pid;
+                            else {
+                                LOG("Can't claim interface %d\n", res);
+                            }
 
-                            /* Release Number */
-                            cur_dev->release_number = desc.bcdDevice;
+                            /* Re-attach kernel driver if necessary. */
+                            if (detached) {
+                                res = libusb_attach_kernel_driver(handle, interface_num);
+                                if (res < 0) {
+                                    LOG("Couldn't re-attach kernel driver.\n");
+                                }
+                            }
+#endif /*******************/
 
-                            /* Interface Number */
-                            cur_dev->interface_number = interface_num;
+                            libusb_close(handle);
                         }
+                        /* VID/PID */
+                        cur_dev->vendor_id = dev_vid;
+                        cur_dev->product_id = dev_pid;
+
+                        /* Release Number */
+                        cur_dev->release_number = desc.bcdDevice;
+
+                        /* Interface Number */
+                        cur_dev->interface_number = interface_num;
+
                     }
                 } /* altsettings */
             } /* interfaces */
@@ -598,13 +970,17 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, wchar
     const char *path_to_open = NULL;
     hid_device *handle = NULL;
 
-    devs = hid_enumerate(vendor_id, product_id);
+    /* Only the serial number is needed, and only if there is one to
+       look for. */
+    devs = hid_enumerate_filtered(vendor_id, product_id,
+                                  serial_number ? HID_ENUMERATE_SERIAL_NUMBER : 0);
     cur_dev = devs;
     while (cur_dev) {
         if (cur_dev->vendor_id == vendor_id &&
                 cur_dev->product_id == product_id) {
             if (serial_number) {
-                if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
+                if (cur_dev->serial_number &&
+                        wcscmp(serial_number, cur_dev->serial_number) == 0) {
                     path_to_open = cur_dev->path;
                     break;
                 }
@@ -628,83 +1004,141 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, wchar
 }
 
 static void read_callback(struct libusb_transfer *transfer) {
-    hid_device *dev = transfer->user_data;
-
-    if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
-
-        struct input_report *rpt = malloc(sizeof(*rpt));
-        rpt->data = malloc(transfer->actual_length);
-        memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-        rpt->len = transfer->actual_length;
-        rpt->next = NULL;
-
+    struct input_transfer *it = transfer->user_data;
+    hid_device *dev = it->dev;
+    int queued;
+
+    if (transfer->status == LIBUSB_TRANSFER_CANCELLED
+            || transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+        /* Wake hid_close() (which may be waiting for the transfers to
+           finish), and any readers, which should give up now. */
         pthread_mutex_lock(&dev->mutex);
-
-        /* Attach the new report object to the end of the list. */
-        if (dev->input_reports == NULL) {
-            /* The list is empty. Put it at the root. */
-            dev->input_reports = rpt;
-            pthread_cond_signal(&dev->condition);
-        }
-        else {
-            /* Find the end of the list and attach. */
-            struct input_report *cur = dev->input_reports;
-            int num_queued = 0;
-            while (cur->next != NULL) {
-                cur = cur->next;
-                num_queued++;
-            }
-            cur->next = rpt;
-
-            /* Pop one off if we've reached 30 in the queue. This
-               way we don't grow forever if the user never reads
-               anything from the device. */
-            if (num_queued > 30) {
-                return_data(dev, NULL, 0);
-            }
-        }
-        pthread_mutex_unlock(&dev->mutex);
-    }
-    else if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
-        dev->shutdown_thread = 1;
-        return;
-    }
-    else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
         dev->shutdown_thread = 1;
+        it->state = TRANSFER_IDLE;
+        pthread_cond_broadcast(&dev->condition);
+        pthread_mutex_unlock(&dev->mutex);
         return;
     }
     else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
         //LOG("Timeout (normal)\n");
     }
-    else {
+    else if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
         LOG("Unknown transfer code: %d\n", transfer->status);
     }
 
-    /* Re-submit the transfer object. */
-    libusb_submit_transfer(transfer);
-}
-
+    /* The fast path doesn't take the mutex: it only touches the producer's
+       side of the queue. It's not available while someone else is using
+       that side (see freeze_producer()), or under HID_QUEUE_BLOCK, where
+       hid_read() delivers the reports that were waiting for room. */
+    __atomic_store_n(&dev->producing, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&dev->ring_frozen, __ATOMIC_SEQ_CST)
+            || dev->queue_policy == HID_QUEUE_BLOCK) {
+        __atomic_store_n(&dev->producing, 0, __ATOMIC_SEQ_CST);
 
-static void *read_thread(void *param) {
-    hid_device *dev = param;
-    unsigned char *buf;
-    const size_t length = dev->input_ep_max_packet_size;
+        pthread_mutex_lock(&dev->mutex);
+        it->state = TRANSFER_COMPLETED;
+        if (deliver_reports(dev) > 0) {
+            pthread_cond_broadcast(&dev->condition);
+        }
+        pthread_mutex_unlock(&dev->mutex);
+    }
+    else {
+        it->state = TRANSFER_COMPLETED;
+        queued = deliver_reports(dev);
+        __atomic_store_n(&dev->producing, 0, __ATOMIC_SEQ_CST);
+
+        /* Only wake readers up if there are any asleep. The fence pairs
+           with the one in add_waiter(): either the reader sees the new
+           report, or we see the reader. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (queued > 0 && __atomic_load_n(&dev->waiters, __ATOMIC_SEQ_CST) > 0) {
+            pthread_mutex_lock(&dev->mutex);
+            pthread_cond_broadcast(&dev->condition);
+            pthread_mutex_unlock(&dev->mutex);
+        }
+    }
+}
 
-    /* Set up the transfer object. */
-    buf = malloc(length);
-    dev->transfer = libusb_alloc_transfer(0);
-    libusb_fill_interrupt_transfer(dev->transfer,
+/* Allocates the next interrupt IN transfer (but doesn't submit it).
+   Returns 0 on success, -1 on failure. */
+static int add_input_transfer(hid_device *dev) {
+    struct input_transfer *it = &dev->transfers[dev->num_transfers];
+    const int length = dev->input_ep_max_packet_size;
+    unsigned char *buf = malloc((size_t) length);
+
+    it->transfer = libusb_alloc_transfer(0);
+    if (!buf || !it->transfer) {
+        free(buf);
+        libusb_free_transfer(it->transfer);
+        it->transfer = NULL;
+        return -1;
+    }
+    it->dev = dev;
+    it->seq = 0;
+    it->state = TRANSFER_IDLE;
+    libusb_fill_interrupt_transfer(it->transfer,
                                    dev->device_handle,
-                                   dev->input_endpoint,
+                                   (unsigned char) dev->input_endpoint,
                                    buf,
                                    length,
                                    read_callback,
-                                   dev,
+                                   it,
                                    5000/*timeout*/);
+    dev->num_transfers++;
+    return 0;
+}
+
+/* Whether any transfer (IN or OUT) is still submitted. Called with
+   dev->mutex locked. */
+static int transfers_busy(hid_device *dev) {
+    int i;
+
+    if (dev->writes_in_flight > 0) {
+        return 1;
+    }
+    for (i = 0; i < dev->num_transfers; i++) {
+        if (dev->transfers[i].state == TRANSFER_SUBMITTED) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Whether any transfer is still submitted. Once there are none, marks the
+   transfers as stopped, so hid_close() and hid_write_batch() won't submit
+   any more. */
+static int transfers_submitted(hid_device *dev) {
+    int submitted;
+
+    pthread_mutex_lock(&dev->mutex);
+    submitted = transfers_busy(dev);
+    if (!submitted) {
+        dev->transfers_stopped = 1;
+    }
+    pthread_mutex_unlock(&dev->mutex);
+    return submitted;
+}
+
+/* Sets up the transfer objects, and makes the first submissions. Further
+   submissions are made from inside read_callback(), so there are always
+   several transfers waiting for the device, and reports keep coming in while
+   the last one is being dealt with. */
+static void start_input(hid_device *dev) {
+    int i;
 
-    /* Make the first submission. Further submissions are made
-       from inside read_callback() */
-    libusb_submit_transfer(dev->transfer);
+    while (dev->num_transfers < DEFAULT_INPUT_TRANSFERS && add_input_transfer(dev) == 0) {
+    }
+    dev->active_transfers = dev->num_transfers;
+    for (i = 0; i < dev->num_transfers; i++) {
+        resubmit_transfer(dev, &dev->transfers[i]);
+    }
+}
+
+static void *read_thread(void *param) {
+    hid_device *dev = param;
+    int i;
+
+    start_input(dev);
 
     // Notify the main thread that the read thread is up and running.
     pthread_barrier_wait(&dev->barrier);
@@ -719,11 +1153,19 @@ static void *read_thread(void *param) {
         }
     }
 
-    /* Cancel any transfer that may be pending. This call will fail
-       if no transfers are pending, but that's OK. */
-    if (libusb_cancel_transfer(dev->transfer) == 0) {
-        /* The transfer was cancelled, so wait for its completion. */
-        libusb_handle_events(NULL);
+    /* Cancel any transfers that may be pending, and wait for them to
+       complete. */
+    pthread_mutex_lock(&dev->mutex);
+    for (i = 0; i < dev->num_transfers; i++) {
+        if (dev->transfers[i].state == TRANSFER_SUBMITTED) {
+            libusb_cancel_transfer(dev->transfers[i].transfer);
+        }
+    }
+    pthread_mutex_unlock(&dev->mutex);
+    while (transfers_submitted(dev)) {
+        if (libusb_handle_events(NULL) < 0) {
+            break;
+        }
     }
 
     /* Now that the read thread is stopping, Wake any threads which are
@@ -735,27 +1177,300 @@ static void *read_thread(void *param) {
     pthread_cond_broadcast(&dev->condition);
     pthread_mutex_unlock(&dev->mutex);
 
-    /* The dev->transfer->buffer and dev->transfer objects are cleaned up
-       in hid_close(). They are not cleaned up here because this thread
-       could end either due to a disconnect or due to a user
-       call to hid_close(). In both cases the objects can be safely
-       cleaned up after the call to pthread_join() (in hid_close()), but
-       since hid_close() calls libusb_cancel_transfer(), on these objects,
-       they can not be cleaned up here. */
+    /* The transfers and their buffers are cleaned up in hid_close().
+       They are not cleaned up here because this thread could end either
+       due to a disconnect or due to a user call to hid_close(). In both
+       cases the objects can be safely cleaned up after the call to
+       pthread_join() (in hid_close()), but since hid_close() calls
+       libusb_cancel_transfer(), on these objects, they can not be cleaned
+       up here. */
+
+    return NULL;
+}
+
+
+/* The shared event thread, which handles the USB events for every device
+   opened in HID_EVENTS_SHARED mode. It waits (with epoll) on libusb's file
+   descriptors, which libusb tells us about as they come and go, so a device
+   costs a few transfers and a file descriptor, rather than a thread of its
+   own. It is started by the first device to need it, and stopped when the
+   last one is closed. */
+static struct {
+    pthread_mutex_t mutex;  /* Guards users, and starting and stopping */
+    int users;              /* Devices relying on the thread */
+    int stop;
+    int epoll_fd;
+    int wake_fds[2];        /* A pipe, for waking the thread up */
+    pthread_t thread;
+} event_loop = { PTHREAD_MUTEX_INITIALIZER, 0, 0, -1, { -1, -1 }, 0 };
+
+/* The mode devices are opened in (see hid_set_event_mode()). */
+static int event_mode = HID_EVENTS_SHARED;
+
+static void event_fd_added(int fd, short events, void *user_data) {
+    struct epoll_event ev;
+    (void)user_data;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((events & POLLIN) ? EPOLLIN : 0) | ((events & POLLOUT) ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void event_fd_removed(int fd, void *user_data) {
+    (void)user_data;
+    epoll_ctl(event_loop.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void *event_thread(void *param) {
+    (void)param;
 
+    while (!__atomic_load_n(&event_loop.stop, __ATOMIC_ACQUIRE)) {
+        struct epoll_event events[16];
+        struct timeval tv, zero = { 0, 0 };
+        int timeout = -1, n, i;
+
+        /* Wait until one of libusb's descriptors is ready, or the next of
+           its timeouts is due (unless it's handling those with a
+           descriptor of its own). */
+        if (libusb_get_next_timeout(NULL, &tv) == 1) {
+            timeout = (int)(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+        }
+        n = epoll_wait(event_loop.epoll_fd, events, 16, timeout);
+        if (n < 0 && errno != EINTR) {
+            LOG("epoll_wait failed: %d\n", errno);
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (events[i].data.fd == event_loop.wake_fds[0]) {
+                char buf[16];
+                while (read(event_loop.wake_fds[0], buf, sizeof(buf)) > 0) {
+                }
+            }
+        }
+
+        /* Deal with whatever is ready, without waiting for anything more. */
+        libusb_handle_events_timeout(NULL, &zero);
+    }
     return NULL;
 }
 
+/* Makes sure the shared event thread is running, for a device about to use
+   it. Returns 0 on success, -1 on failure. */
+static int event_loop_acquire(void) {
+    const struct libusb_pollfd **fds;
+    int i, res = 0;
+
+    pthread_mutex_lock(&event_loop.mutex);
+    if (event_loop.users++ > 0) {
+        pthread_mutex_unlock(&event_loop.mutex);
+        return 0;
+    }
+
+    event_loop.stop = 0;
+    event_loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (event_loop.epoll_fd < 0 || pipe(event_loop.wake_fds) < 0) {
+        res = -1;
+    }
+    else {
+        fcntl(event_loop.wake_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(event_loop.wake_fds[1], F_SETFL, O_NONBLOCK);
+        event_fd_added(event_loop.wake_fds[0], POLLIN, NULL);
+
+        /* Watch libusb's descriptors, now and as they change. */
+        libusb_set_pollfd_notifiers(NULL, event_fd_added, event_fd_removed, NULL);
+        fds = libusb_get_pollfds(NULL);
+        for (i = 0; fds && fds[i]; i++) {
+            event_fd_added(fds[i]->fd, fds[i]->events, NULL);
+        }
+        libusb_free_pollfds(fds);
+
+        if (pthread_create(&event_loop.thread, NULL, event_thread, NULL) != 0) {
+            libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
+            res = -1;
+        }
+    }
+
+    if (res < 0) {
+        if (event_loop.epoll_fd >= 0) {
+            close(event_loop.epoll_fd);
+        }
+        if (event_loop.wake_fds[0] >= 0) {
+            close(event_loop.wake_fds[0]);
+            close(event_loop.wake_fds[1]);
+        }
+        event_loop.epoll_fd = -1;
+        event_loop.wake_fds[0] = event_loop.wake_fds[1] = -1;
+        event_loop.users = 0;
+    }
+    pthread_mutex_unlock(&event_loop.mutex);
+    return res;
+}
+
+/* Lets go of the shared event thread, stopping it if nothing else needs it.
+   The device must have finished with its transfers. */
+static void event_loop_release(void) {
+    pthread_mutex_lock(&event_loop.mutex);
+    if (--event_loop.users == 0) {
+        __atomic_store_n(&event_loop.stop, 1, __ATOMIC_RELEASE);
+        if (write(event_loop.wake_fds[1], "x", 1) < 0) {
+            LOG("can't wake the event thread\n");
+        }
+        pthread_join(event_loop.thread, NULL);
+
+        libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
+        close(event_loop.epoll_fd);
+        close(event_loop.wake_fds[0]);
+        close(event_loop.wake_fds[1]);
+        event_loop.epoll_fd = -1;
+        event_loop.wake_fds[0] = event_loop.wake_fds[1] = -1;
+    }
+    pthread_mutex_unlock(&event_loop.mutex);
+}
+
+int HID_API_EXPORT hid_set_event_mode(int mode) {
+    if (mode != HID_EVENTS_SHARED && mode != HID_EVENTS_PER_DEVICE) {
+        return -1;
+    }
+    event_mode = mode;
+    return 0;
+}
+
+/* Opens the HID interface numbered interface_number on usb_dev as dev:
+   claims it, finds its endpoints and starts reading from it. Returns 0
+   on success, or -1 if there's no such interface or it can't be opened,
+   leaving the device closed. */
+static int open_usb_interface(hid_device *dev, libusb_device *usb_dev, int interface_number) {
+    struct libusb_device_descriptor desc;
+    struct libusb_config_descriptor *conf_desc = NULL;
+    const struct libusb_interface_descriptor *intf_desc = NULL;
+    int i, j, k;
+    int res;
+
+    libusb_get_device_descriptor(usb_dev, &desc);
+
+    if (libusb_get_active_config_descriptor(usb_dev, &conf_desc) < 0) {
+        return -1;
+    }
+    for (j = 0; j < conf_desc->bNumInterfaces && !intf_desc; j++) {
+        const struct libusb_interface *intf = &conf_desc->interface[j];
+        for (k = 0; k < intf->num_altsetting; k++) {
+            if (intf->altsetting[k].bInterfaceClass == LIBUSB_CLASS_HID &&
+                    intf->altsetting[k].bInterfaceNumber == interface_number) {
+                intf_desc = &intf->altsetting[k];
+                break;
+            }
+        }
+    }
+    if (!intf_desc) {
+        libusb_free_config_descriptor(conf_desc);
+        return -1;
+    }
+
+    res = libusb_open(usb_dev, &dev->device_handle);
+    if (res < 0) {
+        LOG("can't open device\n");
+        libusb_free_config_descriptor(conf_desc);
+        return -1;
+    }
+
+    /* Detach the kernel driver, but only if the
+       device is managed by the kernel */
+    if (libusb_kernel_driver_active(dev->device_handle, intf_desc->bInterfaceNumber) == 1) {
+        res = libusb_detach_kernel_driver(dev->device_handle, intf_desc->bInterfaceNumber);
+        if (res < 0) {
+            libusb_close(dev->device_handle);
+            LOG("Unable to detach Kernel Driver\n");
+            libusb_free_config_descriptor(conf_desc);
+            return -1;
+        }
+    }
+
+    res = libusb_claim_interface(dev->device_handle, intf_desc->bInterfaceNumber);
+    if (res < 0) {
+        LOG("can't claim interface %d: %d\n", intf_desc->bInterfaceNumber, res);
+        libusb_close(dev->device_handle);
+        libusb_free_config_descriptor(conf_desc);
+        return -1;
+    }
+
+    /* Store off the string descriptor indexes */
+    dev->manufacturer_index = desc.iManufacturer;
+    dev->product_index      = desc.iProduct;
+    dev->serial_index       = desc.iSerialNumber;
+
+    /* Store off the interface number */
+    dev->interface = intf_desc->bInterfaceNumber;
+
+    /* Find the INPUT and OUTPUT endpoints. An
+       OUTPUT endpoint is not required. */
+    dev->input_endpoint = 0;
+    dev->output_endpoint = 0;
+    for (i = 0; i < intf_desc->bNumEndpoints; i++) {
+        const struct libusb_endpoint_descriptor *ep
+                    = &intf_desc->endpoint[i];
+
+        /* Determine the type and direction of this
+           endpoint. */
+        int is_interrupt =
+            (ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+            == LIBUSB_TRANSFER_TYPE_INTERRUPT;
+        int is_output =
+            (ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+            == LIBUSB_ENDPOINT_OUT;
+        int is_input =
+            (ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+            == LIBUSB_ENDPOINT_IN;
+
+        /* Decide whether to use it for intput or output. */
+        if (dev->input_endpoint == 0 &&
+                is_interrupt && is_input) {
+            /* Use this endpoint for INPUT */
+            dev->input_endpoint = ep->bEndpointAddress;
+            dev->input_ep_max_packet_size = ep->wMaxPacketSize;
+        }
+        if (dev->output_endpoint == 0 &&
+                is_interrupt && is_output) {
+            /* Use this endpoint for OUTPUT */
+            dev->output_endpoint = ep->bEndpointAddress;
+        }
+    }
+    libusb_free_config_descriptor(conf_desc);
+
+    /* Set up the input report queue, with room
+       for a whole packet in each slot. */
+    dev->ring = ring_new(DEFAULT_INPUT_QUEUE_DEPTH, (size_t) dev->input_ep_max_packet_size);
+    if (!dev->ring) {
+        LOG("can't allocate the input report queue\n");
+        libusb_release_interface(dev->device_handle, dev->interface);
+        libusb_close(dev->device_handle);
+        return -1;
+    }
+
+    /* Have the shared event thread look after the
+       device, or else start a thread of its own. */
+    dev->shared_events = event_mode == HID_EVENTS_SHARED
+                         && event_loop_acquire() == 0;
+    if (dev->shared_events) {
+        start_input(dev);
+    }
+    else {
+        pthread_create(&dev->thread, NULL, read_thread, dev);
+
+        // Wait here for the read thread to be initialized.
+        pthread_barrier_wait(&dev->barrier);
+    }
+
+    return 0;
+}
 
 hid_device * HID_API_EXPORT hid_open_path(const char *path) {
     hid_device *dev = NULL;
 
-    dev = new_hid_device();
-
     libusb_device **devs;
     libusb_device *usb_dev;
     ssize_t num_devs;
-    int res;
+    int bus, address, interface_number;
     int d = 0;
     int good_open = 0;
 
@@ -765,113 +1480,40 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path) {
         hid_init();
     }
 
-    num_devs = libusb_get_device_list(NULL, &devs);
-    while ((usb_dev = devs[d++]) != NULL) {
-        struct libusb_device_descriptor desc;
-        struct libusb_config_descriptor *conf_desc = NULL;
-        int i, j, k;
-        libusb_get_device_descriptor(usb_dev, &desc);
-
-        if (libusb_get_active_config_descriptor(usb_dev, &conf_desc) < 0) {
-            continue;
-        }
-        for (j = 0; j < conf_desc->bNumInterfaces; j++) {
-            const struct libusb_interface *intf = &conf_desc->interface[j];
-            for (k = 0; k < intf->num_altsetting; k++) {
-                const struct libusb_interface_descriptor *intf_desc;
-                intf_desc = &intf->altsetting[k];
-                if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
-                    char *dev_path = make_path(usb_dev, intf_desc->bInterfaceNumber);
-                    if (!strcmp(dev_path, path)) {
-                        /* Matched Paths. Open this device */
-
-                        // OPEN HERE //
-                        res = libusb_open(usb_dev, &dev->device_handle);
-                        if (res < 0) {
-                            LOG("can't open device\n");
-                            free(dev_path);
-                            break;
-                        }
-                        good_open = 1;
-
-                        /* Detach the kernel driver, but only if the
-                           device is managed by the kernel */
-                        if (libusb_kernel_driver_active(dev->device_handle, intf_desc->bInterfaceNumber) == 1) {
-                            res = libusb_detach_kernel_driver(dev->device_handle, intf_desc->bInterfaceNumber);
-                            if (res < 0) {
-                                libusb_close(dev->device_handle);
-                                LOG("Unable to detach Kernel Driver\n");
-                                free(dev_path);
-                                good_open = 0;
-                                break;
-                            }
-                        }
-
-                        res = libusb_claim_interface(dev->device_handle, intf_desc->bInterfaceNumber);
-                        if (res < 0) {
-                            LOG("can't claim interface %d: %d\n", intf_desc->bInterfaceNumber, res);
-                            free(dev_path);
-                            libusb_close(dev->device_handle);
-                            good_open = 0;
-                            break;
-                        }
-
-                        /* Store off the string descriptor indexes */
-                        dev->manufacturer_index = desc.iManufacturer;
-                        dev->product_index      = desc.iProduct;
-                        dev->serial_index       = desc.iSerialNumber;
-
-                        /* Store off the interface number */
-                        dev->interface = intf_desc->bInterfaceNumber;
-
-                        /* Find the INPUT and OUTPUT endpoints. An
-                           OUTPUT endpoint is not required. */
-                        for (i = 0; i < intf_desc->bNumEndpoints; i++) {
-                            const struct libusb_endpoint_descriptor *ep
-                                        = &intf_desc->endpoint[i];
-
-                            /* Determine the type and direction of this
-                               endpoint. */
-                            int is_interrupt =
-                                (ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
-                                == LIBUSB_TRANSFER_TYPE_INTERRUPT;
-                            int is_output =
-                                (ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
-                                == LIBUSB_ENDPOINT_OUT;
-                            int is_input =
-                                (ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
-                                == LIBUSB_ENDPOINT_IN;
-
-                            /* Decide whether to use it for intput or output. */
-                            if (dev->input_endpoint == 0 &&
-                                    is_interrupt && is_input) {
-                                /* Use this endpoint for INPUT */
-                                dev->input_endpoint = ep->bEndpointAddress;
-                                dev->input_ep_max_packet_size = ep->wMaxPacketSize;
-                            }
-                            if (dev->output_endpoint == 0 &&
-                                    is_interrupt && is_output) {
-                                /* Use this endpoint for OUTPUT */
-                                dev->output_endpoint = ep->bEndpointAddress;
-                            }
-                        }
+    if (parse_path(path, &bus, &address, &interface_number) < 0) {
+        return NULL;
+    }
 
-                        pthread_create(&dev->thread, NULL, read_thread, dev);
+    dev = new_hid_device();
 
-                        // Wait here for the read thread to be initialized.
-                        pthread_barrier_wait(&dev->barrier);
+    /* If it was found by hid_enumerate(), go straight to it. */
+    usb_dev = device_index_find(path);
+    if (usb_dev) {
+        good_open = open_usb_interface(dev, usb_dev, interface_number) == 0;
+        if (!good_open) {
+            device_index_remove(path, usb_dev);
+        }
+        libusb_unref_device(usb_dev);
+    }
 
+    /* Otherwise look for it, by its bus number and address. */
+    if (!good_open) {
+        num_devs = libusb_get_device_list(NULL, &devs);
+        if (num_devs >= 0) {
+            while ((usb_dev = devs[d++]) != NULL) {
+                if (libusb_get_bus_number(usb_dev) == bus &&
+                        libusb_get_device_address(usb_dev) == address) {
+                    good_open = open_usb_interface(dev, usb_dev, interface_number) == 0;
+                    if (good_open) {
+                        device_index_add(path, usb_dev);
                     }
-                    free(dev_path);
+                    break;
                 }
             }
+            libusb_free_device_list(devs, 1);
         }
-        libusb_free_config_descriptor(conf_desc);
-
     }
 
-    libusb_free_device_list(devs, 1);
-
     // If we have a good handle, return it.
     if (good_open) {
         return dev;
@@ -937,20 +1579,54 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
     }
 }
 
-/* Helper function, to simplify hid_read().
-   This should be called with dev->mutex locked. */
-static int return_data(hid_device *dev, unsigned char *data, size_t length) {
-    /* Copy the data out of the linked list item (rpt) into the
-       return buffer (data), and delete the liked list item. */
-    struct input_report *rpt = dev->input_reports;
-    size_t len = (length < rpt->len) ? length : rpt->len;
-    if (len > 0) {
-        memcpy(data, rpt->data, len);
+/* A batch of reports being written by hid_write_batch(). */
+struct write_batch {
+    hid_device *dev;
+    hid_write_callback callback;
+    void *user_data;
+    unsigned char *data;   /* A copy of the reports */
+    int outstanding;       /* Transfers not yet completed (guarded by dev->mutex) */
+    int written;           /* Reports written successfully (ditto) */
+};
+
+/* Counts one of a batch's transfers (or the submitter) as finished, and
+   reports the outcome once they all are. */
+static void finish_write(struct write_batch *batch, int transfer_done, int written) {
+    hid_device *dev = batch->dev;
+    int done;
+
+    pthread_mutex_lock(&dev->mutex);
+    batch->written += written;
+    done = --batch->outstanding == 0;
+    if (transfer_done && !done) {
+        dev->writes_in_flight--;
+        pthread_cond_broadcast(&dev->condition);
     }
-    dev->input_reports = rpt->next;
-    free(rpt->data);
-    free(rpt);
-    return len;
+    pthread_mutex_unlock(&dev->mutex);
+
+    if (done) {
+        if (batch->callback) {
+            batch->callback(dev, batch->user_data, batch->written);
+        }
+        free(batch->data);
+        free(batch);
+
+        /* Only now can hid_close() go ahead and free the device. */
+        if (transfer_done) {
+            pthread_mutex_lock(&dev->mutex);
+            dev->writes_in_flight--;
+            pthread_cond_broadcast(&dev->condition);
+            pthread_mutex_unlock(&dev->mutex);
+        }
+    }
+}
+
+static void write_callback(struct libusb_transfer *transfer) {
+    struct write_batch *batch = transfer->user_data;
+    const int written = transfer->status == LIBUSB_TRANSFER_COMPLETED;
+
+    libusb_free_transfer(transfer);
+    finish_write(batch, 1, written);
 }
 
 static void cleanup_mutex(void *param) {
@@ -958,6 +1634,121 @@ static void cleanup_mutex(void *param) {
     pthread_mutex_unlock(&dev->mutex);
 }
 
+/* Tells read_callback() that a reader is (or is about to be) asleep on
+   dev->condition, so it must wake it when it queues a report. This should be
+   called with dev->mutex locked, before checking whether the queue is empty
+   and going to sleep. */
+static void add_waiter(hid_device *dev) {
+    __atomic_add_fetch(&dev->waiters, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void remove_waiter(void *param) {
+    hid_device *dev = param;
+    __atomic_sub_fetch(&dev->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Whether there's a report queued. Called with dev->mutex locked. */
+static int have_report(hid_device *dev) {
+    return ring_count(dev->ring) > 0;
+}
+
+
+int HID_API_EXPORT hid_write_async(hid_device *dev, const unsigned char *data, size_t length, hid_write_callback callback, void *user_data) {
+    return hid_write_batch(dev, data, length, 1, callback, user_data);
+}
+
+int HID_API_EXPORT hid_write_batch(hid_device *dev, const unsigned char *data, size_t report_length, size_t count, hid_write_callback callback, void *user_data) {
+    struct write_batch *batch;
+    size_t i;
+
+    if (report_length == 0) {
+        return -1;
+    }
+
+    if (dev->output_endpoint <= 0) {
+        /* No interrupt OUT endpoint, so the reports go over the Control
+           Endpoint, one at a time. */
+        int written = 0;
+        for (i = 0; i < count; i++) {
+            if (hid_write(dev, data + i * report_length, report_length) < 0) {
+                break;
+            }
+            written++;
+        }
+        if (callback) {
+            callback(dev, user_data, written);
+        }
+        return 0;
+    }
+
+    batch = calloc(1, sizeof(struct write_batch));
+    if (!batch) {
+        return -1;
+    }
+    batch->data = malloc(report_length * count + 1);
+    if (!batch->data) {
+        free(batch);
+        return -1;
+    }
+    memcpy(batch->data, data, report_length * count);
+    batch->dev = dev;
+    batch->callback = callback;
+    batch->user_data = user_data;
+
+    /* The submitter counts as outstanding too, so the callback can't run
+       until every transfer has been submitted. */
+    batch->outstanding = 1;
+
+    pthread_mutex_lock(&dev->mutex);
+    if (dev->shutdown_thread || dev->transfers_stopped) {
+        /* Nothing would be around to complete the transfers. */
+        pthread_mutex_unlock(&dev->mutex);
+        free(batch->data);
+        free(batch);
+        return -1;
+    }
+
+    /* Transfers on the same endpoint go out in the order they were
+       submitted, so the device gets the reports in order. */
+    for (i = 0; i < count; i++) {
+        unsigned char *report = batch->data + i * report_length;
+        int length = (int)report_length;
+        struct libusb_transfer *transfer;
+
+        if (report[0] == 0x0) {
+            /* Unnumbered report; don't send the Report ID. */
+            report++;
+            length--;
+        }
+
+        transfer = libusb_alloc_transfer(0);
+        if (!transfer) {
+            break;
+        }
+        libusb_fill_interrupt_transfer(transfer,
+                                       dev->device_handle,
+                                       (unsigned char) dev->output_endpoint,
+                                       report,
+                                       length,
+                                       write_callback,
+                                       batch,
+                                       1000/*timeout*/);
+        batch->outstanding++;
+        dev->writes_in_flight++;
+        if (libusb_submit_transfer(transfer) < 0) {
+            batch->outstanding--;
+            dev->writes_in_flight--;
+            libusb_free_transfer(transfer);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dev->mutex);
+
+    finish_write(batch, 0, 0);
+    return 0;
+}
+
 
 int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds) {
     int bytes_read = -1;
@@ -973,9 +1764,9 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
     pthread_cleanup_push(&cleanup_mutex, dev);
 
     /* There's an input report queued up. Return it. */
-    if (dev->input_reports) {
+    if (have_report(dev)) {
         /* Return the first one */
-        bytes_read = return_data(dev, data, length);
+        bytes_read = take_report(dev, data, length);
         goto ret;
     }
 
@@ -988,11 +1779,14 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
     if (milliseconds == -1) {
         /* Blocking */
-        while (!dev->input_reports && !dev->shutdown_thread) {
+        add_waiter(dev);
+        pthread_cleanup_push(&remove_waiter, dev);
+        while (!have_report(dev) && !dev->shutdown_thread) {
             pthread_cond_wait(&dev->condition, &dev->mutex);
         }
-        if (dev->input_reports) {
-            bytes_read = return_data(dev, data, length);
+        pthread_cleanup_pop(1);
+        if (have_report(dev)) {
+            bytes_read = take_report(dev, data, length);
         }
     }
     else if (milliseconds > 0) {
@@ -1007,11 +1801,13 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
             ts.tv_nsec -= 1000000000L;
         }
 
-        while (!dev->input_reports && !dev->shutdown_thread) {
+        add_waiter(dev);
+        pthread_cleanup_push(&remove_waiter, dev);
+        while (!have_report(dev) && !dev->shutdown_thread) {
             res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
             if (res == 0) {
-                if (dev->input_reports) {
-                    bytes_read = return_data(dev, data, length);
+                if (have_report(dev)) {
+                    bytes_read = take_report(dev, data, length);
                     break;
                 }
 
@@ -1030,6 +1826,11 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
                 break;
             }
         }
+        pthread_cleanup_pop(1);
+        if (bytes_read == -1 && have_report(dev)) {
+            /* One came in between the first check and the loop. */
+            bytes_read = take_report(dev, data, length);
+        }
     }
     else {
         /* Purely non-blocking */
@@ -1054,6 +1855,89 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock) {
 }
 
 
+int HID_API_EXPORT hid_set_input_queue(hid_device *dev, int depth, int policy) {
+    struct input_ring *old_ring, *new_ring;
+    unsigned count, skip, i;
+
+    if (depth < 1 || policy < HID_QUEUE_DROP_OLDEST || policy > HID_QUEUE_BLOCK) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dev->mutex);
+    old_ring = dev->ring;
+    new_ring = ring_new((unsigned) depth, old_ring->slot_size);
+    if (!new_ring) {
+        pthread_mutex_unlock(&dev->mutex);
+        return -1;
+    }
+
+    freeze_producer(dev);
+
+    /* Carry over what's queued, keeping the newest reports if they don't
+       all fit. */
+    count = old_ring->head - old_ring->tail;
+    skip = (count > new_ring->depth) ? count - new_ring->depth : 0;
+    __atomic_add_fetch(&dev->dropped_reports, skip, __ATOMIC_RELAXED);
+    for (i = old_ring->tail + skip; i != old_ring->head; i++) {
+        const size_t slot = i % old_ring->depth;
+        ring_push(dev, new_ring, HID_QUEUE_DROP_NEWEST,
+                  old_ring->data + slot * old_ring->slot_size, old_ring->lens[slot]);
+    }
+
+    dev->ring = new_ring;
+    dev->queue_policy = policy;
+
+    /* Reports held back under HID_QUEUE_BLOCK may fit now (or the policy
+       may not be HID_QUEUE_BLOCK any more). */
+    deliver_reports(dev);
+
+    thaw_producer(dev);
+    pthread_cond_broadcast(&dev->condition);
+    pthread_mutex_unlock(&dev->mutex);
+
+    ring_free(old_ring);
+    return 0;
+}
+
+unsigned long HID_API_EXPORT hid_get_dropped_input_reports(hid_device *dev) {
+    return __atomic_load_n(&dev->dropped_reports, __ATOMIC_RELAXED);
+}
+
+int HID_API_EXPORT hid_set_input_transfers(hid_device *dev, int count) {
+    int i, res = 0;
+
+    if (count < 1 || count > MAX_INPUT_TRANSFERS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dev->mutex);
+    freeze_producer(dev);
+
+    while (dev->num_transfers < count) {
+        if (add_input_transfer(dev) < 0) {
+            res = -1;
+            break;
+        }
+    }
+
+    /* Extra transfers retire as they complete (see resubmit_transfer());
+       new ones, and ones that had retired, are submitted now. */
+    dev->active_transfers = (count < dev->num_transfers) ? count : dev->num_transfers;
+    if (!dev->transfers_stopped) {
+        for (i = 0; i < dev->active_transfers; i++) {
+            if (dev->transfers[i].state == TRANSFER_IDLE) {
+                resubmit_transfer(dev, &dev->transfers[i]);
+            }
+        }
+    }
+
+    thaw_producer(dev);
+    pthread_mutex_unlock(&dev->mutex);
+
+    return res;
+}
+
+
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length) {
     int res = -1;
     int skipped_report_id = 0;
@@ -1118,20 +2002,61 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 
 
 void HID_API_EXPORT hid_close(hid_device *dev) {
+    int i;
+
     if (!dev) {
         return;
     }
 
-    /* Cause read_thread() to stop. */
+    /* Cause read_thread() to stop, by cancelling its transfers. If they're
+       all being held for want of queue space, put one back so there's
+       something to cancel. (On the shared event thread, the transfers just
+       need cancelling.) */
+    pthread_mutex_lock(&dev->mutex);
+    freeze_producer(dev);
     dev->shutdown_thread = 1;
-    libusb_cancel_transfer(dev->transfer);
+    if (!dev->transfers_stopped) {
+        struct input_transfer *held = NULL;
+        int submitted = 0;
+
+        for (i = 0; i < dev->num_transfers; i++) {
+            if (dev->transfers[i].state == TRANSFER_SUBMITTED) {
+                libusb_cancel_transfer(dev->transfers[i].transfer);
+                submitted = 1;
+            }
+            else if (dev->transfers[i].state == TRANSFER_COMPLETED) {
+                held = &dev->transfers[i];
+            }
+        }
+        if (!submitted && held && !dev->shared_events
+                && libusb_submit_transfer(held->transfer) == 0) {
+            held->state = TRANSFER_SUBMITTED;
+            libusb_cancel_transfer(held->transfer);
+        }
+    }
+    pthread_mutex_unlock(&dev->mutex);
 
-    /* Wait for read_thread() to end. */
-    pthread_join(dev->thread, NULL);
+    if (dev->shared_events) {
+        /* Wait for the event thread to finish with the transfers. */
+        pthread_mutex_lock(&dev->mutex);
+        while (transfers_busy(dev)) {
+            pthread_cond_wait(&dev->condition, &dev->mutex);
+        }
+        dev->transfers_stopped = 1;
+        pthread_mutex_unlock(&dev->mutex);
+
+        event_loop_release();
+    }
+    else {
+        /* Wait for read_thread() to end. */
+        pthread_join(dev->thread, NULL);
+    }
 
     /* Clean up the Transfer objects allocated in read_thread(). */
-    free(dev->transfer->buffer);
-    libusb_free_transfer(dev->transfer);
+    for (i = 0; i < dev->num_transfers; i++) {
+        free(dev->transfers[i].transfer->buffer);
+        libusb_free_transfer(dev->transfers[i].transfer);
+    }
 
     /* release the interface */
     libusb_release_interface(dev->device_handle, dev->interface);
@@ -1139,13 +2064,6 @@ void HID_API_EXPORT hid_close(hid_device *dev) {
     /* Close the handle */
     libusb_close(dev->device_handle);
 
-    /* Clear out the queue of received reports. */
-    pthread_mutex_lock(&dev->mutex);
-    while (dev->input_reports) {
-        return_data(dev, NULL, 0);
-    }
-    pthread_mutex_unlock(&dev->mutex);
-
     free_hid_device(dev);
 }
 
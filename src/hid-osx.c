@@ -31,6 +31,10 @@
 
 #define UNUSED(param)       ((void)param)
 
+/* How many input reports are queued up for hid_read() by default, until
+   hid_set_input_queue() says otherwise. */
+#define DEFAULT_INPUT_QUEUE_DEPTH 32
+
 /* Linked List of input reports received from the device. */
 struct input_report {
     uint8_t *data;
@@ -46,6 +50,10 @@ struct hid_device_ {
     CFStringRef run_loop_mode;
     uint8_t *input_report_buf;
     struct input_report *input_reports;
+    int num_input_reports;
+    int queue_depth;
+    int queue_policy;
+    unsigned long dropped_reports;
     pthread_mutex_t mutex;
 
     hid_device *next;
@@ -53,6 +61,15 @@ struct hid_device_ {
 
 };
 
+/* Deletes the oldest report in the queue. */
+static void drop_oldest(hid_device *dev) {
+    struct input_report *rpt = dev->input_reports;
+    dev->input_reports = rpt->next;
+    dev->num_input_reports--;
+    free(rpt->data);
+    free(rpt);
+}
+
 /* Static list of all the devices open. This way when a device gets
    disconnected, its hid_device structure can be marked as disconnected
    from hid_device_removal_callback(). */
@@ -67,6 +84,10 @@ static hid_device *new_hid_device(void) {
     dev->run_loop_mode = NULL;
     dev->input_report_buf = NULL;
     dev->input_reports = NULL;
+    dev->num_input_reports = 0;
+    dev->queue_depth = DEFAULT_INPUT_QUEUE_DEPTH;
+    dev->queue_policy = HID_QUEUE_DROP_OLDEST;
+    dev->dropped_reports = 0;
     dev->next = NULL;
 
     pthread_mutex_init(&dev->mutex, NULL);
@@ -285,6 +306,10 @@ static void init_hid_manager(void) {
 
 
 struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id) {
+    return hid_enumerate_filtered(vendor_id, product_id, HID_ENUMERATE_STRINGS);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(unsigned short vendor_id, unsigned short product_id, int flags) {
     struct hid_device_info *root = NULL; // return object
     struct hid_device_info *cur_dev = NULL;
     CFIndex num_devices;
@@ -344,14 +369,21 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
             cur_dev->path = strdup(cbuf);
 
             /* Serial Number */
-            get_serial_number(dev, buf, BUF_LEN);
-            cur_dev->serial_number = dup_wcs(buf);
+            cur_dev->serial_number = NULL;
+            if (flags & HID_ENUMERATE_SERIAL_NUMBER) {
+                get_serial_number(dev, buf, BUF_LEN);
+                cur_dev->serial_number = dup_wcs(buf);
+            }
 
             /* Manufacturer and Product strings */
-            get_manufacturer_string(dev, buf, BUF_LEN);
-            cur_dev->manufacturer_string = dup_wcs(buf);
-            get_product_string(dev, buf, BUF_LEN);
-            cur_dev->product_string = dup_wcs(buf);
+            cur_dev->manufacturer_string = NULL;
+            cur_dev->product_string = NULL;
+            if (flags & HID_ENUMERATE_NAMES) {
+                get_manufacturer_string(dev, buf, BUF_LEN);
+                cur_dev->manufacturer_string = dup_wcs(buf);
+                get_product_string(dev, buf, BUF_LEN);
+                cur_dev->product_string = dup_wcs(buf);
+            }
 
             /* VID/PID */
             cur_dev->vendor_id = dev_vid;
@@ -391,13 +423,15 @@ hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short pr
     const char *path_to_open = NULL;
     hid_device * handle = NULL;
 
-    devs = hid_enumerate(vendor_id, product_id);
+    devs = hid_enumerate_filtered(vendor_id, product_id,
+                                  serial_number ? HID_ENUMERATE_SERIAL_NUMBER : 0);
     cur_dev = devs;
     while (cur_dev) {
         if (cur_dev->vendor_id == vendor_id &&
                 cur_dev->product_id == product_id) {
             if (serial_number) {
-                if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
+                if (cur_dev->serial_number &&
+                        wcscmp(serial_number, cur_dev->serial_number) == 0) {
                     path_to_open = cur_dev->path;
                     break;
                 }
@@ -449,6 +483,18 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
     struct input_report *rpt;
     hid_device *dev = context;
 
+    /* Make room for it, or drop it, if the queue is full. The callback runs
+       inside hid_read()'s run loop, so there's no way to hold the report
+       back with the device; HID_QUEUE_BLOCK drops the new report too. */
+    if (dev->num_input_reports >= dev->queue_depth) {
+        dev->dropped_reports++;
+        if (dev->queue_policy != HID_QUEUE_DROP_OLDEST) {
+            CFRunLoopStop(CFRunLoopGetCurrent());
+            return;
+        }
+        drop_oldest(dev);
+    }
+
     /* Make a new Input Report object */
     rpt = calloc(1, sizeof(struct input_report));
     rpt->data = calloc(1, (unsigned long)report_length);
@@ -469,6 +515,7 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
         }
         cur->next = rpt;
     }
+    dev->num_input_reports++;
 
     /* Stop the Run Loop. This is mostly used for when blocking is
        enabled, but it doesn't hurt for non-blocking as well.  */
@@ -586,7 +633,32 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
     return set_report(dev, kIOHIDReportTypeOutput, data, length);
 }
 
-/* Helper function, so that this isn't duplicated in hid_read(). */
+int HID_API_EXPORT hid_write_async(hid_device *dev, const unsigned char *data, size_t length, hid_write_callback callback, void *user_data) {
+    return hid_write_batch(dev, data, length, 1, callback, user_data);
+}
+
+int HID_API_EXPORT hid_write_batch(hid_device *dev, const unsigned char *data, size_t report_length, size_t count, hid_write_callback callback, void *user_data) {
+    /* IOHIDDeviceSetReport() is synchronous, so the reports are simply
+       written one after the other. */
+    int written = 0;
+    size_t i;
+
+    if (report_length == 0) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (hid_write(dev, data + i * report_length, report_length) < 0) {
+            break;
+        }
+        written++;
+    }
+    if (callback) {
+        callback(dev, user_data, written);
+    }
+    return 0;
+}
+
+/* Helper function, so that this isn't duplicated in hid_read_timeout(). */
 static int return_data(hid_device *dev, unsigned char *data, size_t length) {
     /* Copy the data out of the linked list item (rpt) into the
        return buffer (data), and delete the liked list item. */
@@ -594,12 +666,13 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length) {
     size_t len = (length < rpt->len) ? length : rpt->len;
     memcpy(data, rpt->data, len);
     dev->input_reports = rpt->next;
+    dev->num_input_reports--;
     free(rpt->data);
     free(rpt);
     return (int)len;
 }
 
-int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length) {
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds) {
     int ret_val = -1;
 
     /* Lock this function */
@@ -624,13 +697,23 @@ int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
     /* Move the device's run loop to this thread. */
     IOHIDDeviceScheduleWithRunLoop(dev->device_handle, CFRunLoopGetCurrent(), dev->run_loop_mode);
 
-    if (dev->blocking) {
-        /* Run the Run Loop until it stops timing out. In other
-           words, until something happens. This is necessary because
-           there is no INFINITE timeout value. */
+    if (milliseconds != 0) {
+        /* Run the Run Loop until it stops timing out (or our time is up).
+           In other words, until something happens. When waiting for as
+           long as it takes, it's run a bit at a time, because there is no
+           INFINITE timeout value. */
+        const CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + milliseconds / 1000.0;
         SInt32 code;
         while (1) {
-            code = CFRunLoopRunInMode(dev->run_loop_mode, 1000, TRUE);
+            CFTimeInterval timeout = 1000;
+            if (milliseconds > 0) {
+                timeout = deadline - CFAbsoluteTimeGetCurrent();
+                if (timeout <= 0) {
+                    ret_val = 0; /* No data in time */
+                    goto ret;
+                }
+            }
+            code = CFRunLoopRunInMode(dev->run_loop_mode, timeout, TRUE);
 
             /* Return if the device has been disconnected */
             if (code == kCFRunLoopRunFinished) {
@@ -691,6 +774,10 @@ ret:
     return ret_val;
 }
 
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length) {
+    return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock) {
     /* All Nonblocking operation is handled by the library. */
     dev->blocking = !nonblock;
@@ -698,6 +785,47 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock) {
     return 0;
 }
 
+int HID_API_EXPORT hid_set_input_queue(hid_device *dev, int depth, int policy) {
+    if (depth < 1 || policy < HID_QUEUE_DROP_OLDEST || policy > HID_QUEUE_BLOCK) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dev->mutex);
+    dev->queue_depth = depth;
+    dev->queue_policy = policy;
+
+    /* Keep the newest reports, if they don't all fit any more. */
+    while (dev->num_input_reports > depth) {
+        drop_oldest(dev);
+        dev->dropped_reports++;
+    }
+    pthread_mutex_unlock(&dev->mutex);
+
+    return 0;
+}
+
+unsigned long HID_API_EXPORT hid_get_dropped_input_reports(hid_device *dev) {
+    unsigned long dropped;
+
+    pthread_mutex_lock(&dev->mutex);
+    dropped = dev->dropped_reports;
+    pthread_mutex_unlock(&dev->mutex);
+
+    return dropped;
+}
+
+int HID_API_EXPORT hid_set_event_mode(int mode) {
+    /* IOKit does the reading from the device. */
+    return (mode == HID_EVENTS_SHARED || mode == HID_EVENTS_PER_DEVICE) ? 0 : -1;
+}
+
+int HID_API_EXPORT hid_set_input_transfers(hid_device *dev, int count) {
+    /* IOKit does the reading from the device. */
+    UNUSED(dev);
+
+    return (count >= 1 && count <= 32) ? 0 : -1;
+}
+
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length) {
     return set_report(dev, kIOHIDReportTypeFeature, data, length);
 }
@@ -0,0 +1,791 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Recorded Finch Version
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+/* This backend plays back a session recorded with Finch::startRecording()
+   (see finch-recording.h), as one Finch, so a program can be run against
+   real data without the robot. Build with HID_BACKEND=replay, or link
+   against libFinch++-replay.a, to use it.
+
+   The recording is mapped into memory rather than read, so even one
+   many hours long opens straight away, and only the parts played back
+   are ever read from disk.
+
+   Each query the program sends ('T', 'A', 'L', 'I' or 'z') is answered
+   with a recorded reply to the same query, carrying the program's report
+   counter. Output commands are accepted, and ignored. How the reply is
+   picked depends on the speed:
+
+   - At the original speed (or a multiple of it), the recording plays out
+     against the clock, and each query gets the latest reply to it
+     recorded up to that point, so the program sees what the robot was
+     reading at that moment. It arrives after the round trip it took
+     when it was recorded. Once the clock passes the end of the
+     recording, the Finch stops answering, as if it had been unplugged.
+
+   - As fast as possible, each query gets the next recorded reply to it,
+     in order, straight away, so the program sees every reading once.
+     Once a query's replies run out, the Finch stops answering.
+
+   Queries that never appear in the recording get replies of all zeros.
+
+   The playback is set up from the environment when the library is first
+   used:
+
+     FINCH_REPLAY        The recording to play back (required)
+     FINCH_REPLAY_SPEED  How many times the original speed to play it at,
+                         or 0 for as fast as possible (default 1)
+     FINCH_REPLAY_START  How many seconds into the recording to start
+                         (default 0)
+*/
+
+#define _GNU_SOURCE // needed for wcsdup() before glibc 2.10
+
+/* C */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <wchar.h>
+
+/* Unix */
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hidapi.h"
+#include "finch-recording.h"
+
+#define REPLAY_VENDOR_ID 0x2354
+#define REPLAY_PRODUCT_ID 0x1111
+#define REPLAY_PATH "replay:0"
+
+/* Input reports are 8 bytes; there's no report ID. */
+#define REPLAY_REPORT_SIZE 8
+
+#define DEFAULT_INPUT_QUEUE_DEPTH 32
+
+/* How far back from a reply to look for the command it answered, to
+   find out how long the round trip took. */
+#define MAX_ROUND_TRIP_SEARCH 512
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The recording, mapped into memory once. */
+struct replay_recording {
+    int loaded;
+    void *map;
+    size_t map_size;
+    const unsigned char *records;
+    long long num_records;
+    const unsigned char *index;     /* NULL if the recording has none */
+    long long index_count;
+    long long end_time;             /* Time of the last record */
+    double speed;                   /* 0 for as fast as possible */
+    long long start_time;           /* Where in the recording to start */
+};
+
+/* Where each query has got to in the recording. */
+struct replay_cursor {
+    long long chosen;   /* The last reply given, -1 if none yet */
+    long long scan;     /* Every record before this has been looked at */
+    long long ahead;    /* The next reply at or after scan, if it's been
+                           looked for since scan last moved past it */
+};
+
+/* A reply on its way back from the device. */
+struct replay_reply {
+    unsigned char data[REPLAY_REPORT_SIZE];
+    long long ready_at;             /* When it can be read (CLOCK_MONOTONIC ns) */
+};
+
+struct hid_device_ {
+    int blocking;
+    long long started_at;           /* When playback started (CLOCK_MONOTONIC ns) */
+    int ended;                      /* Whether the recording has run out */
+    struct replay_cursor cursors[256];
+
+    /* The replies not yet read, oldest first, in a ring of queue_depth
+       slots. */
+    struct replay_reply *replies;
+    int queue_depth;
+    int queue_policy;
+    int head;
+    int count;
+    unsigned long dropped_reports;
+    long long last_ready_at;        /* Replies can't overtake each other */
+
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+};
+
+static struct replay_recording recording;
+static pthread_once_t recording_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t open_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int device_open;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned long long get_u64(const unsigned char *in) {
+    unsigned long long value = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static unsigned long get_u32(const unsigned char *in) {
+    return (unsigned long) in[0] | ((unsigned long) in[1] << 8) |
+           ((unsigned long) in[2] << 16) | ((unsigned long) in[3] << 24);
+}
+
+static double env_double(const char *name, double def) {
+    const char *value = getenv(name);
+    char *end;
+    double result;
+
+    if (!value || !*value) {
+        return def;
+    }
+    result = strtod(value, &end);
+    return (end == value) ? def : result;
+}
+
+static const unsigned char *record_at(long long n) {
+    return recording.records + n * FINCH_REC_RECORD_SIZE;
+}
+
+static long long record_time(long long n) {
+    return (long long) get_u64(record_at(n) + FINCH_REC_TIME);
+}
+
+static int is_reply_to(long long n, unsigned char command) {
+    const unsigned char *record = record_at(n);
+    return record[FINCH_REC_DIRECTION] == FINCH_REC_IN && record[FINCH_REC_COMMAND] == command;
+}
+
+/* Checks the recording over, and works out where its records and index
+   are. Returns an error message, or NULL if it's fine. */
+static const char *map_recording(const unsigned char *map, size_t size) {
+    long long records_end = (long long) size;
+
+    if (size < FINCH_REC_HEADER_SIZE || memcmp(map, FINCH_REC_MAGIC, FINCH_REC_MAGIC_SIZE) != 0) {
+        return "not a Finch recording";
+    }
+    if (get_u32(map + 8) != FINCH_REC_VERSION || get_u32(map + 12) != FINCH_REC_RECORD_SIZE) {
+        return "recorded by an incompatible version of the library";
+    }
+
+    /* Use the index if the recording was finished off properly. */
+    if (size >= FINCH_REC_HEADER_SIZE + FINCH_REC_TRAILER_SIZE) {
+        const unsigned char *trailer = map + size - FINCH_REC_TRAILER_SIZE;
+        const unsigned long long offset = get_u64(trailer);
+        const unsigned long long count = get_u64(trailer + 8);
+
+        if (memcmp(trailer + 16, FINCH_REC_INDEX_MAGIC, FINCH_REC_MAGIC_SIZE) == 0 &&
+                offset >= FINCH_REC_HEADER_SIZE &&
+                (offset - FINCH_REC_HEADER_SIZE) % FINCH_REC_RECORD_SIZE == 0 &&
+                count <= size / FINCH_REC_INDEX_ENTRY_SIZE &&
+                offset + count * FINCH_REC_INDEX_ENTRY_SIZE + FINCH_REC_TRAILER_SIZE == size) {
+            records_end = (long long) offset;
+            recording.index = map + offset;
+            recording.index_count = (long long) count;
+        }
+    }
+
+    recording.records = map + FINCH_REC_HEADER_SIZE;
+    recording.num_records = (records_end - FINCH_REC_HEADER_SIZE) / FINCH_REC_RECORD_SIZE;
+    recording.end_time = (recording.num_records > 0) ? record_time(recording.num_records - 1) : 0;
+    return NULL;
+}
+
+static void load_recording(void) {
+    const char *path = getenv("FINCH_REPLAY");
+    const char *error = NULL;
+    struct stat st;
+    void *map;
+    int fd;
+
+    recording.speed = env_double("FINCH_REPLAY_SPEED", 1);
+    if (recording.speed < 0) {
+        recording.speed = 1;
+    }
+    recording.start_time = (long long) (env_double("FINCH_REPLAY_START", 0) * 1e9);
+    if (recording.start_time < 0) {
+        recording.start_time = 0;
+    }
+
+    if (!path || !*path) {
+        fprintf(stderr, "Set FINCH_REPLAY to the recording to play back.\n");
+        return;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Can't play back %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        fprintf(stderr, "Can't play back %s: %s\n", path, "empty file");
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't play back %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    error = map_recording((const unsigned char *) map, (size_t) st.st_size);
+    if (error) {
+        fprintf(stderr, "Can't play back %s: %s\n", path, error);
+        munmap(map, (size_t) st.st_size);
+        return;
+    }
+    recording.map = map;
+    recording.map_size = (size_t) st.st_size;
+    recording.loaded = 1;
+}
+
+/* The first record at or after time. */
+static long long seek(long long time) {
+    long long low = 0;
+    long long high = recording.num_records;
+
+    if (recording.index && recording.index_count > 0) {
+        /* Jump to the start of the second, then look from there. */
+        long long entry = time / FINCH_REC_INDEX_INTERVAL_NS;
+        long long n;
+
+        if (entry >= recording.index_count) {
+            entry = recording.index_count - 1;
+        }
+        n = (long long) get_u64(recording.index + entry * FINCH_REC_INDEX_ENTRY_SIZE + 8);
+        while (n < recording.num_records && record_time(n) < time) {
+            n++;
+        }
+        return n;
+    }
+
+    /* No index; the records are in time order, so search them. */
+    while (low < high) {
+        const long long middle = low + (high - low) / 2;
+        if (record_time(middle) < time) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* The next reply to command at or after the cursor's scan position, or
+   num_records if there are no more. */
+static long long look_ahead(struct replay_cursor *cursor, unsigned char command) {
+    if (cursor->ahead < cursor->scan) {
+        long long n = cursor->scan;
+        while (n < recording.num_records && !is_reply_to(n, command)) {
+            n++;
+        }
+        cursor->ahead = n;
+    }
+    return cursor->ahead;
+}
+
+/* Picks the recorded reply to give to a query. Returns its record
+   number, -1 if there's none to give (so it gets zeros), or -2 if the
+   recording has run out. Called with the mutex held. */
+static long long pick_reply(hid_device *dev, unsigned char command) {
+    struct replay_cursor *cursor = &dev->cursors[command];
+    long long next;
+
+    if (recording.speed > 0) {
+        const long long time = recording.start_time +
+                               (long long) ((double) (now_ns() - dev->started_at) * recording.speed);
+        if (time > recording.end_time) {
+            return -2;
+        }
+
+        /* The latest reply up to now... */
+        while (cursor->scan < recording.num_records && record_time(cursor->scan) <= time) {
+            if (is_reply_to(cursor->scan, command)) {
+                cursor->chosen = cursor->scan;
+            }
+            cursor->scan++;
+        }
+        if (cursor->chosen >= 0) {
+            return cursor->chosen;
+        }
+
+        /* ...or, if there hasn't been one yet, the first one to come. */
+        next = look_ahead(cursor, command);
+        return (next < recording.num_records) ? next : -1;
+    }
+
+    next = look_ahead(cursor, command);
+    if (next >= recording.num_records) {
+        return (cursor->chosen >= 0) ? -2 : -1;
+    }
+    cursor->chosen = next;
+    cursor->scan = next + 1;
+    return next;
+}
+
+/* How long the round trip for a reply took when it was recorded. */
+static long long round_trip(long long reply) {
+    const unsigned char *record = record_at(reply);
+    const unsigned char counter = record[FINCH_REC_REPORT + 7];
+    long long n;
+
+    for (n = reply - 1; n >= 0 && n >= reply - MAX_ROUND_TRIP_SEARCH; n--) {
+        const unsigned char *command = record_at(n);
+        if (command[FINCH_REC_DIRECTION] == FINCH_REC_OUT &&
+                command[FINCH_REC_COMMAND] == record[FINCH_REC_COMMAND] &&
+                command[FINCH_REC_REPORT + 8] == counter) {
+            return record_time(reply) - record_time(n);
+        }
+    }
+    return 0;
+}
+
+/* Queues a reply, due delay_ns from now. Called with the mutex held. */
+static void queue_reply(hid_device *dev, const unsigned char *data, long long delay_ns) {
+    long long ready_at = now_ns() + delay_ns;
+    struct replay_reply *reply;
+
+    if (ready_at < dev->last_ready_at) {
+        ready_at = dev->last_ready_at;
+    }
+    dev->last_ready_at = ready_at;
+
+    if (dev->count == dev->queue_depth) {
+        dev->dropped_reports++;
+        if (dev->queue_policy != HID_QUEUE_DROP_OLDEST) {
+            /* Drop the newest; there's no holding the reply back at
+               the device, so HID_QUEUE_BLOCK does the same. */
+            return;
+        }
+        dev->head = (dev->head + 1) % dev->queue_depth;
+        dev->count--;
+    }
+    reply = &dev->replies[(dev->head + dev->count) % dev->queue_depth];
+    memcpy(reply->data, data, REPLAY_REPORT_SIZE);
+    reply->ready_at = ready_at;
+    dev->count++;
+    pthread_cond_broadcast(&dev->condition);
+}
+
+/* Answers a command report (with its report ID). Returns -1 once the
+   recording has run out. Called with the mutex held. */
+static int handle_command(hid_device *dev, const unsigned char *report, size_t length) {
+    const unsigned char command = report[1];
+    unsigned char reply[REPLAY_REPORT_SIZE];
+    long long delay_ns = 0;
+    long long picked;
+
+    if (dev->ended) {
+        return -1;
+    }
+    if (command != 'T' && command != 'A' && command != 'L' && command != 'I' && command != 'z') {
+        /* Outputs have nothing to play back. */
+        return 0;
+    }
+
+    picked = pick_reply(dev, command);
+    if (picked == -2) {
+        dev->ended = 1;
+        pthread_cond_broadcast(&dev->condition);
+        return -1;
+    }
+    memset(reply, 0, sizeof(reply));
+    if (picked >= 0) {
+        memcpy(reply, record_at(picked) + FINCH_REC_REPORT, REPLAY_REPORT_SIZE);
+        if (recording.speed > 0) {
+            delay_ns = (long long) ((double) round_trip(picked) / recording.speed);
+        }
+    }
+
+    /* The report counter, from byte 8 of the command report. */
+    reply[7] = (length > 8) ? report[8] : 0;
+    queue_reply(dev, reply, delay_ns);
+    return 0;
+}
+
+static hid_device *new_hid_device(void) {
+    hid_device *dev = calloc(1, sizeof(hid_device));
+    pthread_condattr_t cond_attr;
+    const long long start = seek(recording.start_time);
+    int i;
+
+    dev->blocking = 1;
+    dev->started_at = now_ns();
+    for (i = 0; i < 256; i++) {
+        dev->cursors[i].chosen = -1;
+        dev->cursors[i].scan = start;
+        dev->cursors[i].ahead = -1;
+    }
+    dev->queue_depth = DEFAULT_INPUT_QUEUE_DEPTH;
+    dev->queue_policy = HID_QUEUE_DROP_OLDEST;
+    dev->replies = calloc((size_t) dev->queue_depth, sizeof(struct replay_reply));
+
+    pthread_mutex_init(&dev->mutex, NULL);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dev->condition, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    return dev;
+}
+
+static void free_hid_device(hid_device *dev) {
+    pthread_cond_destroy(&dev->condition);
+    pthread_mutex_destroy(&dev->mutex);
+    free(dev->replies);
+    free(dev);
+}
+
+
+int HID_API_EXPORT hid_init(void) {
+    pthread_once(&recording_once, load_recording);
+    return 0;
+}
+
+int HID_API_EXPORT hid_exit(void) {
+    /* The recording stays mapped, in case the library is used again. */
+    return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id) {
+    return hid_enumerate_filtered(vendor_id, product_id, HID_ENUMERATE_STRINGS);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(unsigned short vendor_id, unsigned short product_id, int flags) {
+    struct hid_device_info *cur_dev;
+
+    hid_init();
+
+    if (!recording.loaded) {
+        return NULL;
+    }
+    if (!(vendor_id == 0x0 && product_id == 0x0) &&
+            !(vendor_id == REPLAY_VENDOR_ID && product_id == REPLAY_PRODUCT_ID)) {
+        return NULL;
+    }
+
+    cur_dev = calloc(1, sizeof(struct hid_device_info));
+    cur_dev->path = strdup(REPLAY_PATH);
+    cur_dev->vendor_id = REPLAY_VENDOR_ID;
+    cur_dev->product_id = REPLAY_PRODUCT_ID;
+    if (flags & HID_ENUMERATE_SERIAL_NUMBER) {
+        cur_dev->serial_number = wcsdup(L"REPLAY");
+    }
+    if (flags & HID_ENUMERATE_NAMES) {
+        cur_dev->manufacturer_string = wcsdup(L"BirdBrain Technologies");
+        cur_dev->product_string = wcsdup(L"Finch (replay)");
+    }
+    cur_dev->interface_number = 0;
+    cur_dev->next = NULL;
+
+    return cur_dev;
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs) {
+    struct hid_device_info *d = devs;
+    while (d) {
+        struct hid_device_info *next = d->next;
+        free(d->path);
+        free(d->serial_number);
+        free(d->manufacturer_string);
+        free(d->product_string);
+        free(d);
+        d = next;
+    }
+}
+
+hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, wchar_t *serial_number) {
+    struct hid_device_info *devs;
+    hid_device *handle = NULL;
+
+    devs = hid_enumerate_filtered(vendor_id, product_id,
+                                  serial_number ? HID_ENUMERATE_SERIAL_NUMBER : 0);
+    if (devs && (!serial_number ||
+                 (devs->serial_number && wcscmp(serial_number, devs->serial_number) == 0))) {
+        handle = hid_open_path(devs->path);
+    }
+    hid_free_enumeration(devs);
+
+    return handle;
+}
+
+int HID_API_EXPORT hid_set_event_mode(int mode) {
+    /* There are no USB events to wait for. */
+    return (mode == HID_EVENTS_SHARED || mode == HID_EVENTS_PER_DEVICE) ? 0 : -1;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path) {
+    hid_init();
+
+    if (!recording.loaded || strcmp(path, REPLAY_PATH) != 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&open_mutex);
+    if (device_open) {
+        pthread_mutex_unlock(&open_mutex);
+        return NULL;
+    }
+    device_open = 1;
+    pthread_mutex_unlock(&open_mutex);
+
+    return new_hid_device();
+}
+
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length) {
+    int res;
+
+    if (length < 2) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dev->mutex);
+    res = handle_command(dev, data, length);
+    pthread_mutex_unlock(&dev->mutex);
+
+    return (res < 0) ? -1 : (int) length;
+}
+
+int HID_API_EXPORT hid_write_async(hid_device *dev, const unsigned char *data, size_t length, hid_write_callback callback, void *user_data) {
+    return hid_write_batch(dev, data, length, 1, callback, user_data);
+}
+
+int HID_API_EXPORT hid_write_batch(hid_device *dev, const unsigned char *data, size_t report_length, size_t count, hid_write_callback callback, void *user_data) {
+    /* The writes finish straight away, so the reports are simply written
+       one after the other. */
+    int written = 0;
+    size_t i;
+
+    if (report_length == 0) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (hid_write(dev, data + i * report_length, report_length) < 0) {
+            break;
+        }
+        written++;
+    }
+    if (callback) {
+        callback(dev, user_data, written);
+    }
+    return 0;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds) {
+    const long long deadline = (milliseconds > 0) ? now_ns() + milliseconds * 1000000LL : 0;
+    int bytes_read = 0;
+
+    pthread_mutex_lock(&dev->mutex);
+    for (;;) {
+        const long long now = now_ns();
+        long long wake_at;
+
+        if (dev->count > 0 && dev->replies[dev->head].ready_at <= now) {
+            struct replay_reply *reply = &dev->replies[dev->head];
+            bytes_read = (int) ((length < REPLAY_REPORT_SIZE) ? length : REPLAY_REPORT_SIZE);
+            memcpy(data, reply->data, (size_t) bytes_read);
+            dev->head = (dev->head + 1) % dev->queue_depth;
+            dev->count--;
+            break;
+        }
+        if (dev->ended && dev->count == 0) {
+            /* Nothing more will ever come. */
+            bytes_read = -1;
+            break;
+        }
+        if (milliseconds == 0 || (milliseconds > 0 && now >= deadline)) {
+            break;
+        }
+
+        /* Sleep until the next reply is due, or the timeout. */
+        wake_at = (milliseconds > 0) ? deadline : 0;
+        if (dev->count > 0 && (wake_at == 0 || dev->replies[dev->head].ready_at < wake_at)) {
+            wake_at = dev->replies[dev->head].ready_at;
+        }
+        if (wake_at == 0) {
+            pthread_cond_wait(&dev->condition, &dev->mutex);
+        }
+        else {
+            struct timespec ts;
+            ts.tv_sec = (time_t) (wake_at / 1000000000LL);
+            ts.tv_nsec = (long) (wake_at % 1000000000LL);
+            pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&dev->mutex);
+
+    return bytes_read;
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length) {
+    return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock) {
+    dev->blocking = !nonblock;
+
+    return 0;
+}
+
+int HID_API_EXPORT hid_set_input_queue(hid_device *dev, int depth, int policy) {
+    struct replay_reply *replies;
+    int keep;
+    int i;
+
+    if (depth < 1 || policy < HID_QUEUE_DROP_OLDEST || policy > HID_QUEUE_BLOCK) {
+        return -1;
+    }
+    replies = calloc((size_t) depth, sizeof(struct replay_reply));
+    if (!replies) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dev->mutex);
+
+    /* Keep the newest replies, if they don't all fit any more. */
+    keep = (dev->count < depth) ? dev->count : depth;
+    dev->dropped_reports += (unsigned long) (dev->count - keep);
+    for (i = 0; i < keep; i++) {
+        replies[i] = dev->replies[(dev->head + dev->count - keep + i) % dev->queue_depth];
+    }
+    free(dev->replies);
+    dev->replies = replies;
+    dev->queue_depth = depth;
+    dev->queue_policy = policy;
+    dev->head = 0;
+    dev->count = keep;
+
+    pthread_mutex_unlock(&dev->mutex);
+
+    return 0;
+}
+
+unsigned long HID_API_EXPORT hid_get_dropped_input_reports(hid_device *dev) {
+    unsigned long dropped;
+
+    pthread_mutex_lock(&dev->mutex);
+    dropped = dev->dropped_reports;
+    pthread_mutex_unlock(&dev->mutex);
+
+    return dropped;
+}
+
+int HID_API_EXPORT hid_set_input_transfers(hid_device *dev, int count) {
+    /* There are no transfers to keep waiting. */
+    (void) dev;
+
+    return (count >= 1 && count <= 32) ? 0 : -1;
+}
+
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length) {
+    /* The Finch has no feature reports. */
+    (void) dev;
+    (void) data;
+    (void) length;
+
+    return -1;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length) {
+    (void) dev;
+    (void) data;
+    (void) length;
+
+    return -1;
+}
+
+
+void HID_API_EXPORT hid_close(hid_device *dev) {
+    if (!dev) {
+        return;
+    }
+
+    pthread_mutex_lock(&open_mutex);
+    device_open = 0;
+    pthread_mutex_unlock(&open_mutex);
+
+    free_hid_device(dev);
+}
+
+
+static int copy_string(const wchar_t *str, wchar_t *string, size_t maxlen) {
+    if (maxlen == 0) {
+        return -1;
+    }
+    wcsncpy(string, str, maxlen);
+    string[maxlen - 1] = L'\0';
+
+    return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    (void) dev;
+
+    return copy_string(L"BirdBrain Technologies", string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    (void) dev;
+
+    return copy_string(L"Finch (replay)", string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    (void) dev;
+
+    return copy_string(L"REPLAY", string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen) {
+    (void) dev;
+    (void) string_index;
+    (void) string;
+    (void) maxlen;
+
+    return -1;
+}
+
+
+HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev) {
+    (void) dev;
+
+    return NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
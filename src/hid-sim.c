@@ -0,0 +1,881 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ Simulated Finch Version
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        http://github.com/signal11/hidapi .
+********************************************************/
+
+/* This backend has no hardware behind it: it simulates Finches in the
+   process, so the library can be run and measured on machines with no
+   USB devices at all. Build with HID_BACKEND=sim, or link against
+   libFinch++-sim.a, to use it.
+
+   Each simulated Finch answers the Finch's command reports the way the
+   robot does. The 'T', 'A', 'L', 'I' and 'z' queries get a reply with
+   the report counter from byte 8 of the command echoed in byte 7; the
+   'O', 'M', 'B' and 'R' commands change the outputs and get no reply.
+   A reply can only be read once the round-trip latency has passed since
+   its command was written, and replies arrive in the order the commands
+   were, as they do over USB.
+
+   The simulation is set up from the environment when the library is
+   first used:
+
+     FINCH_SIM_DEVICES      Number of Finches (default 1, at most 64)
+     FINCH_SIM_LATENCY_US   Round-trip latency in microseconds (default 1000)
+     FINCH_SIM_JITTER_US    Extra latency, uniformly random between 0 and
+                            this (default 0)
+     FINCH_SIM_WRITE_US     Time each write takes (default 0)
+     FINCH_SIM_SEED         Seed for the jitter, so runs can be repeated
+                            exactly (default 1)
+     FINCH_SIM_TEMPERATURE  Temperature in Celsius (default 25)
+     FINCH_SIM_ACCEL        Accelerations in G as "x,y,z" (default
+                            "0,0,1", sitting level)
+     FINCH_SIM_LIGHT        Light sensors as "left,right", 0 to 255
+                            (default "100,100")
+     FINCH_SIM_OBSTACLES    Obstacle sensors as "left,right", 0 or 1
+                            (default "0,0")
+
+   Test programs can also pull simulated Finches off the bus, lose
+   replies and look at the outputs, through the hooks in hid-sim.h.
+*/
+
+#define _GNU_SOURCE // needed for wcsdup() before glibc 2.10
+
+/* C */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <wchar.h>
+
+/* Unix */
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hidapi.h"
+#include "hid-sim.h"
+
+#define SIM_VENDOR_ID 0x2354
+#define SIM_PRODUCT_ID 0x1111
+#define SIM_PATH_PREFIX "sim:"
+#define MAX_SIM_DEVICES 64
+
+/* Input reports are 8 bytes; there's no report ID. */
+#define SIM_REPORT_SIZE 8
+
+#define DEFAULT_INPUT_QUEUE_DEPTH 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The simulation settings, read from the environment once. */
+struct sim_config {
+    int num_devices;
+    long long latency_ns;
+    long long jitter_ns;
+    long long write_ns;
+    unsigned long seed;
+    unsigned char temperature;
+    unsigned char accel[3];
+    unsigned char light[2];
+    unsigned char obstacles[2];
+};
+
+/* One simulated Finch. It outlives any handle opened on it, so its
+   outputs stay set across a close and reopen, as the robot's do. The
+   fields up to handle are guarded by finches_mutex; the rest by the
+   open handle's mutex. */
+struct sim_finch {
+    int open;
+    int absent;                 /* Pulled off the bus by hid_sim_set_present() */
+    hid_device *handle;         /* The handle open on it, if any */
+    unsigned char led[3];
+    unsigned char motors[4];
+    unsigned char buzzer[4];
+    unsigned char received;     /* Reports received, reported by 'z' */
+};
+
+/* A reply on its way back from the device. */
+struct sim_reply {
+    unsigned char data[SIM_REPORT_SIZE];
+    long long ready_at;         /* When it can be read (CLOCK_MONOTONIC ns) */
+};
+
+struct hid_device_ {
+    int index;                  /* Which simulated Finch */
+    int blocking;
+
+    /* The replies not yet read, oldest first, in a ring of queue_depth
+       slots. */
+    struct sim_reply *replies;
+    int queue_depth;
+    int queue_policy;
+    int head;
+    int count;
+    unsigned long dropped_reports;
+    long long last_ready_at;    /* Replies can't overtake each other */
+    unsigned long long rng;     /* For the jitter */
+    int dead;                   /* The Finch was pulled out since this was opened */
+    int drop;                   /* Replies still to be lost, from hid_sim_drop_replies() */
+
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+};
+
+static struct sim_config config;
+static struct sim_finch finches[MAX_SIM_DEVICES];
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t finches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_ns(long long ns) {
+    struct timespec ts;
+
+    if (ns <= 0) {
+        return;
+    }
+    ts.tv_sec = (time_t) (ns / 1000000000LL);
+    ts.tv_nsec = (long) (ns % 1000000000LL);
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+}
+
+static long env_long(const char *name, long def) {
+    const char *value = getenv(name);
+    char *end;
+    long result;
+
+    if (!value || !*value) {
+        return def;
+    }
+    result = strtol(value, &end, 10);
+    return (end == value) ? def : result;
+}
+
+/* Reads a comma separated list of count numbers into values, leaving
+   them alone if the variable isn't set or can't be read. */
+static void env_doubles(const char *name, double *values, int count) {
+    const char *value = getenv(name);
+    double parsed[3];
+    int i;
+
+    if (!value || count > 3) {
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        char *end;
+        parsed[i] = strtod(value, &end);
+        if (end == value) {
+            return;
+        }
+        value = end;
+        if (i < count - 1) {
+            if (*value != ',') {
+                return;
+            }
+            value++;
+        }
+    }
+    memcpy(values, parsed, sizeof(double) * (size_t) count);
+}
+
+static unsigned char clamp_byte(double value) {
+    if (value < 0) {
+        return 0;
+    }
+    if (value > 255) {
+        return 255;
+    }
+    return (unsigned char) (value + 0.5);
+}
+
+/* The raw accelerometer reading for g G's; the inverse of what Finch.cpp
+   does with an 'A' report. */
+static unsigned char encode_acceleration(double g) {
+    double raw = g * 32 / 1.5;
+
+    if (raw > 31) {
+        raw = 31;
+    }
+    if (raw < -32) {
+        raw = -32;
+    }
+    return (unsigned char) ((raw < 0) ? (int) (64 + raw + 0.5) : (int) (raw + 0.5));
+}
+
+static void read_config(void) {
+    double temperature = 25;
+    double accel[3] = { 0, 0, 1 };
+    double light[2] = { 100, 100 };
+    double obstacles[2] = { 0, 0 };
+    int i;
+
+    config.num_devices = (int) env_long("FINCH_SIM_DEVICES", 1);
+    if (config.num_devices < 0) {
+        config.num_devices = 0;
+    }
+    if (config.num_devices > MAX_SIM_DEVICES) {
+        config.num_devices = MAX_SIM_DEVICES;
+    }
+    config.latency_ns = env_long("FINCH_SIM_LATENCY_US", 1000) * 1000LL;
+    config.jitter_ns = env_long("FINCH_SIM_JITTER_US", 0) * 1000LL;
+    config.write_ns = env_long("FINCH_SIM_WRITE_US", 0) * 1000LL;
+    config.seed = (unsigned long) env_long("FINCH_SIM_SEED", 1);
+    if (config.latency_ns < 0) {
+        config.latency_ns = 0;
+    }
+    if (config.jitter_ns < 0) {
+        config.jitter_ns = 0;
+    }
+
+    env_doubles("FINCH_SIM_TEMPERATURE", &temperature, 1);
+    env_doubles("FINCH_SIM_ACCEL", accel, 3);
+    env_doubles("FINCH_SIM_LIGHT", light, 2);
+    env_doubles("FINCH_SIM_OBSTACLES", obstacles, 2);
+
+    config.temperature = clamp_byte((temperature - 25) * 2.4 + 127);
+    for (i = 0; i < 3; i++) {
+        config.accel[i] = encode_acceleration(accel[i]);
+    }
+    for (i = 0; i < 2; i++) {
+        config.light[i] = clamp_byte(light[i]);
+        config.obstacles[i] = (obstacles[i] >= 0.5) ? 1 : 0;
+    }
+}
+
+/* xorshift64*, so the jitter is the same from run to run for a seed. */
+static unsigned long long next_random(hid_device *dev) {
+    dev->rng ^= dev->rng >> 12;
+    dev->rng ^= dev->rng << 25;
+    dev->rng ^= dev->rng >> 27;
+    return dev->rng * 2685821657736338717ULL;
+}
+
+/* Queues a reply, due one round trip from now. Called with the mutex
+   held. */
+static void queue_reply(hid_device *dev, const unsigned char *data) {
+    long long ready_at = now_ns() + __atomic_load_n(&config.latency_ns, __ATOMIC_RELAXED);
+    struct sim_reply *reply;
+
+    if (dev->drop > 0) {
+        dev->drop--;
+        return;
+    }
+
+    if (config.jitter_ns > 0) {
+        ready_at += (long long) (next_random(dev) % (unsigned long long) (config.jitter_ns + 1));
+    }
+    if (ready_at < dev->last_ready_at) {
+        ready_at = dev->last_ready_at;
+    }
+    dev->last_ready_at = ready_at;
+
+    if (dev->count == dev->queue_depth) {
+        dev->dropped_reports++;
+        if (dev->queue_policy != HID_QUEUE_DROP_OLDEST) {
+            /* Drop the newest; there's no holding the reply back at
+               the device, so HID_QUEUE_BLOCK does the same. */
+            return;
+        }
+        dev->head = (dev->head + 1) % dev->queue_depth;
+        dev->count--;
+    }
+    reply = &dev->replies[(dev->head + dev->count) % dev->queue_depth];
+    memcpy(reply->data, data, SIM_REPORT_SIZE);
+    reply->ready_at = ready_at;
+    dev->count++;
+    pthread_cond_broadcast(&dev->condition);
+}
+
+/* What the Finch does with a command report (without the report ID).
+   Called with the mutex held. */
+static void handle_command(hid_device *dev, const unsigned char *command, size_t length) {
+    struct sim_finch *finch = &finches[dev->index];
+    unsigned char args[7];
+    unsigned char reply[SIM_REPORT_SIZE];
+    int has_reply = 1;
+
+    memset(args, 0, sizeof(args));
+    memcpy(args, command + 1, (length - 1 < sizeof(args)) ? length - 1 : sizeof(args));
+    memset(reply, 0, sizeof(reply));
+    finch->received++;
+
+    switch (command[0]) {
+    case 'O':
+        memcpy(finch->led, args, sizeof(finch->led));
+        has_reply = 0;
+        break;
+    case 'M':
+        memcpy(finch->motors, args, sizeof(finch->motors));
+        has_reply = 0;
+        break;
+    case 'B':
+        memcpy(finch->buzzer, args, sizeof(finch->buzzer));
+        has_reply = 0;
+        break;
+    case 'R':
+        /* Back to idle: everything off. */
+        memset(finch->led, 0, sizeof(finch->led));
+        memset(finch->motors, 0, sizeof(finch->motors));
+        memset(finch->buzzer, 0, sizeof(finch->buzzer));
+        has_reply = 0;
+        break;
+    case 'T':
+        reply[0] = config.temperature;
+        break;
+    case 'A':
+        reply[1] = config.accel[0];
+        reply[2] = config.accel[1];
+        reply[3] = config.accel[2];
+        break;
+    case 'L':
+        reply[0] = config.light[0];
+        reply[1] = config.light[1];
+        break;
+    case 'I':
+        reply[0] = config.obstacles[0];
+        reply[1] = config.obstacles[1];
+        break;
+    case 'z':
+        reply[0] = finch->received;
+        break;
+    default:
+        has_reply = 0;
+        break;
+    }
+
+    if (has_reply) {
+        /* The report counter, from byte 8 of the command report. */
+        reply[7] = args[6];
+        queue_reply(dev, reply);
+    }
+}
+
+static int parse_path(const char *path) {
+    const size_t prefix = strlen(SIM_PATH_PREFIX);
+    char *end;
+    long index;
+
+    if (strncmp(path, SIM_PATH_PREFIX, prefix) != 0) {
+        return -1;
+    }
+    index = strtol(path + prefix, &end, 10);
+    if (end == path + prefix || *end != '\0' || index < 0 || index >= config.num_devices) {
+        return -1;
+    }
+    return (int) index;
+}
+
+static hid_device *new_hid_device(int index) {
+    hid_device *dev = calloc(1, sizeof(hid_device));
+    pthread_condattr_t cond_attr;
+
+    dev->index = index;
+    dev->blocking = 1;
+    dev->queue_depth = DEFAULT_INPUT_QUEUE_DEPTH;
+    dev->queue_policy = HID_QUEUE_DROP_OLDEST;
+    dev->replies = calloc((size_t) dev->queue_depth, sizeof(struct sim_reply));
+    dev->rng = (unsigned long long) config.seed * 0x9E3779B97F4A7C15ULL + (unsigned long long) index + 1;
+
+    pthread_mutex_init(&dev->mutex, NULL);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dev->condition, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    return dev;
+}
+
+static void free_hid_device(hid_device *dev) {
+    pthread_cond_destroy(&dev->condition);
+    pthread_mutex_destroy(&dev->mutex);
+    free(dev->replies);
+    free(dev);
+}
+
+static wchar_t *serial_number(int index) {
+    wchar_t buf[32];
+    swprintf(buf, sizeof(buf) / sizeof(buf[0]), L"SIM%04d", index);
+    return wcsdup(buf);
+}
+
+
+int HID_API_EXPORT hid_init(void) {
+    pthread_once(&config_once, read_config);
+    return 0;
+}
+
+int HID_API_EXPORT hid_exit(void) {
+    /* Nothing to do for this in the simulation. */
+    return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id) {
+    return hid_enumerate_filtered(vendor_id, product_id, HID_ENUMERATE_STRINGS);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_filtered(unsigned short vendor_id, unsigned short product_id, int flags) {
+    struct hid_device_info *root = NULL; // return object
+    struct hid_device_info *cur_dev = NULL;
+    int i;
+
+    hid_init();
+
+    if (!(vendor_id == 0x0 && product_id == 0x0) &&
+            !(vendor_id == SIM_VENDOR_ID && product_id == SIM_PRODUCT_ID)) {
+        return NULL;
+    }
+
+    for (i = 0; i < config.num_devices; i++) {
+        struct hid_device_info *tmp;
+        char path[32];
+        int absent;
+
+        pthread_mutex_lock(&finches_mutex);
+        absent = finches[i].absent;
+        pthread_mutex_unlock(&finches_mutex);
+        if (absent) {
+            continue;
+        }
+
+        tmp = calloc(1, sizeof(struct hid_device_info));
+
+        if (cur_dev) {
+            cur_dev->next = tmp;
+        }
+        else {
+            root = tmp;
+        }
+        cur_dev = tmp;
+
+        snprintf(path, sizeof(path), SIM_PATH_PREFIX "%d", i);
+        cur_dev->path = strdup(path);
+        cur_dev->vendor_id = SIM_VENDOR_ID;
+        cur_dev->product_id = SIM_PRODUCT_ID;
+        if (flags & HID_ENUMERATE_SERIAL_NUMBER) {
+            cur_dev->serial_number = serial_number(i);
+        }
+        if (flags & HID_ENUMERATE_NAMES) {
+            cur_dev->manufacturer_string = wcsdup(L"BirdBrain Technologies");
+            cur_dev->product_string = wcsdup(L"Finch (simulated)");
+        }
+        cur_dev->interface_number = 0;
+        cur_dev->next = NULL;
+    }
+
+    return root;
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs) {
+    struct hid_device_info *d = devs;
+    while (d) {
+        struct hid_device_info *next = d->next;
+        free(d->path);
+        free(d->serial_number);
+        free(d->manufacturer_string);
+        free(d->product_string);
+        free(d);
+        d = next;
+    }
+}
+
+hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, wchar_t *serial_number) {
+    struct hid_device_info *devs, *cur_dev;
+    const char *path_to_open = NULL;
+    hid_device *handle = NULL;
+
+    devs = hid_enumerate_filtered(vendor_id, product_id,
+                                  serial_number ? HID_ENUMERATE_SERIAL_NUMBER : 0);
+    cur_dev = devs;
+    while (cur_dev) {
+        if (serial_number) {
+            if (cur_dev->serial_number &&
+                    wcscmp(serial_number, cur_dev->serial_number) == 0) {
+                path_to_open = cur_dev->path;
+                break;
+            }
+        }
+        else {
+            path_to_open = cur_dev->path;
+            break;
+        }
+        cur_dev = cur_dev->next;
+    }
+
+    if (path_to_open) {
+        /* Open the device */
+        handle = hid_open_path(path_to_open);
+    }
+
+    hid_free_enumeration(devs);
+
+    return handle;
+}
+
+int HID_API_EXPORT hid_set_event_mode(int mode) {
+    /* There are no USB events to wait for. */
+    return (mode == HID_EVENTS_SHARED || mode == HID_EVENTS_PER_DEVICE) ? 0 : -1;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path) {
+    int index;
+
+    hid_init();
+
+    index = parse_path(path);
+    if (index < 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&finches_mutex);
+    if (finches[index].open || finches[index].absent) {
+        pthread_mutex_unlock(&finches_mutex);
+        return NULL;
+    }
+    finches[index].open = 1;
+    finches[index].handle = new_hid_device(index);
+    pthread_mutex_unlock(&finches_mutex);
+
+    return finches[index].handle;
+}
+
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length) {
+    if (length < 2) {
+        return -1;
+    }
+
+    sleep_ns(config.write_ns);
+
+    /* Leave the report ID off, as the device never sees it. */
+    pthread_mutex_lock(&dev->mutex);
+    if (dev->dead) {
+        pthread_mutex_unlock(&dev->mutex);
+        return -1;
+    }
+    handle_command(dev, data + 1, length - 1);
+    pthread_mutex_unlock(&dev->mutex);
+
+    return (int) length;
+}
+
+int HID_API_EXPORT hid_write_async(hid_device *dev, const unsigned char *data, size_t length, hid_write_callback callback, void *user_data) {
+    return hid_write_batch(dev, data, length, 1, callback, user_data);
+}
+
+int HID_API_EXPORT hid_write_batch(hid_device *dev, const unsigned char *data, size_t report_length, size_t count, hid_write_callback callback, void *user_data) {
+    /* The simulated writes finish straight away, so the reports are
+       simply written one after the other. */
+    int written = 0;
+    size_t i;
+
+    if (report_length == 0) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (hid_write(dev, data + i * report_length, report_length) < 0) {
+            break;
+        }
+        written++;
+    }
+    if (callback) {
+        callback(dev, user_data, written);
+    }
+    return 0;
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds) {
+    const long long deadline = (milliseconds > 0) ? now_ns() + milliseconds * 1000000LL : 0;
+    int bytes_read = 0;
+
+    pthread_mutex_lock(&dev->mutex);
+    for (;;) {
+        const long long now = now_ns();
+        long long wake_at;
+
+        if (dev->dead) {
+            bytes_read = -1;
+            break;
+        }
+        if (dev->count > 0 && dev->replies[dev->head].ready_at <= now) {
+            struct sim_reply *reply = &dev->replies[dev->head];
+            bytes_read = (int) ((length < SIM_REPORT_SIZE) ? length : SIM_REPORT_SIZE);
+            memcpy(data, reply->data, (size_t) bytes_read);
+            dev->head = (dev->head + 1) % dev->queue_depth;
+            dev->count--;
+            break;
+        }
+        if (milliseconds == 0 || (milliseconds > 0 && now >= deadline)) {
+            break;
+        }
+
+        /* Sleep until the next reply is due, or the timeout. */
+        wake_at = (milliseconds > 0) ? deadline : 0;
+        if (dev->count > 0 && (wake_at == 0 || dev->replies[dev->head].ready_at < wake_at)) {
+            wake_at = dev->replies[dev->head].ready_at;
+        }
+        if (wake_at == 0) {
+            pthread_cond_wait(&dev->condition, &dev->mutex);
+        }
+        else {
+            struct timespec ts;
+            ts.tv_sec = (time_t) (wake_at / 1000000000LL);
+            ts.tv_nsec = (long) (wake_at % 1000000000LL);
+            pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&dev->mutex);
+
+    return bytes_read;
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length) {
+    return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
+}
+
+int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock) {
+    dev->blocking = !nonblock;
+
+    return 0;
+}
+
+int HID_API_EXPORT hid_set_input_queue(hid_device *dev, int depth, int policy) {
+    struct sim_reply *replies;
+    int keep;
+    int i;
+
+    if (depth < 1 || policy < HID_QUEUE_DROP_OLDEST || policy > HID_QUEUE_BLOCK) {
+        return -1;
+    }
+    replies = calloc((size_t) depth, sizeof(struct sim_reply));
+    if (!replies) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dev->mutex);
+
+    /* Keep the newest replies, if they don't all fit any more. */
+    keep = (dev->count < depth) ? dev->count : depth;
+    dev->dropped_reports += (unsigned long) (dev->count - keep);
+    for (i = 0; i < keep; i++) {
+        replies[i] = dev->replies[(dev->head + dev->count - keep + i) % dev->queue_depth];
+    }
+    free(dev->replies);
+    dev->replies = replies;
+    dev->queue_depth = depth;
+    dev->queue_policy = policy;
+    dev->head = 0;
+    dev->count = keep;
+
+    pthread_mutex_unlock(&dev->mutex);
+
+    return 0;
+}
+
+unsigned long HID_API_EXPORT hid_get_dropped_input_reports(hid_device *dev) {
+    unsigned long dropped;
+
+    pthread_mutex_lock(&dev->mutex);
+    dropped = dev->dropped_reports;
+    pthread_mutex_unlock(&dev->mutex);
+
+    return dropped;
+}
+
+int HID_API_EXPORT hid_set_input_transfers(hid_device *dev, int count) {
+    /* There are no transfers to keep waiting. */
+    (void) dev;
+
+    return (count >= 1 && count <= 32) ? 0 : -1;
+}
+
+int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length) {
+    /* The Finch has no feature reports. */
+    (void) dev;
+    (void) data;
+    (void) length;
+
+    return -1;
+}
+
+int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length) {
+    (void) dev;
+    (void) data;
+    (void) length;
+
+    return -1;
+}
+
+
+void HID_API_EXPORT hid_close(hid_device *dev) {
+    if (!dev) {
+        return;
+    }
+
+    pthread_mutex_lock(&finches_mutex);
+    if (finches[dev->index].handle == dev) {
+        finches[dev->index].open = 0;
+        finches[dev->index].handle = NULL;
+    }
+    pthread_mutex_unlock(&finches_mutex);
+
+    free_hid_device(dev);
+}
+
+
+static int copy_string(const wchar_t *str, wchar_t *string, size_t maxlen) {
+    if (maxlen == 0) {
+        return -1;
+    }
+    wcsncpy(string, str, maxlen);
+    string[maxlen - 1] = L'\0';
+
+    return 0;
+}
+
+int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    (void) dev;
+
+    return copy_string(L"BirdBrain Technologies", string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_product_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    (void) dev;
+
+    return copy_string(L"Finch (simulated)", string, maxlen);
+}
+
+int HID_API_EXPORT_CALL hid_get_serial_number_string(hid_device *dev, wchar_t *string, size_t maxlen) {
+    wchar_t *str = serial_number(dev->index);
+    int res = copy_string(str, string, maxlen);
+
+    free(str);
+    return res;
+}
+
+int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index, wchar_t *string, size_t maxlen) {
+    (void) dev;
+    (void) string_index;
+    (void) string;
+    (void) maxlen;
+
+    return -1;
+}
+
+
+int HID_API_EXPORT HID_API_CALL hid_sim_set_present(int index, int present) {
+    struct sim_finch *finch;
+
+    hid_init();
+    if (index < 0 || index >= config.num_devices) {
+        return -1;
+    }
+    finch = &finches[index];
+
+    pthread_mutex_lock(&finches_mutex);
+    if (!present && !finch->absent) {
+        /* Whoever is waiting on the handle finds it dead. */
+        finch->absent = 1;
+        if (finch->handle) {
+            pthread_mutex_lock(&finch->handle->mutex);
+            finch->handle->dead = 1;
+            pthread_cond_broadcast(&finch->handle->condition);
+            pthread_mutex_unlock(&finch->handle->mutex);
+        }
+    }
+    else if (present && finch->absent) {
+        /* Back in idle mode; the old handle (if still open) stays dead,
+           but no longer counts as having the Finch open. */
+        finch->absent = 0;
+        finch->open = 0;
+        finch->handle = NULL;
+        memset(finch->led, 0, sizeof(finch->led));
+        memset(finch->motors, 0, sizeof(finch->motors));
+        memset(finch->buzzer, 0, sizeof(finch->buzzer));
+    }
+    pthread_mutex_unlock(&finches_mutex);
+
+    return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_sim_drop_replies(int index, int count) {
+    hid_init();
+    if (index < 0 || index >= config.num_devices) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&finches_mutex);
+    if (finches[index].handle) {
+        pthread_mutex_lock(&finches[index].handle->mutex);
+        finches[index].handle->drop += count;
+        pthread_mutex_unlock(&finches[index].handle->mutex);
+    }
+    pthread_mutex_unlock(&finches_mutex);
+
+    return 0;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_sim_set_latency(long microseconds) {
+    hid_init();
+    __atomic_store_n(&config.latency_ns, (microseconds > 0) ? microseconds * 1000LL : 0, __ATOMIC_RELAXED);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_sim_get_outputs(int index, unsigned char *led, unsigned char *motors, unsigned char *buzzer) {
+    struct sim_finch *finch;
+
+    hid_init();
+    if (index < 0 || index >= config.num_devices) {
+        return -1;
+    }
+    finch = &finches[index];
+
+    /* The outputs are changed under the open handle's mutex. */
+    pthread_mutex_lock(&finches_mutex);
+    if (finch->handle) {
+        pthread_mutex_lock(&finch->handle->mutex);
+    }
+    if (led) {
+        memcpy(led, finch->led, sizeof(finch->led));
+    }
+    if (motors) {
+        memcpy(motors, finch->motors, sizeof(finch->motors));
+    }
+    if (buzzer) {
+        memcpy(buzzer, finch->buzzer, sizeof(finch->buzzer));
+    }
+    if (finch->handle) {
+        pthread_mutex_unlock(&finch->handle->mutex);
+    }
+    pthread_mutex_unlock(&finches_mutex);
+
+    return 0;
+}
+
+
+HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev) {
+    (void) dev;
+
+    return NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
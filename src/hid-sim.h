@@ -0,0 +1,50 @@
+/*******************************************************
+ Simulated Finch backend: test hooks
+
+ Extra entry points provided only by the simulated backend (hid-sim.c),
+ so that test programs can do to a simulated Finch what would take a
+ hand on the cable with a real one.
+********************************************************/
+
+#ifndef HID_SIM_H__
+#define HID_SIM_H__
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Pulls simulated Finch number @p index off the bus (@p present = 0)
+    or plugs it back in (@p present = 1). While it's out it isn't
+    enumerated and can't be opened, and every read and write on a
+    handle opened on it fails. It comes back in idle mode, and handles
+    opened before it was pulled out stay dead.
+
+    @returns 0 on success, -1 if there's no such Finch. */
+int HID_API_EXPORT HID_API_CALL hid_sim_set_present(int index, int present);
+
+/** Throws away the next @p count replies from simulated Finch number
+    @p index, as if they had been lost on the way.
+
+    @returns 0 on success, -1 if there's no such Finch. */
+int HID_API_EXPORT HID_API_CALL hid_sim_drop_replies(int index, int count);
+
+/** Sets the round-trip latency, in microseconds, for replies to
+    commands written from now on (FINCH_SIM_LATENCY_US sets the
+    starting value). */
+void HID_API_EXPORT HID_API_CALL hid_sim_set_latency(long microseconds);
+
+/** Copies out what simulated Finch number @p index has its outputs set
+    to: the arguments of the last 'O' (3 bytes), 'M' (4 bytes) and 'B'
+    (4 bytes) commands it took, all zero in idle mode. Any of the
+    buffers may be NULL.
+
+    @returns 0 on success, -1 if there's no such Finch. */
+int HID_API_EXPORT HID_API_CALL hid_sim_get_outputs(int index, unsigned char *led, unsigned char *motors, unsigned char *buzzer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -77,6 +77,33 @@ struct hid_device_info {
 };
 
 
+/** @brief Initialize the HIDAPI library.
+
+    Calling this is not strictly necessary, as hid_enumerate() and
+    the hid_open*() functions call it when it's needed. It can be
+    called more than once. (The Mac backend has nothing to set up,
+    and doesn't provide it.)
+
+    @ingroup API
+
+    @returns
+        This function returns 0 on success and -1 on error.
+*/
+int HID_API_EXPORT HID_API_CALL hid_init(void);
+
+/** @brief Finalize the HIDAPI library.
+
+    Frees whatever hid_init() set up, where the backend has
+    anything to free. Call it at the end of execution, once every
+    device has been closed. (The Mac backend doesn't provide it.)
+
+    @ingroup API
+
+    @returns
+        This function returns 0 on success and -1 on error.
+*/
+int HID_API_EXPORT HID_API_CALL hid_exit(void);
+
 /** @brief Enumerate the HID Devices.
 
     This function returns a linked list of all the HID devices
@@ -98,6 +125,43 @@ struct hid_device_info {
 */
 struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id);
 
+/** Which strings hid_enumerate_filtered() fetches from each device. */
+enum hid_enumerate_flags {
+    /** The serial number. */
+    HID_ENUMERATE_SERIAL_NUMBER = 1,
+    /** The manufacturer and product strings. */
+    HID_ENUMERATE_NAMES = 2,
+    /** All of them, as hid_enumerate() does. */
+    HID_ENUMERATE_STRINGS = 3
+};
+
+/** @brief Enumerate the HID Devices, fetching only the strings
+    asked for.
+
+    Like hid_enumerate(), but a device is only opened to read its
+    strings if @p flags asks for them; those not asked for are
+    left NULL. Devices that don't match @p vendor_id and
+    @p product_id are passed over without looking any further
+    than their device descriptor. The devices found are
+    remembered, so hid_open_path() can go straight to them rather
+    than look through every device again.
+
+    @ingroup API
+    @param vendor_id The Vendor ID (VID) of the types of device
+        to open.
+    @param product_id The Product ID (PID) of the types of
+        device to open.
+    @param flags Which strings to fetch: 0 for none, or a
+        combination of the values of enum hid_enumerate_flags.
+
+    @returns
+        This function returns a pointer to a linked list of type
+        struct #hid_device, containing information about the HID devices
+        attached to the system, or NULL in the case of failure. Free
+        this linked list by calling hid_free_enumeration().
+*/
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_filtered(unsigned short vendor_id, unsigned short product_id, int flags);
+
 /** @brief Free an enumeration Linked List
 
     This function frees a linked list created by hid_enumerate().
@@ -108,6 +172,31 @@ struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned shor
 */
 void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs);
 
+/** How the library waits for USB events (Linux/libusb only). */
+enum hid_event_mode {
+    /** One thread, shared by every open device (the default). */
+    HID_EVENTS_SHARED = 0,
+    /** A thread of its own for each open device. */
+    HID_EVENTS_PER_DEVICE = 1
+};
+
+/** @brief Choose how devices opened from now on wait for USB
+    events.
+
+    By default a single thread, waiting on all of libusb's file
+    descriptors at once, handles the events of every open
+    device, so opening more devices doesn't mean more threads.
+    Devices already open are not affected. Has no effect on
+    platforms where the operating system does the reading.
+
+    @ingroup API
+    @param mode One of the values of enum hid_event_mode.
+
+    @returns
+        This function returns 0 on success and -1 on error.
+*/
+int HID_API_EXPORT HID_API_CALL hid_set_event_mode(int mode);
+
 /** @brief Open a HID device using a Vendor ID (VID), Product ID
     (PID) and optionally a serial number.
 
@@ -169,6 +258,64 @@ HID_API_EXPORT hid_device * HID_API_CALL hid_open_path(const char *path);
 */
 int  HID_API_EXPORT HID_API_CALL hid_write(hid_device *device, const unsigned char *data, size_t length);
 
+/** Called when a write started by hid_write_async() or
+    hid_write_batch() has finished, with the number of reports
+    that were written successfully. */
+typedef void (HID_API_CALL *hid_write_callback)(hid_device *device, void *user_data, int written);
+
+/** @brief Write an Output report to a HID device, without
+    waiting for it to go out.
+
+    The same as hid_write_batch() with a single report.
+
+    @ingroup API
+    @param device A device handle returned from hid_open().
+    @param data The data to send, including the report number as
+        the first byte.
+    @param length The length in bytes of the data to send.
+    @param callback Called once the report has gone out (or
+        failed to); may be NULL.
+    @param user_data Passed to @p callback.
+
+    @returns
+        This function returns 0 if the report was submitted and
+        -1 on error.
+*/
+int  HID_API_EXPORT HID_API_CALL hid_write_async(hid_device *device, const unsigned char *data, size_t length, hid_write_callback callback, void *user_data);
+
+/** @brief Write a batch of Output reports to a HID device,
+    without waiting for them to go out.
+
+    The reports are laid out back to back in @p data[], each
+    @p report_length bytes long and starting with its Report ID,
+    as for hid_write(). They are all submitted at once, and reach
+    the device in order. @p data[] may be reused as soon as this
+    function returns.
+
+    Once every report has gone out (or failed to), @p callback is
+    called exactly once, with the number written successfully.
+    It may be called from the library's own thread, or from this
+    one before hid_write_batch() returns, and must not block.
+    Where there is no OUT endpoint (or on platforms without
+    asynchronous writes), the reports are written one after the
+    other before this function returns.
+
+    @ingroup API
+    @param device A device handle returned from hid_open().
+    @param data The reports to send.
+    @param report_length The length in bytes of each report,
+        including the report number.
+    @param count The number of reports.
+    @param callback Called once the batch has finished; may be
+        NULL.
+    @param user_data Passed to @p callback.
+
+    @returns
+        This function returns 0 if the batch was submitted (in
+        which case @p callback will be called) and -1 on error.
+*/
+int  HID_API_EXPORT HID_API_CALL hid_write_batch(hid_device *device, const unsigned char *data, size_t report_length, size_t count, hid_write_callback callback, void *user_data);
+
 /** @brief Read an Input report from a HID device.
 
     Input reports are returned
@@ -188,6 +335,27 @@ int  HID_API_EXPORT HID_API_CALL hid_write(hid_device *device, const unsigned ch
 */
 int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *data, size_t length);
 
+/** @brief Read an Input report from a HID device, waiting at most
+    a given time for one to arrive.
+
+    As hid_read(), but rather than waiting as long as it takes (or
+    not at all, in non-blocking mode), it waits up to @p milliseconds.
+
+    @ingroup API
+    @param device A device handle returned from hid_open().
+    @param data A buffer to put the read data into.
+    @param length The number of bytes to read. For devices with
+        multiple reports, make sure to read an extra byte for
+        the report number.
+    @param milliseconds How long to wait: 0 not to wait at all,
+        -1 to wait as long as it takes.
+
+    @returns
+        This function returns the actual number of bytes read, 0
+        if no report arrived in time, and -1 on error.
+*/
+int  HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *device, unsigned char *data, size_t length, int milliseconds);
+
 /** @brief Set the device handle to be non-blocking.
 
     In non-blocking mode calls to hid_read() will return
@@ -208,6 +376,69 @@ int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *dat
 */
 int  HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *device, int nonblock);
 
+/** What to do with an input report that arrives when the input
+    queue is already full. */
+enum hid_queue_policy {
+    /** Drop the oldest queued report to make room (the default). */
+    HID_QUEUE_DROP_OLDEST = 0,
+    /** Drop the report that just arrived. */
+    HID_QUEUE_DROP_NEWEST = 1,
+    /** Stop reading from the device until hid_read() makes room,
+        leaving the reports with the device. */
+    HID_QUEUE_BLOCK = 2
+};
+
+/** @brief Set the size of the device's input report queue.
+
+    Input reports are queued up as they arrive, until they are
+    read with hid_read(). By default up to 32 are queued, and
+    the oldest is dropped to make room for a new one. Reports
+    already queued are kept (the newest of them, if there are
+    more than @p depth). With the Linux hidraw backend the kernel
+    keeps the queue itself (64 reports, dropping the newest), so
+    this always fails there.
+
+    @ingroup API
+    @param device A device handle returned from hid_open().
+    @param depth The number of reports to queue, at least 1.
+    @param policy What to do when the queue is full; one of
+        the values of enum hid_queue_policy.
+
+    @returns
+        This function returns 0 on success and -1 on error.
+*/
+int  HID_API_EXPORT HID_API_CALL hid_set_input_queue(hid_device *device, int depth, int policy);
+
+/** @brief Get the number of input reports dropped because the
+    input queue was full.
+
+    @ingroup API
+    @param device A device handle returned from hid_open().
+
+    @returns
+        This function returns the number of reports dropped since
+        the device was opened.
+*/
+unsigned long HID_API_EXPORT HID_API_CALL hid_get_dropped_input_reports(hid_device *device);
+
+/** @brief Set the number of input transfers kept waiting for the
+    device.
+
+    While one input report is being dealt with, the others are
+    still there to receive the next ones, so nothing is missed
+    at high report rates. Reports are always queued in the order
+    they were received. The default is 4. Has no effect on
+    platforms where the operating system does the reading.
+
+    @ingroup API
+    @param device A device handle returned from hid_open().
+    @param count The number of transfers, from 1 to 32.
+
+    @returns
+        This function returns 0 on success and -1 on error.
+*/
+int  HID_API_EXPORT HID_API_CALL hid_set_input_transfers(hid_device *device, int count);
+
 /** @brief Send a Feature report to the device.
 
     Feature reports are sent over the Control endpoint as a